@@ -65,6 +65,13 @@ static inline tcg_target_ulong cpu_tb_exec(CPUState *cpu, uint8_t *tb_ptr)
 #endif /* DEBUG_DISAS */
 
     next_tb = tcg_qemu_tb_exec(env, tb_ptr);
+    if (next_tb != 0) {
+        /* The TB we left from may have been reached through chained
+           jumps, which tb_find_fast() never saw. A hot chained loop
+           still leaves for every interrupt, so its regions stay in use. */
+        tb_mark_used(&tcg_ctx.tb_ctx,
+                     (TranslationBlock *)(next_tb & ~TB_EXIT_MASK));
+    }
     if ((next_tb & TB_EXIT_MASK) > TB_EXIT_IDX1) {
         /* We didn't start executing this TB (eg because the instruction
          * counter hit zero); we must restore the guest PC to the address
@@ -184,6 +191,7 @@ static inline TranslationBlock *tb_find_fast(CPUArchState *env)
                  tb->flags != flags)) {
         tb = tb_find_slow(env, pc, cs_base, flags);
     }
+    tb_mark_used(&tcg_ctx.tb_ctx, tb);
     return tb;
 }
 
@@ -272,6 +280,12 @@ int cpu_exec(CPUArchState *env)
 #elif defined(TARGET_MICROBLAZE)
 #elif defined(TARGET_MIPS)
 #elif defined(TARGET_RISCV)
+#if !defined(CONFIG_USER_ONLY)
+    /* Other harts only run while this hart is outside cpu_exec(), so an
+       LR reservation does not survive them. DMA from AIO worker threads
+       can still land in between, see helper_sc() */
+    env->load_res = -1;
+#endif
 #elif defined(TARGET_MOXIE)
 #elif defined(TARGET_OPENRISC)
 #elif defined(TARGET_SH4)
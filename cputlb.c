@@ -27,12 +27,157 @@
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
+#include "qemu/timer.h"
+#include "qemu/error-report.h"
+#include "sysemu/sysemu.h"
 
 //#define DEBUG_TLB
 //#define DEBUG_TLB_CHECK
 
 /* statistics */
 int tlb_flush_count;
+uint64_t tlb_victim_hit_count;
+int tlb_resize_count;
+int tlb_large_page_flush_count;
+
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
+}
+
+static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
+                             size_t max_entries)
+{
+    desc->window_begin_ns = ns;
+    desc->window_max_entries = max_entries;
+    desc->window_evictions = 0;
+}
+
+#if CPU_TLB_DYN
+/* Bounds set with -tlb, in entries */
+static size_t tlb_dyn_min = 1 << CPU_TLB_DYN_MIN_BITS;
+static size_t tlb_dyn_max = 1 << CPU_TLB_DYN_MAX_BITS;
+
+/* Round n to a power of two within [lo, hi] */
+static size_t tlb_clamp_entries(size_t n, size_t lo, size_t hi)
+{
+    size_t p = lo;
+
+    while (p < n && p < hi) {
+        p <<= 1;
+    }
+    return p;
+}
+
+static void tlb_mmu_alloc(CPUArchState *env, int mmu_idx, size_t n_entries)
+{
+    g_free(env->tlb_table[mmu_idx]);
+    g_free(env->iotlb[mmu_idx]);
+    env->tlb_mask[mmu_idx] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
+    env->tlb_table[mmu_idx] = g_new(CPUTLBEntry, n_entries);
+    env->iotlb[mmu_idx] = g_new(hwaddr, n_entries);
+}
+
+/* Pick the size of the TLB of an MMU mode for the next period, from what
+ * was observed since the last flush. The window covers at least 100 ms,
+ * so a single short burst does not shrink the table.
+ *
+ * - Grow if more than 70% of the entries were in use, or if more valid
+ *   entries were evicted by conflicts than there are entries: the working
+ *   set does not fit.
+ * - Shrink if less than 30% were in use during the whole window, to the
+ *   smallest power of two that keeps the peak under 70%.
+ *
+ * This only runs on a flush, when the table is empty anyway, so lookups
+ * that hold an index across tlb_fill() are not affected. */
+static void tlb_mmu_resize(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t new_size = old_size;
+    int64_t now = get_clock_realtime();
+    bool window_expired = now > desc->window_begin_ns + 100 * SCALE_MS;
+    size_t rate;
+
+    if (desc->n_used_entries > desc->window_max_entries) {
+        desc->window_max_entries = desc->n_used_entries;
+    }
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70 || desc->window_evictions > old_size) {
+        new_size = MIN(old_size << 1, tlb_dyn_max);
+    } else if (rate < 30 && window_expired) {
+        new_size = tlb_clamp_entries(desc->window_max_entries * 100 / 70,
+                                     tlb_dyn_min, tlb_dyn_max);
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            tlb_window_reset(desc, now, desc->n_used_entries);
+        }
+        return;
+    }
+    tlb_mmu_alloc(env, mmu_idx, new_size);
+    tlb_window_reset(desc, now, 0);
+    tlb_resize_count++;
+}
+#else
+static inline void tlb_mmu_resize(CPUArchState *env, int mmu_idx)
+{
+}
+#endif
+
+/* Allocate the TLB of a new CPU. The entries are invalidated by the
+ * tlb_flush() of the CPU reset. */
+void tlb_init(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int64_t now = get_clock_realtime();
+    int mmu_idx;
+
+#if CPU_TLB_DYN
+    size_t n_entries;
+
+    tlb_dyn_min = tlb_clamp_entries(tlb_entries_min ?: 1,
+                                    1 << CPU_TLB_DYN_MIN_BITS,
+                                    1 << CPU_TLB_DYN_MAX_BITS);
+    tlb_dyn_max = tlb_clamp_entries(tlb_entries_max ?: SIZE_MAX,
+                                    tlb_dyn_min, 1 << CPU_TLB_DYN_MAX_BITS);
+    n_entries = tlb_clamp_entries(tlb_entries ?: 1 << CPU_TLB_DYN_DEFAULT_BITS,
+                                  tlb_dyn_min, tlb_dyn_max);
+#else
+    static bool warned;
+
+    if ((tlb_entries || tlb_entries_min || tlb_entries_max) && !warned) {
+        error_report("-tlb: the TLB has a fixed size of %d entries on this "
+                     "host or target", CPU_TLB_SIZE);
+        warned = true;
+    }
+#endif
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+#if CPU_TLB_DYN
+        tlb_mmu_alloc(env, mmu_idx, n_entries);
+#endif
+        env->tlb_d[mmu_idx].n_used_entries = 0;
+        tlb_window_reset(&env->tlb_d[mmu_idx], now, 0);
+    }
+}
+
+static void tlb_flush_one_mmuidx(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    int k;
+
+    tlb_mmu_resize(env, mmu_idx);
+    memset(env->tlb_table[mmu_idx], -1,
+           tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
+    memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[mmu_idx]));
+    desc->n_used_entries = 0;
+    for (k = 0; k < CPU_TLB_LARGE_PAGES; k++) {
+        desc->large_page[k].addr = -1;
+        desc->large_page[k].mask = 0;
+    }
+}
 
 /* NOTE:
  * If flush_global is true (the usual case), flush all tlb entries.
@@ -49,6 +194,7 @@ int tlb_flush_count;
 void tlb_flush(CPUState *cpu, int flush_global)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -57,42 +203,163 @@ void tlb_flush(CPUState *cpu, int flush_global)
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_flush_one_mmuidx(env, mmu_idx);
+    }
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
 
-    env->tlb_flush_addr = -1;
-    env->tlb_flush_mask = 0;
+    env->vtlb_index = 0;
+    tlb_flush_count++;
+}
+
+/* Flush only the MMU modes set in idxmap. This is for targets that use
+ * MMU modes to tag entries with an address space, so that switching
+ * between address spaces does not need a full flush. */
+void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
+#if defined(DEBUG_TLB)
+    printf("tlb_flush_by_mmuidx: %" PRIx16 "\n", idxmap);
+#endif
+    cpu->current_tb = NULL;
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (idxmap & (1 << mmu_idx)) {
+            tlb_flush_one_mmuidx(env, mmu_idx);
+        }
+    }
+    /* The jump cache is keyed on virtual addresses only */
+    memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
     tlb_flush_count++;
 }
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+static inline bool tlb_hit_range(target_ulong tlb_addr, target_ulong addr,
+                                 target_ulong len)
+{
+    return ((tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK)) - addr) < len;
+}
+
+/* Invalidate tlb_entry if it maps a page in [addr, addr + len); return
+ * whether it did. addr and len are multiples of the page size. */
+static inline bool tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr,
+                                   target_ulong len)
 {
-    if (addr == (tlb_entry->addr_read &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_write &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_code &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+    if (tlb_entry_is_empty(tlb_entry)) {
+        return false;
+    }
+    if (tlb_hit_range(tlb_entry->addr_read, addr, len) ||
+        tlb_hit_range(tlb_entry->addr_write, addr, len) ||
+        tlb_hit_range(tlb_entry->addr_code, addr, len)) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
     }
+    return false;
 }
 
-void tlb_flush_page(CPUState *cpu, target_ulong addr)
+/* Evict the entries of one MMU mode for pages in [addr, addr + len). Small
+ * ranges are looked up page by page, large ones by scanning the table. */
+static void tlb_flush_entries(CPUArchState *env, int mmu_idx,
+                              target_ulong addr, target_ulong len)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    size_t n_entries = tlb_n_entries(env, mmu_idx);
+    size_t n_flushed = 0;
+    target_ulong page;
+    size_t i;
+
+    if ((len >> TARGET_PAGE_BITS) >= n_entries) {
+        for (i = 0; i < n_entries; i++) {
+            n_flushed += tlb_flush_entry(&env->tlb_table[mmu_idx][i],
+                                         addr, len);
+        }
+    } else {
+        for (page = addr; page - addr < len; page += TARGET_PAGE_SIZE) {
+            i = tlb_index(env, mmu_idx, page);
+            n_flushed += tlb_flush_entry(&env->tlb_table[mmu_idx][i],
+                                         page, TARGET_PAGE_SIZE);
+        }
+    }
+    desc->n_used_entries -= MIN(n_flushed, desc->n_used_entries);
+
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][i], addr, len);
+    }
+}
+
+static void tlb_flush_jmp_cache_range(CPUState *cpu, target_ulong addr,
+                                      target_ulong len)
+{
+    target_ulong page;
+
+    if ((len >> TARGET_PAGE_BITS) >= TB_JMP_CACHE_SIZE / TB_JMP_PAGE_SIZE) {
+        memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+        return;
+    }
+    for (page = addr; page - addr < len; page += TARGET_PAGE_SIZE) {
+        tb_flush_jmp_cache(cpu, page);
+    }
+}
+
+/* Flush [addr, addr + len) from one MMU mode. A large page that overlaps
+ * the range goes as a whole, since the guest invalidated its mapping. */
+static void tlb_flush_range_mmuidx(CPUState *cpu, int mmu_idx,
+                                   target_ulong addr, target_ulong len)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
-    int mmu_idx;
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    int k;
 
+    for (k = 0; k < CPU_TLB_LARGE_PAGES; k++) {
+        CPUTLBLargePage *lp = &desc->large_page[k];
+        target_ulong lp_addr = lp->addr;
+        target_ulong lp_len = ~lp->mask + 1;
+
+        if (lp_addr == (target_ulong)-1) {
+            continue;
+        }
+        if (lp_len == 0) {
+            /* merged up to the whole address space */
+            tlb_flush_one_mmuidx(env, mmu_idx);
+            memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+            tlb_large_page_flush_count++;
+            return;
+        }
+        if (lp_addr - addr < len || addr - lp_addr < lp_len) {
 #if defined(DEBUG_TLB)
-    printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
+            printf("tlb_flush_range: large page " TARGET_FMT_lx "/"
+                   TARGET_FMT_lx "\n", lp_addr, lp->mask);
 #endif
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
+            lp->addr = -1;
+            lp->mask = 0;
+            tlb_flush_entries(env, mmu_idx, lp_addr, lp_len);
+            tlb_flush_jmp_cache_range(cpu, lp_addr, lp_len);
+            tlb_large_page_flush_count++;
+        }
+    }
+    tlb_flush_entries(env, mmu_idx, addr, len);
+    tlb_flush_jmp_cache_range(cpu, addr, len);
+}
+
+/* Flush the pages in [addr, addr + len) from all MMU modes, together with
+ * any large page they are part of. */
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    int mmu_idx;
+
 #if defined(DEBUG_TLB)
-        printf("tlb_flush_page: forced full flush ("
-               TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-               env->tlb_flush_addr, env->tlb_flush_mask);
+    printf("tlb_flush_range: " TARGET_FMT_lx "+" TARGET_FMT_lx "\n",
+           addr, len);
 #endif
+    if (len == 0) {
+        return;
+    }
+    len = ((addr & ~TARGET_PAGE_MASK) + len + TARGET_PAGE_SIZE - 1)
+          & TARGET_PAGE_MASK;
+    addr &= TARGET_PAGE_MASK;
+    if (len == 0) {
+        /* the whole address space */
         tlb_flush(cpu, 1);
         return;
     }
@@ -100,13 +367,17 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        tlb_flush_range_mmuidx(cpu, mmu_idx, addr, len);
     }
+}
 
-    tb_flush_jmp_cache(cpu, addr);
+void tlb_flush_page(CPUState *cpu, target_ulong addr)
+{
+#if defined(DEBUG_TLB)
+    printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
+#endif
+    tlb_flush_range(cpu, addr, TARGET_PAGE_SIZE);
 }
 
 /* update the TLBs so that writes to code in the virtual page 'addr'
@@ -164,12 +435,18 @@ void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length)
 
         env = cpu->env_ptr;
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            size_t n_entries = tlb_n_entries(env, mmu_idx);
             unsigned int i;
 
-            for (i = 0; i < CPU_TLB_SIZE; i++) {
+            for (i = 0; i < n_entries; i++) {
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
             }
+
+            for (i = 0; i < CPU_VTLB_SIZE; i++) {
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
+            }
         }
     }
 }
@@ -189,38 +466,65 @@ void tlb_set_dirty(CPUArchState *env, target_ulong vaddr)
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        i = tlb_index(env, mmu_idx, vaddr);
         tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
     }
+
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        int k;
+        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][k], vaddr);
+        }
+    }
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
-                               target_ulong size)
+   large pages and flush all of it if any of its pages is invalidated.  */
+static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
+                               target_ulong vaddr, target_ulong size)
 {
+    CPUTLBLargePage *lp = env->tlb_d[mmu_idx].large_page;
     target_ulong mask = ~(size - 1);
-
-    if (env->tlb_flush_addr == (target_ulong)-1) {
-        env->tlb_flush_addr = vaddr & mask;
-        env->tlb_flush_mask = mask;
-        return;
+    target_ulong best_mask = 0;
+    int best = 0;
+    int k;
+
+    for (k = 0; k < CPU_TLB_LARGE_PAGES; k++) {
+        if (lp[k].addr != (target_ulong)-1 &&
+            (vaddr & lp[k].mask) == lp[k].addr && (lp[k].mask & ~mask) == 0) {
+            /* already covered */
+            return;
+        }
+    }
+    for (k = 0; k < CPU_TLB_LARGE_PAGES; k++) {
+        if (lp[k].addr == (target_ulong)-1) {
+            lp[k].addr = vaddr & mask;
+            lp[k].mask = mask;
+            return;
+        }
     }
-    /* Extend the existing region to include the new page.
-       This is a compromise between unnecessary flushes and the cost
-       of maintaining a full variable size TLB.  */
-    mask &= env->tlb_flush_mask;
-    while (((env->tlb_flush_addr ^ vaddr) & mask) != 0) {
-        mask <<= 1;
+    /* All slots are taken: extend the area that grows the least to
+       include the new page.  This is a compromise between unnecessary
+       flushes and the cost of maintaining a full variable size TLB.  */
+    for (k = 0; k < CPU_TLB_LARGE_PAGES; k++) {
+        target_ulong m = mask & lp[k].mask;
+
+        while (((lp[k].addr ^ vaddr) & m) != 0) {
+            m <<= 1;
+        }
+        if (k == 0 || m > best_mask) {
+            best = k;
+            best_mask = m;
+        }
     }
-    env->tlb_flush_addr &= mask;
-    env->tlb_flush_mask = mask;
+    lp[best].addr &= best_mask;
+    lp[best].mask = best_mask;
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
    is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
-   supplied size is only used by tlb_flush_page.  */
+   supplied size is only used by tlb_flush_range.  */
 void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size)
@@ -233,10 +537,13 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
     uintptr_t addend;
     CPUTLBEntry *te;
     hwaddr iotlb, xlat, sz;
+    target_ulong page = vaddr & TARGET_PAGE_MASK;
+    unsigned vidx;
+    int k;
 
     assert(size >= TARGET_PAGE_SIZE);
     if (size != TARGET_PAGE_SIZE) {
-        tlb_add_large_page(env, vaddr, size);
+        tlb_add_large_page(env, mmu_idx, vaddr, size);
     }
 
     sz = size;
@@ -264,9 +571,33 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+    if (tlb_entry_is_empty(te)) {
+        env->tlb_d[mmu_idx].n_used_entries++;
+    } else {
+        env->tlb_d[mmu_idx].window_evictions++;
+    }
+
+    /* a victim entry for this page would be stale once te is refilled, and
+     * VICTIM_TLB_HIT would swap it back in */
+    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], page, TARGET_PAGE_SIZE);
+    }
+
+    /* do not discard the translation in te, evict it into a victim tlb,
+     * unless it is the old mapping of the page being refilled */
+    if (!tlb_entry_is_empty(te) &&
+        !tlb_hit_range(te->addr_read, page, TARGET_PAGE_SIZE) &&
+        !tlb_hit_range(te->addr_write, page, TARGET_PAGE_SIZE) &&
+        !tlb_hit_range(te->addr_code, page, TARGET_PAGE_SIZE)) {
+        vidx = env->vtlb_index++ % CPU_VTLB_SIZE;
+        env->tlb_v_table[mmu_idx][vidx] = *te;
+        env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
+    }
+
+    /* refill the tlb */
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -308,8 +639,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     MemoryRegion *mr;
     CPUState *cpu = ENV_GET_CPU(env1);
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
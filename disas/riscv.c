@@ -0,0 +1,628 @@
+/*
+ *  RISC-V disassembler
+ *
+ *  Covers RV64IMAFDC and the supervisor instructions and CSRs implemented
+ *  by target-riscv.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "disas/bfd.h"
+
+/* Register names match the ones used by the CPU state dump in
+ * target-riscv/translate.c. */
+static const char * const riscv_gpr_names[32] = {
+    "zero", "ra", "s0", "s1",  "s2",  "s3",  "s4",  "s5",
+    "s6",   "s7", "s8", "s9", "s10", "s11",  "sp",  "tp",
+    "v0",   "v1", "a0", "a1",  "a2",  "a3",  "a4",  "a5",
+    "a6",   "a7", "t0", "t1",  "t2",  "t3",  "t4",  "gp"
+};
+
+static const char * const riscv_fpr_names[32] = {
+    "f0", "f1", "f2", "f3", "f4", "f5", "f6", "f7",
+    "f8", "f9", "f10", "f11", "f12", "f13", "f14", "f15",
+    "f16", "f17", "f18", "f19", "f20", "f21", "f22", "f23",
+    "f24", "f25", "f26", "f27", "f28", "f29", "f30", "f31",
+};
+
+typedef struct {
+    int csr;
+    const char *name;
+} RiscvCsrInfo;
+
+/* Same set and spelling as cs_regnames in target-riscv/translate.c */
+static const RiscvCsrInfo riscv_csr_info[] = {
+    { 0x001, "fflags" },
+    { 0x002, "frm" },
+    { 0x003, "fcsr" },
+    { 0x500, "sup0" },
+    { 0x501, "sup1" },
+    { 0x502, "epc" },
+    { 0x503, "badvaddr" },
+    { 0x504, "ptbr" },
+    { 0x505, "asid" },
+    { 0x506, "count" },
+    { 0x507, "compare" },
+    { 0x508, "evec" },
+    { 0x509, "cause" },
+    { 0x50a, "status" },
+    { 0x50b, "hartid" },
+    { 0x50c, "impl" },
+    { 0x50d, "fatc" },
+    { 0x50e, "send_ipi" },
+    { 0x50f, "clear_ipi" },
+    { 0x51e, "tohost" },
+    { 0x51f, "fromhost" },
+    { 0xc00, "cycle" },
+    { 0xc01, "time" },
+    { 0xc02, "instret" },
+};
+
+static const char * const riscv_rm_names[8] = {
+    "rne", "rtz", "rdn", "rup", "rmm", NULL, NULL, NULL /* dyn */
+};
+
+/* Operand formats:
+ *   d s t      integer rd, rs1, rs2
+ *   D S T R    floating point rd, rs1, rs2, rs3
+ *   j          I-type immediate
+ *   o          load/jalr offset, printed as imm(rs1)
+ *   q          store offset, printed as imm(rs1)
+ *   A          atomic address, printed as (rs1)
+ *   p          branch target
+ *   a          jump target
+ *   u          upper immediate
+ *   >          6-bit shift amount
+ *   <          5-bit shift amount
+ *   E          CSR
+ *   Z          5-bit CSR immediate in the rs1 field
+ *   m          rounding mode, omitted when dynamic
+ *
+ * Entries are matched in order, so more specific encodings (pseudo
+ * instructions, fixed fields) must come before the general form.
+ */
+typedef struct {
+    const char *name;
+    uint32_t mask;
+    uint32_t match;
+    const char *args;
+} RiscvOpcodeInfo;
+
+#define MASK_OPCODE   0x0000007f
+#define MASK_FUNCT3   0x0000707f
+#define MASK_FUNCT7   0xfe00707f
+#define MASK_FUNCT7_NORM   0xfe00007f
+#define MASK_RS2      0xfff0007f
+#define MASK_RS2_F3   0xfff0707f
+#define MASK_SHIFT64  0xfc00707f
+#define MASK_AMO      0xf800707f
+#define MASK_LR       0xf9f0707f
+#define MASK_FMA      0x0600007f
+
+static const RiscvOpcodeInfo riscv_opcodes[] = {
+    /* RV64I */
+    { "lui",       MASK_OPCODE, 0x00000037, "d,u" },
+    { "auipc",     MASK_OPCODE, 0x00000017, "d,u" },
+    { "jal",       MASK_OPCODE, 0x0000006f, "d,a" },
+    { "jalr",      MASK_FUNCT3, 0x00000067, "d,o" },
+    { "beq",       MASK_FUNCT3, 0x00000063, "s,t,p" },
+    { "bne",       MASK_FUNCT3, 0x00001063, "s,t,p" },
+    { "blt",       MASK_FUNCT3, 0x00004063, "s,t,p" },
+    { "bge",       MASK_FUNCT3, 0x00005063, "s,t,p" },
+    { "bltu",      MASK_FUNCT3, 0x00006063, "s,t,p" },
+    { "bgeu",      MASK_FUNCT3, 0x00007063, "s,t,p" },
+    { "lb",        MASK_FUNCT3, 0x00000003, "d,o" },
+    { "lh",        MASK_FUNCT3, 0x00001003, "d,o" },
+    { "lw",        MASK_FUNCT3, 0x00002003, "d,o" },
+    { "ld",        MASK_FUNCT3, 0x00003003, "d,o" },
+    { "lbu",       MASK_FUNCT3, 0x00004003, "d,o" },
+    { "lhu",       MASK_FUNCT3, 0x00005003, "d,o" },
+    { "lwu",       MASK_FUNCT3, 0x00006003, "d,o" },
+    { "sb",        MASK_FUNCT3, 0x00000023, "t,q" },
+    { "sh",        MASK_FUNCT3, 0x00001023, "t,q" },
+    { "sw",        MASK_FUNCT3, 0x00002023, "t,q" },
+    { "sd",        MASK_FUNCT3, 0x00003023, "t,q" },
+    { "nop",       0xffffffff,  0x00000013, "" },
+    { "addi",      MASK_FUNCT3, 0x00000013, "d,s,j" },
+    { "slti",      MASK_FUNCT3, 0x00002013, "d,s,j" },
+    { "sltiu",     MASK_FUNCT3, 0x00003013, "d,s,j" },
+    { "xori",      MASK_FUNCT3, 0x00004013, "d,s,j" },
+    { "ori",       MASK_FUNCT3, 0x00006013, "d,s,j" },
+    { "andi",      MASK_FUNCT3, 0x00007013, "d,s,j" },
+    { "slli",      MASK_SHIFT64, 0x00001013, "d,s,>" },
+    { "srli",      MASK_SHIFT64, 0x00005013, "d,s,>" },
+    { "srai",      MASK_SHIFT64, 0x40005013, "d,s,>" },
+    { "add",       MASK_FUNCT7, 0x00000033, "d,s,t" },
+    { "sub",       MASK_FUNCT7, 0x40000033, "d,s,t" },
+    { "sll",       MASK_FUNCT7, 0x00001033, "d,s,t" },
+    { "slt",       MASK_FUNCT7, 0x00002033, "d,s,t" },
+    { "sltu",      MASK_FUNCT7, 0x00003033, "d,s,t" },
+    { "xor",       MASK_FUNCT7, 0x00004033, "d,s,t" },
+    { "srl",       MASK_FUNCT7, 0x00005033, "d,s,t" },
+    { "sra",       MASK_FUNCT7, 0x40005033, "d,s,t" },
+    { "or",        MASK_FUNCT7, 0x00006033, "d,s,t" },
+    { "and",       MASK_FUNCT7, 0x00007033, "d,s,t" },
+    { "addiw",     MASK_FUNCT3, 0x0000001b, "d,s,j" },
+    { "slliw",     MASK_FUNCT7, 0x0000101b, "d,s,<" },
+    { "srliw",     MASK_FUNCT7, 0x0000501b, "d,s,<" },
+    { "sraiw",     MASK_FUNCT7, 0x4000501b, "d,s,<" },
+    { "addw",      MASK_FUNCT7, 0x0000003b, "d,s,t" },
+    { "subw",      MASK_FUNCT7, 0x4000003b, "d,s,t" },
+    { "sllw",      MASK_FUNCT7, 0x0000103b, "d,s,t" },
+    { "srlw",      MASK_FUNCT7, 0x0000503b, "d,s,t" },
+    { "sraw",      MASK_FUNCT7, 0x4000503b, "d,s,t" },
+    { "fence",     MASK_FUNCT3, 0x0000000f, "" },
+    { "fence.i",   MASK_FUNCT3, 0x0000100f, "" },
+
+    /* RV64M */
+    { "mul",       MASK_FUNCT7, 0x02000033, "d,s,t" },
+    { "mulh",      MASK_FUNCT7, 0x02001033, "d,s,t" },
+    { "mulhsu",    MASK_FUNCT7, 0x02002033, "d,s,t" },
+    { "mulhu",     MASK_FUNCT7, 0x02003033, "d,s,t" },
+    { "div",       MASK_FUNCT7, 0x02004033, "d,s,t" },
+    { "divu",      MASK_FUNCT7, 0x02005033, "d,s,t" },
+    { "rem",       MASK_FUNCT7, 0x02006033, "d,s,t" },
+    { "remu",      MASK_FUNCT7, 0x02007033, "d,s,t" },
+    { "mulw",      MASK_FUNCT7, 0x0200003b, "d,s,t" },
+    { "divw",      MASK_FUNCT7, 0x0200403b, "d,s,t" },
+    { "divuw",     MASK_FUNCT7, 0x0200503b, "d,s,t" },
+    { "remw",      MASK_FUNCT7, 0x0200603b, "d,s,t" },
+    { "remuw",     MASK_FUNCT7, 0x0200703b, "d,s,t" },
+
+    /* RV64A; the aq/rl bits are printed as a suffix */
+    { "lr.w",      MASK_LR,  0x1000202f, "d,A" },
+    { "sc.w",      MASK_AMO, 0x1800202f, "d,t,A" },
+    { "amoswap.w", MASK_AMO, 0x0800202f, "d,t,A" },
+    { "amoadd.w",  MASK_AMO, 0x0000202f, "d,t,A" },
+    { "amoxor.w",  MASK_AMO, 0x2000202f, "d,t,A" },
+    { "amoand.w",  MASK_AMO, 0x6000202f, "d,t,A" },
+    { "amoor.w",   MASK_AMO, 0x4000202f, "d,t,A" },
+    { "amomin.w",  MASK_AMO, 0x8000202f, "d,t,A" },
+    { "amomax.w",  MASK_AMO, 0xa000202f, "d,t,A" },
+    { "amominu.w", MASK_AMO, 0xc000202f, "d,t,A" },
+    { "amomaxu.w", MASK_AMO, 0xe000202f, "d,t,A" },
+    { "lr.d",      MASK_LR,  0x1000302f, "d,A" },
+    { "sc.d",      MASK_AMO, 0x1800302f, "d,t,A" },
+    { "amoswap.d", MASK_AMO, 0x0800302f, "d,t,A" },
+    { "amoadd.d",  MASK_AMO, 0x0000302f, "d,t,A" },
+    { "amoxor.d",  MASK_AMO, 0x2000302f, "d,t,A" },
+    { "amoand.d",  MASK_AMO, 0x6000302f, "d,t,A" },
+    { "amoor.d",   MASK_AMO, 0x4000302f, "d,t,A" },
+    { "amomin.d",  MASK_AMO, 0x8000302f, "d,t,A" },
+    { "amomax.d",  MASK_AMO, 0xa000302f, "d,t,A" },
+    { "amominu.d", MASK_AMO, 0xc000302f, "d,t,A" },
+    { "amomaxu.d", MASK_AMO, 0xe000302f, "d,t,A" },
+
+    /* system */
+    { "scall",     0xffffffff, 0x00000073, "" },
+    { "sbreak",    0xffffffff, 0x00100073, "" },
+    { "sret",      0xffffffff, 0x80000073, "" },
+    { "wfi",       0xffffffff, 0x10200073, "" },
+    { "csrr",      MASK_FUNCT3 | 0x000f8000, 0x00002073, "d,E" },
+    { "csrw",      MASK_FUNCT3 | 0x00000f80, 0x00001073, "E,s" },
+    { "csrrw",     MASK_FUNCT3, 0x00001073, "d,E,s" },
+    { "csrrs",     MASK_FUNCT3, 0x00002073, "d,E,s" },
+    { "csrrc",     MASK_FUNCT3, 0x00003073, "d,E,s" },
+    { "csrrwi",    MASK_FUNCT3, 0x00005073, "d,E,Z" },
+    { "csrrsi",    MASK_FUNCT3, 0x00006073, "d,E,Z" },
+    { "csrrci",    MASK_FUNCT3, 0x00007073, "d,E,Z" },
+
+    /* RV64F */
+    { "flw",       MASK_FUNCT3, 0x00002007, "D,o" },
+    { "fsw",       MASK_FUNCT3, 0x00002027, "T,q" },
+    { "fmadd.s",   MASK_FMA, 0x00000043, "D,S,T,R,m" },
+    { "fmsub.s",   MASK_FMA, 0x00000047, "D,S,T,R,m" },
+    { "fnmsub.s",  MASK_FMA, 0x0000004b, "D,S,T,R,m" },
+    { "fnmadd.s",  MASK_FMA, 0x0000004f, "D,S,T,R,m" },
+    { "fadd.s",    MASK_FUNCT7_NORM, 0x00000053, "D,S,T,m" },
+    { "fsub.s",    MASK_FUNCT7_NORM, 0x08000053, "D,S,T,m" },
+    { "fmul.s",    MASK_FUNCT7_NORM, 0x10000053, "D,S,T,m" },
+    { "fdiv.s",    MASK_FUNCT7_NORM, 0x18000053, "D,S,T,m" },
+    { "fsqrt.s",   MASK_RS2, 0x58000053, "D,S,m" },
+    { "fsgnj.s",   MASK_FUNCT7, 0x20000053, "D,S,T" },
+    { "fsgnjn.s",  MASK_FUNCT7, 0x20001053, "D,S,T" },
+    { "fsgnjx.s",  MASK_FUNCT7, 0x20002053, "D,S,T" },
+    { "fmin.s",    MASK_FUNCT7, 0x28000053, "D,S,T" },
+    { "fmax.s",    MASK_FUNCT7, 0x28001053, "D,S,T" },
+    { "fle.s",     MASK_FUNCT7, 0xa0000053, "d,S,T" },
+    { "flt.s",     MASK_FUNCT7, 0xa0001053, "d,S,T" },
+    { "feq.s",     MASK_FUNCT7, 0xa0002053, "d,S,T" },
+    { "fcvt.w.s",  MASK_RS2, 0xc0000053, "d,S,m" },
+    { "fcvt.wu.s", MASK_RS2, 0xc0100053, "d,S,m" },
+    { "fcvt.l.s",  MASK_RS2, 0xc0200053, "d,S,m" },
+    { "fcvt.lu.s", MASK_RS2, 0xc0300053, "d,S,m" },
+    { "fcvt.s.w",  MASK_RS2, 0xd0000053, "D,s,m" },
+    { "fcvt.s.wu", MASK_RS2, 0xd0100053, "D,s,m" },
+    { "fcvt.s.l",  MASK_RS2, 0xd0200053, "D,s,m" },
+    { "fcvt.s.lu", MASK_RS2, 0xd0300053, "D,s,m" },
+    { "fmv.x.s",   MASK_RS2_F3, 0xe0000053, "d,S" },
+    { "fclass.s",  MASK_RS2_F3, 0xe0001053, "d,S" },
+    { "fmv.s.x",   MASK_RS2_F3, 0xf0000053, "D,s" },
+
+    /* RV64D */
+    { "fld",       MASK_FUNCT3, 0x00003007, "D,o" },
+    { "fsd",       MASK_FUNCT3, 0x00003027, "T,q" },
+    { "fmadd.d",   MASK_FMA, 0x02000043, "D,S,T,R,m" },
+    { "fmsub.d",   MASK_FMA, 0x02000047, "D,S,T,R,m" },
+    { "fnmsub.d",  MASK_FMA, 0x0200004b, "D,S,T,R,m" },
+    { "fnmadd.d",  MASK_FMA, 0x0200004f, "D,S,T,R,m" },
+    { "fadd.d",    MASK_FUNCT7_NORM, 0x02000053, "D,S,T,m" },
+    { "fsub.d",    MASK_FUNCT7_NORM, 0x0a000053, "D,S,T,m" },
+    { "fmul.d",    MASK_FUNCT7_NORM, 0x12000053, "D,S,T,m" },
+    { "fdiv.d",    MASK_FUNCT7_NORM, 0x1a000053, "D,S,T,m" },
+    { "fsqrt.d",   MASK_RS2, 0x5a000053, "D,S,m" },
+    { "fsgnj.d",   MASK_FUNCT7, 0x22000053, "D,S,T" },
+    { "fsgnjn.d",  MASK_FUNCT7, 0x22001053, "D,S,T" },
+    { "fsgnjx.d",  MASK_FUNCT7, 0x22002053, "D,S,T" },
+    { "fmin.d",    MASK_FUNCT7, 0x2a000053, "D,S,T" },
+    { "fmax.d",    MASK_FUNCT7, 0x2a001053, "D,S,T" },
+    { "fcvt.s.d",  MASK_RS2, 0x40100053, "D,S,m" },
+    { "fcvt.d.s",  MASK_RS2, 0x42000053, "D,S,m" },
+    { "fle.d",     MASK_FUNCT7, 0xa2000053, "d,S,T" },
+    { "flt.d",     MASK_FUNCT7, 0xa2001053, "d,S,T" },
+    { "feq.d",     MASK_FUNCT7, 0xa2002053, "d,S,T" },
+    { "fcvt.w.d",  MASK_RS2, 0xc2000053, "d,S,m" },
+    { "fcvt.wu.d", MASK_RS2, 0xc2100053, "d,S,m" },
+    { "fcvt.l.d",  MASK_RS2, 0xc2200053, "d,S,m" },
+    { "fcvt.lu.d", MASK_RS2, 0xc2300053, "d,S,m" },
+    { "fcvt.d.w",  MASK_RS2, 0xd2000053, "D,s,m" },
+    { "fcvt.d.wu", MASK_RS2, 0xd2100053, "D,s,m" },
+    { "fcvt.d.l",  MASK_RS2, 0xd2200053, "D,s,m" },
+    { "fcvt.d.lu", MASK_RS2, 0xd2300053, "D,s,m" },
+    { "fmv.x.d",   MASK_RS2_F3, 0xe2000053, "d,S" },
+    { "fclass.d",  MASK_RS2_F3, 0xe2001053, "d,S" },
+    { "fmv.d.x",   MASK_RS2_F3, 0xf2000053, "D,s" },
+};
+
+static const RiscvOpcodeInfo *find_opcode_info(uint32_t insn)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(riscv_opcodes); i++) {
+        if ((insn & riscv_opcodes[i].mask) == riscv_opcodes[i].match) {
+            return &riscv_opcodes[i];
+        }
+    }
+    return NULL;
+}
+
+static const char *find_csr_name(int csr)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(riscv_csr_info); i++) {
+        if (riscv_csr_info[i].csr == csr) {
+            return riscv_csr_info[i].name;
+        }
+    }
+    return NULL;
+}
+
+static inline int32_t imm_i(uint32_t insn)
+{
+    return (int32_t)insn >> 20;
+}
+
+static inline int32_t imm_s(uint32_t insn)
+{
+    return (((int32_t)insn >> 25) << 5) | ((insn >> 7) & 0x1f);
+}
+
+static inline int32_t imm_b(uint32_t insn)
+{
+    return (((int32_t)insn >> 31) << 12) | (((insn >> 7) & 0x1) << 11) |
+           (((insn >> 25) & 0x3f) << 5) | (((insn >> 8) & 0xf) << 1);
+}
+
+static inline int32_t imm_j(uint32_t insn)
+{
+    return (((int32_t)insn >> 31) << 20) | (insn & 0xff000) |
+           (((insn >> 20) & 0x1) << 11) | (((insn >> 21) & 0x3ff) << 1);
+}
+
+static void print_operands(const RiscvOpcodeInfo *opc, uint32_t insn,
+                           bfd_vma memaddr, struct disassemble_info *info)
+{
+    fprintf_function fprintf_fn = info->fprintf_func;
+    void *stream = info->stream;
+    int rd = (insn >> 7) & 0x1f;
+    int rs1 = (insn >> 15) & 0x1f;
+    int rs2 = (insn >> 20) & 0x1f;
+    int rs3 = (insn >> 27) & 0x1f;
+    int rm = (insn >> 12) & 0x7;
+    const char *args;
+
+    for (args = opc->args; *args; args++) {
+        if (args[0] == ',' && args[1] == 'm' && !riscv_rm_names[rm]) {
+            /* dynamic rounding is the default, leave it out */
+            break;
+        }
+        switch (*args) {
+        case 'd':
+            fprintf_fn(stream, "%s", riscv_gpr_names[rd]);
+            break;
+        case 's':
+            fprintf_fn(stream, "%s", riscv_gpr_names[rs1]);
+            break;
+        case 't':
+            fprintf_fn(stream, "%s", riscv_gpr_names[rs2]);
+            break;
+        case 'D':
+            fprintf_fn(stream, "%s", riscv_fpr_names[rd]);
+            break;
+        case 'S':
+            fprintf_fn(stream, "%s", riscv_fpr_names[rs1]);
+            break;
+        case 'T':
+            fprintf_fn(stream, "%s", riscv_fpr_names[rs2]);
+            break;
+        case 'R':
+            fprintf_fn(stream, "%s", riscv_fpr_names[rs3]);
+            break;
+        case 'j':
+            fprintf_fn(stream, "%d", imm_i(insn));
+            break;
+        case 'o':
+            fprintf_fn(stream, "%d(%s)", imm_i(insn), riscv_gpr_names[rs1]);
+            break;
+        case 'q':
+            fprintf_fn(stream, "%d(%s)", imm_s(insn), riscv_gpr_names[rs1]);
+            break;
+        case 'A':
+            fprintf_fn(stream, "(%s)", riscv_gpr_names[rs1]);
+            break;
+        case 'p':
+            info->print_address_func(memaddr + imm_b(insn), info);
+            break;
+        case 'a':
+            info->print_address_func(memaddr + imm_j(insn), info);
+            break;
+        case 'u':
+            fprintf_fn(stream, "0x%x", insn >> 12);
+            break;
+        case '>':
+            fprintf_fn(stream, "%d", (insn >> 20) & 0x3f);
+            break;
+        case '<':
+            fprintf_fn(stream, "%d", (insn >> 20) & 0x1f);
+            break;
+        case 'E': {
+            int csr = insn >> 20;
+            const char *name = find_csr_name(csr);
+            if (name) {
+                fprintf_fn(stream, "%s", name);
+            } else {
+                fprintf_fn(stream, "0x%x", csr);
+            }
+            break;
+        }
+        case 'Z':
+            fprintf_fn(stream, "%d", rs1);
+            break;
+        case 'm':
+            fprintf_fn(stream, "%s", riscv_rm_names[rm]);
+            break;
+        default:
+            fprintf_fn(stream, "%c", *args);
+            break;
+        }
+    }
+}
+
+/* Compressed (RVC) instructions are expanded to the 32-bit instruction
+ * they stand for and printed as that, with a "c." prefix. Same encoding
+ * as target-riscv: the implicit stack pointer is x2, as in the C extension.
+ * Reserved encodings expand to 0, which is not a valid instruction. */
+#define RVC_SP        2
+#define RVC_REG(x)    (8 + ((x) & 0x7))
+#define RVC_BIT(c, n)           (((c) >> (n)) & 0x1)
+#define RVC_BITS(c, n, len)     (((c) >> (n)) & ((1 << (len)) - 1))
+#define RVC_SBIT(c, n)          (-(int32_t)RVC_BIT(c, n))
+
+static inline uint32_t rvc_i(uint32_t match, int rd, int rs1, int32_t imm)
+{
+    return match | (rd << 7) | (rs1 << 15) | ((uint32_t)imm << 20);
+}
+
+static inline uint32_t rvc_s(uint32_t match, int rs1, int rs2, int32_t imm)
+{
+    return match | ((imm & 0x1f) << 7) | (rs1 << 15) | (rs2 << 20) |
+           ((uint32_t)(imm >> 5) << 25);
+}
+
+static inline uint32_t rvc_r(uint32_t match, int rd, int rs1, int rs2)
+{
+    return match | (rd << 7) | (rs1 << 15) | (rs2 << 20);
+}
+
+static uint32_t rvc_expand(uint32_t c)
+{
+    int rd = RVC_BITS(c, 7, 5);
+    int rs2 = RVC_BITS(c, 2, 5);
+    int rd_c = RVC_REG(RVC_BITS(c, 2, 3));
+    int rs1_c = RVC_REG(RVC_BITS(c, 7, 3));
+    int32_t imm6 = (RVC_SBIT(c, 12) << 5) | RVC_BITS(c, 2, 5);
+    int shamt = (RVC_BIT(c, 12) << 5) | RVC_BITS(c, 2, 5);
+    int32_t imm_w = (RVC_BIT(c, 6) << 2) | (RVC_BITS(c, 10, 3) << 3) |
+                    (RVC_BIT(c, 5) << 6);
+    int32_t imm_d = (RVC_BITS(c, 10, 3) << 3) | (RVC_BITS(c, 5, 2) << 6);
+    int32_t imm;
+
+    switch (((c & 0x3) << 3) | RVC_BITS(c, 13, 3)) {
+    case 0x00: /* c.addi4spn */
+        imm = (RVC_BIT(c, 6) << 2) | (RVC_BIT(c, 5) << 3) |
+              (RVC_BITS(c, 11, 2) << 4) | (RVC_BITS(c, 7, 4) << 6);
+        return imm ? rvc_i(0x00000013, rd_c, RVC_SP, imm) : 0;
+    case 0x01: /* c.fld */
+        return rvc_i(0x00003007, rd_c, rs1_c, imm_d);
+    case 0x02: /* c.lw */
+        return rvc_i(0x00002003, rd_c, rs1_c, imm_w);
+    case 0x03: /* c.ld */
+        return rvc_i(0x00003003, rd_c, rs1_c, imm_d);
+    case 0x05: /* c.fsd */
+        return rvc_s(0x00003027, rs1_c, rd_c, imm_d);
+    case 0x06: /* c.sw */
+        return rvc_s(0x00002023, rs1_c, rd_c, imm_w);
+    case 0x07: /* c.sd */
+        return rvc_s(0x00003023, rs1_c, rd_c, imm_d);
+    case 0x08: /* c.addi */
+        return rvc_i(0x00000013, rd, rd, imm6);
+    case 0x09: /* c.addiw */
+        return rd ? rvc_i(0x0000001b, rd, rd, imm6) : 0;
+    case 0x0a: /* c.li */
+        return rvc_i(0x00000013, rd, 0, imm6);
+    case 0x0b:
+        if (rd == 2) { /* c.addi16sp */
+            imm = (RVC_BIT(c, 6) << 4) | (RVC_BIT(c, 2) << 5) |
+                  (RVC_BIT(c, 5) << 6) | (RVC_BITS(c, 3, 2) << 7) |
+                  (RVC_SBIT(c, 12) << 9);
+            return imm ? rvc_i(0x00000013, RVC_SP, RVC_SP, imm) : 0;
+        }
+        /* c.lui */
+        return rd && imm6 ? 0x00000037 | (rd << 7) | ((uint32_t)imm6 << 12)
+                          : 0;
+    case 0x0c:
+        switch (RVC_BITS(c, 10, 2)) {
+        case 0: /* c.srli */
+            return rvc_i(0x00005013, rs1_c, rs1_c, shamt);
+        case 1: /* c.srai */
+            return rvc_i(0x40005013, rs1_c, rs1_c, shamt);
+        case 2: /* c.andi */
+            return rvc_i(0x00007013, rs1_c, rs1_c, imm6);
+        }
+        switch ((RVC_BIT(c, 12) << 2) | RVC_BITS(c, 5, 2)) {
+        case 0: /* c.sub */
+            return rvc_r(0x40000033, rs1_c, rs1_c, rd_c);
+        case 1: /* c.xor */
+            return rvc_r(0x00004033, rs1_c, rs1_c, rd_c);
+        case 2: /* c.or */
+            return rvc_r(0x00006033, rs1_c, rs1_c, rd_c);
+        case 3: /* c.and */
+            return rvc_r(0x00007033, rs1_c, rs1_c, rd_c);
+        case 4: /* c.subw */
+            return rvc_r(0x4000003b, rs1_c, rs1_c, rd_c);
+        case 5: /* c.addw */
+            return rvc_r(0x0000003b, rs1_c, rs1_c, rd_c);
+        }
+        return 0;
+    case 0x0d: /* c.j */
+        imm = (RVC_BITS(c, 3, 3) << 1) | (RVC_BIT(c, 11) << 4) |
+              (RVC_BIT(c, 2) << 5) | (RVC_BIT(c, 7) << 6) |
+              (RVC_BIT(c, 6) << 7) | (RVC_BITS(c, 9, 2) << 8) |
+              (RVC_BIT(c, 8) << 10) | (RVC_SBIT(c, 12) << 11);
+        return 0x0000006f | (imm & 0xff000) | (((imm >> 11) & 0x1) << 20) |
+               (((imm >> 1) & 0x3ff) << 21) | ((uint32_t)(imm < 0) << 31);
+    case 0x0e: /* c.beqz */
+    case 0x0f: /* c.bnez */
+        imm = (RVC_BITS(c, 3, 2) << 1) | (RVC_BITS(c, 10, 2) << 3) |
+              (RVC_BIT(c, 2) << 5) | (RVC_BITS(c, 5, 2) << 6) |
+              (RVC_SBIT(c, 12) << 8);
+        return (c & (1 << 13) ? 0x00001063 : 0x00000063) |
+               (((imm >> 11) & 0x1) << 7) | (((imm >> 1) & 0xf) << 8) |
+               (rs1_c << 15) | (((imm >> 5) & 0x3f) << 25) |
+               ((uint32_t)(imm < 0) << 31);
+    case 0x10: /* c.slli */
+        return rvc_i(0x00001013, rd, rd, shamt);
+    case 0x11: /* c.fldsp */
+        imm = (RVC_BITS(c, 5, 2) << 3) | (RVC_BIT(c, 12) << 5) |
+              (RVC_BITS(c, 2, 3) << 6);
+        return rvc_i(0x00003007, rd, RVC_SP, imm);
+    case 0x12: /* c.lwsp */
+        imm = (RVC_BITS(c, 4, 3) << 2) | (RVC_BIT(c, 12) << 5) |
+              (RVC_BITS(c, 2, 2) << 6);
+        return rd ? rvc_i(0x00002003, rd, RVC_SP, imm) : 0;
+    case 0x13: /* c.ldsp */
+        imm = (RVC_BITS(c, 5, 2) << 3) | (RVC_BIT(c, 12) << 5) |
+              (RVC_BITS(c, 2, 3) << 6);
+        return rd ? rvc_i(0x00003003, rd, RVC_SP, imm) : 0;
+    case 0x14:
+        if (!RVC_BIT(c, 12)) {
+            if (rs2) { /* c.mv */
+                return rvc_r(0x00000033, rd, 0, rs2);
+            }
+            /* c.jr */
+            return rd ? rvc_i(0x00000067, 0, rd, 0) : 0;
+        }
+        if (rs2) { /* c.add */
+            return rvc_r(0x00000033, rd, rd, rs2);
+        }
+        /* c.ebreak, c.jalr */
+        return rd ? rvc_i(0x00000067, 1, rd, 0) : 0x00100073;
+    case 0x15: /* c.fsdsp */
+        imm = (RVC_BITS(c, 10, 3) << 3) | (RVC_BITS(c, 7, 3) << 6);
+        return rvc_s(0x00003027, RVC_SP, rs2, imm);
+    case 0x16: /* c.swsp */
+        imm = (RVC_BITS(c, 9, 4) << 2) | (RVC_BITS(c, 7, 2) << 6);
+        return rvc_s(0x00002023, RVC_SP, rs2, imm);
+    case 0x17: /* c.sdsp */
+        imm = (RVC_BITS(c, 10, 3) << 3) | (RVC_BITS(c, 7, 3) << 6);
+        return rvc_s(0x00003023, RVC_SP, rs2, imm);
+    }
+    return 0;
+}
+
+int print_insn_riscv(bfd_vma memaddr, struct disassemble_info *info)
+{
+    fprintf_function fprintf_fn = info->fprintf_func;
+    void *stream = info->stream;
+    const RiscvOpcodeInfo *opc;
+    bfd_byte buf[4];
+    char name[16];
+    uint32_t insn;
+    int status;
+    int len = 2;
+
+    status = info->read_memory_func(memaddr, buf, 2, info);
+    if (status == 0) {
+        insn = bfd_getl16(buf);
+        if ((insn & 0x3) == 0x3) {
+            len = 4;
+            status = info->read_memory_func(memaddr + 2, buf + 2, 2, info);
+        }
+    }
+    if (status != 0) {
+        info->memory_error_func(status, memaddr, info);
+        return -1;
+    }
+
+    if (len == 2) {
+        fprintf_fn(stream, "%04x        ", insn);
+        insn = rvc_expand(insn);
+    } else {
+        insn = bfd_getl32(buf);
+        fprintf_fn(stream, "%08x    ", insn);
+    }
+
+    opc = find_opcode_info(insn);
+    if (opc == NULL) {
+        if (len == 2) {
+            fprintf_fn(stream, "%-12s0x%04x", ".half",
+                       (unsigned)bfd_getl16(buf));
+        } else {
+            fprintf_fn(stream, "%-12s0x%08x", ".word", insn);
+        }
+        return len;
+    }
+
+    if ((insn & 0x7f) == 0x2f) {
+        /* atomics: show the ordering bits */
+        snprintf(name, sizeof(name), "%s%s%s", opc->name,
+                 insn & (1 << 26) ? ".aq" : "", insn & (1 << 25) ? ".rl" : "");
+    } else {
+        snprintf(name, sizeof(name), "%s%s", len == 2 ? "c." : "", opc->name);
+    }
+    fprintf_fn(stream, opc->args[0] ? "%-12s" : "%s", name);
+    print_operands(opc, insn, memaddr, info);
+    return len;
+}
@@ -356,6 +356,40 @@ STEXI
 @item delvm @var{tag}|@var{id}
 @findex delvm
 Delete the snapshot identified by @var{tag} or @var{id}.
+ETEXI
+
+    {
+        .name       = "savevm_mem",
+        .args_type  = "",
+        .params     = "",
+        .help       = "save a VM snapshot in host memory, replacing the previous one",
+        .mhandler.cmd = do_savevm_mem,
+    },
+
+STEXI
+@item savevm_mem
+@findex savevm_mem
+Keep a copy of guest RAM and of the device state in host memory, for
+@code{loadvm_mem}. Disk contents are not part of the snapshot. Only
+available with TCG.
+ETEXI
+
+    {
+        .name       = "loadvm_mem",
+        .args_type  = "verbose:-v",
+        .params     = "[-v]",
+        .help       = "restore the snapshot taken by savevm_mem (-v: report pages restored)",
+        .mhandler.cmd = do_loadvm_mem,
+    },
+
+STEXI
+@item loadvm_mem [-v]
+@findex loadvm_mem
+Go back to the state saved by @code{savevm_mem}. Only the guest RAM pages
+written since the snapshot was taken, or last restored, are copied back,
+so restoring is cheap when the guest ran for a short time. The snapshot
+can be restored any number of times. Do not use it while a migration is
+running.
 ETEXI
 
     {
@@ -27,13 +27,14 @@
 #include "hw/riscv/cpudevs.h"
 #include "qemu/timer.h"
 
-static uint64_t last_count_update;
-
 // should be the cpu freq
 #define TIMER_FREQ	100 * 1000 * 1000
 
 uint64_t cpu_riscv_get_cycle (CPURISCVState *env) {
     uint64_t now;
+    if (riscv_env_get_cpu(env)->icount_counters) {
+        return env->instret;
+    }
     now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
     // first, convert _now_ to seconds by dividing by get_ticks_per_sec
     // and then multiply by the timer freq.
@@ -61,7 +62,7 @@ uint32_t cpu_riscv_get_count (CPURISCVState *env)
 {
     uint64_t diff;
 
-    diff = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - last_count_update;
+    diff = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - env->last_count_update;
     return env->helper_csr[CSR_COUNT] +
         (uint32_t)muldiv64(diff, TIMER_FREQ, get_ticks_per_sec());
 }
@@ -70,7 +71,7 @@ void cpu_riscv_store_count (CPURISCVState *env, uint32_t count)
 {
     /* Store new count register */
     env->helper_csr[CSR_COUNT] = count;
-    last_count_update = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    env->last_count_update = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
 
     /* Update timer timer */
     cpu_riscv_timer_update(env);
@@ -94,9 +95,23 @@ static void riscv_timer_cb (void *opaque)
     env->helper_csr[CSR_COUNT]--;
 }
 
+static const VMStateDescription vmstate_riscv_cputimer = {
+    .name = "riscv-cputimer",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_TIMER(timer, CPURISCVState),
+        VMSTATE_UINT64(last_count_update, CPURISCVState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 void cpu_riscv_clock_init (CPURISCVState *env)
 {
     env->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, &riscv_timer_cb, env);
+    vmstate_register(NULL, ENV_GET_CPU(env)->cpu_index,
+                     &vmstate_riscv_cputimer, env);
     env->helper_csr[CSR_COMPARE] = 0;
     cpu_riscv_store_count(env, 1);
 }
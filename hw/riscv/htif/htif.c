@@ -30,90 +30,311 @@
 #include "qemu/timer.h"
 #include "exec/address-spaces.h"
 #include "qemu/error-report.h"
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/stat.h>
-
-static void htif_pre_save(void *opaque)
-{
-    return;
-}
 
 static int htif_post_load(void *opaque, int version_id)
 {
+    HTIFState *htifstate = opaque;
+
+    if (htifstate->resp_count < 0 ||
+        htifstate->resp_count > HTIF_RESP_QUEUE_SIZE ||
+        htifstate->console_fifo_head < 0 ||
+        htifstate->console_fifo_head >= HTIF_CONSOLE_FIFO_SIZE ||
+        htifstate->console_fifo_len < 0 ||
+        htifstate->console_fifo_len > HTIF_CONSOLE_FIFO_SIZE) {
+        return -EINVAL;
+    }
+    // input may have been buffered while a read was pending
+    if (htifstate->console_read_pending && htifstate->console_fifo_len) {
+        qemu_bh_schedule(htifstate->console_bh);
+    }
     return 0;
 }
 
+/* Disk requests are not saved: the block layer is drained before the
+ * state is, and their responses are in fromhost or the queue by then. */
 const VMStateDescription vmstate_htif = {
     .name = "htif",
-    .version_id = 1,
+    .version_id = 2,
     .minimum_version_id = 1,
-    .pre_save = htif_pre_save,
+    .minimum_version_id_old = 1,
     .post_load = htif_post_load,
-    .fields      = (VMStateField []) { // TODO what
+    .fields      = (VMStateField []) {
         VMSTATE_UINT64(tohost, HTIFState),
         VMSTATE_UINT64(fromhost, HTIFState),
         VMSTATE_UINT64(tohost_addr, HTIFState),
         VMSTATE_UINT64(fromhost_addr, HTIFState),
+        VMSTATE_UINT64_ARRAY_V(resp_queue, HTIFState, HTIF_RESP_QUEUE_SIZE, 2),
+        VMSTATE_INT32_V(resp_count, HTIFState, 2),
+        VMSTATE_BUFFER_V(console_fifo, HTIFState, 2),
+        VMSTATE_INT32_V(console_fifo_head, HTIFState, 2),
+        VMSTATE_INT32_V(console_fifo_len, HTIFState, 2),
+        VMSTATE_INT32_V(console_read_pending, HTIFState, 2),
+        VMSTATE_UINT64_V(console_read_tohost, HTIFState, 2),
+        VMSTATE_UINT64_V(console_read_addr, HTIFState, 2),
+        VMSTATE_UINT64_V(console_read_size, HTIFState, 2),
         VMSTATE_END_OF_LIST()
     },
 };
 
+// Goes through the memory API, so that the write shows in dirty tracking
 static void dma_strcopy(HTIFState *htifstate, char *str, hwaddr phys_addr) {
-    int i = 0;
-    void* base_copy_addr = htifstate->main_mem_ram_ptr+phys_addr;
-    while(*(str+i)) {
-        stb_p((void*)(base_copy_addr + i), *(str + i));
-        i++;
+    // copy the null terminator too
+    cpu_physical_memory_write(phys_addr, str, strlen(str) + 1);
+}
+
+/* Disk reads and writes and console reads complete some time after the
+ * tohost write, so their responses raise the interrupt. Everything else is
+ * answered before the tohost write returns and, as it always was, is only
+ * seen by polling fromhost. */
+static bool htif_resp_is_async(HTIFState *htifstate, uint64_t val)
+{
+    uint8_t device = val >> 56;
+    uint8_t cmd = val >> 48;
+
+    if (device == HTIF_DEV_BLOCK) {
+        return htifstate->block_dev_present && (cmd == 0x0 || cmd == 0x1);
     }
-    stb_p((void*)(base_copy_addr + i), 0); // store null term
+    return device == HTIF_DEV_CONSOLE && cmd == 0x0;
 }
 
-static int htif_block_device_read(HTIFState *htifstate, uint64_t payload) {
-    request_t req;
-    int i;
-    uint8_t* reqptr = (uint8_t*)&req;
-    void *base = htifstate->main_mem_ram_ptr+payload;
-    for (i = 0; i < sizeof(req); i++) {
-        // TODO: potential endianness issues here
-        *(reqptr + i) = ldub_p((void*)(base + i));
+static void htif_set_fromhost(HTIFState *htifstate, uint64_t val)
+{
+    htifstate->fromhost = val;
+    qemu_set_irq(htifstate->irq, htif_resp_is_async(htifstate, val));
+}
+
+/* A request is only taken when the response it posts is sure to fit, along
+ * with those of the requests still in flight: each of these needs fromhost
+ * or a queue slot. Otherwise tohost stays set and the guest waits, as it
+ * does for a busy disk. */
+static bool htif_can_accept(HTIFState *htifstate)
+{
+    return htifstate->fromhost == 0 ||
+           htifstate->resp_count + htifstate->block_busy +
+           htifstate->console_read_pending < HTIF_RESP_QUEUE_SIZE;
+}
+
+/* Post a response. Devices complete asynchronously, so fromhost may still
+ * hold a response the guest has not taken; queue behind it in that case.
+ * htif_handle_fromhost_write hands out the next one. */
+static void htif_respond(HTIFState *htifstate, uint64_t tohost, uint64_t resp)
+{
+    uint64_t val = (tohost >> 48 << 48) | (resp << 16 >> 16);
+
+    if (htifstate->fromhost != 0) {
+        // htif_can_accept() keeps a slot for every request in flight
+        assert(htifstate->resp_count < HTIF_RESP_QUEUE_SIZE);
+        htifstate->resp_queue[htifstate->resp_count++] = val;
+        return;
     }
+    htif_set_fromhost(htifstate, val);
+}
 
-    uint8_t copybuf[req.size];
-    if (pread(htifstate->block_fd, copybuf, req.size, req.offset) != req.size) {
-        printf("FAILED READ\n");
-        exit(1);
+/* Read the {addr, offset, size, tag} request descriptor at payload */
+static void htif_read_request(uint64_t payload, request_t *req)
+{
+    cpu_physical_memory_read(payload, req, sizeof(*req));
+    req->addr = le64_to_cpu(req->addr);
+    req->offset = le64_to_cpu(req->offset);
+    req->size = le64_to_cpu(req->size);
+    req->tag = le64_to_cpu(req->tag);
+}
+
+/* Console output: the whole guest buffer goes to the chardev in as few
+ * writes as possible, and a single response reports the bytes sent. */
+static void htif_console_write(HTIFState *htifstate, uint64_t tohost,
+                               uint64_t payload)
+{
+    request_t req;
+    uint8_t buf[1024];
+    uint64_t done = 0;
+    int len;
+
+    htif_read_request(payload, &req);
+    while (done < req.size) {
+        len = MIN(req.size - done, sizeof(buf));
+        cpu_physical_memory_read(req.addr + done, buf, len);
+        if (htifstate->chr) {
+            qemu_chr_fe_write_all(htifstate->chr, buf, len);
+        }
+        done += len;
     }
+    htif_respond(htifstate, tohost, done);
+}
+
+/* Hand whatever input is buffered to the pending read request */
+static void htif_console_complete_read(HTIFState *htifstate)
+{
+    uint64_t len, chunk, done = 0;
 
-    base = htifstate->main_mem_ram_ptr + req.addr;
-    for (i = 0; i < req.size; i++) {
-        stb_p((void*)(base + i), copybuf[i]);
+    if (!htifstate->console_read_pending || !htifstate->console_fifo_len) {
+        return;
+    }
+    len = MIN(htifstate->console_fifo_len, htifstate->console_read_size);
+    while (done < len) {
+        chunk = MIN(len - done,
+                    HTIF_CONSOLE_FIFO_SIZE - htifstate->console_fifo_head);
+        cpu_physical_memory_write(htifstate->console_read_addr + done,
+            htifstate->console_fifo + htifstate->console_fifo_head, chunk);
+        htifstate->console_fifo_head = (htifstate->console_fifo_head + chunk) %
+                                       HTIF_CONSOLE_FIFO_SIZE;
+        done += chunk;
+    }
+    htifstate->console_fifo_len -= len;
+    htifstate->console_read_pending = 0;
+    htif_respond(htifstate, htifstate->console_read_tohost, len);
+    if (htifstate->chr) {
+        qemu_chr_accept_input(htifstate->chr);
     }
-    return req.tag;
 }
 
-static int htif_block_device_write(HTIFState *htifstate, uint64_t payload) {
+/* Console input: a read request completes as soon as input is buffered,
+ * with everything that is buffered, up to the size of the guest buffer.
+ * Otherwise it waits for the chardev, and other HTIF devices carry on. */
+static void htif_console_read(HTIFState *htifstate, uint64_t tohost,
+                              uint64_t payload)
+{
     request_t req;
+
+    if (htifstate->console_read_pending) {
+        // only one read at a time; the guest retries
+        htif_respond(htifstate, tohost, 0);
+        return;
+    }
+    htif_read_request(payload, &req);
+    if (req.size == 0) {
+        htif_respond(htifstate, tohost, 0);
+        return;
+    }
+    htifstate->console_read_pending = 1;
+    htifstate->console_read_tohost = tohost;
+    htifstate->console_read_addr = req.addr;
+    htifstate->console_read_size = req.size;
+    htif_console_complete_read(htifstate);
+}
+
+static int htif_console_can_receive(void *opaque)
+{
+    HTIFState *htifstate = opaque;
+
+    return HTIF_CONSOLE_FIFO_SIZE - htifstate->console_fifo_len;
+}
+
+/* Input arrives from the chardev. The pending read is completed from a
+ * bottom half, so that input that arrives in several pieces during one
+ * main loop iteration costs the guest a single interrupt. */
+static void htif_console_receive(void *opaque, const uint8_t *buf, int size)
+{
+    HTIFState *htifstate = opaque;
+    int i, tail;
+
+    for (i = 0; i < size && htifstate->console_fifo_len <
+                            HTIF_CONSOLE_FIFO_SIZE; i++) {
+        tail = (htifstate->console_fifo_head + htifstate->console_fifo_len) %
+               HTIF_CONSOLE_FIFO_SIZE;
+        htifstate->console_fifo[tail] = buf[i];
+        htifstate->console_fifo_len++;
+    }
+    if (htifstate->console_read_pending) {
+        qemu_bh_schedule(htifstate->console_bh);
+    }
+}
+
+static void htif_console_bh(void *opaque)
+{
+    htif_console_complete_read(opaque);
+}
+
+static void htif_block_device_unmap(HTIFState *htifstate)
+{
+    QEMUIOVector *qiov = &htifstate->block_qiov;
     int i;
-    uint8_t* reqptr = (uint8_t*)&req;
-    void* base = htifstate->main_mem_ram_ptr + payload;
-    for (i = 0; i < sizeof(req); i++) {
-        // TODO: potential endianness issues here
-        *(reqptr + i) = ldub_p((void*)(base + i));
+
+    // disk reads wrote to guest memory
+    for (i = 0; i < qiov->niov; i++) {
+        address_space_unmap(&address_space_memory, qiov->iov[i].iov_base,
+                            qiov->iov[i].iov_len, !htifstate->block_is_write,
+                            qiov->iov[i].iov_len);
     }
+    qemu_iovec_destroy(qiov);
+}
 
-    uint8_t copybuf[req.size];
+static void htif_block_device_complete(void *opaque, int ret)
+{
+    HTIFState *htifstate = opaque;
+    uint64_t resp = htifstate->block_tag;
 
-    base = htifstate->main_mem_ram_ptr + req.addr;
-    for (i = 0; i < req.size; i++) {
-        copybuf[i] = ldub_p((void*)(base + i));
+    bdrv_acct_done(htifstate->bs, &htifstate->block_acct);
+    if (ret < 0) {
+        error_report("htif: disk %s failed: %s",
+                     htifstate->block_is_write ? "write" : "read",
+                     strerror(-ret));
+        resp = HTIF_BLOCK_ERROR(resp);
     }
+    htif_block_device_unmap(htifstate);
+    htifstate->block_busy = 0;
+    htif_respond(htifstate, htifstate->block_tohost, resp);
+}
 
-    if (pwrite(htifstate->block_fd, copybuf, req.size, req.offset) != req.size) {
-        printf("FAILED WRITE\n");
-        exit(1);
+/* Start a disk read or write. The guest buffer is mapped and handed to the
+ * block layer as is, and the vCPU keeps running while the request is in
+ * flight. htif_block_device_complete posts the response. A request that
+ * cannot be carried out is answered with HTIF_BLOCK_ERROR of its tag. */
+static void htif_block_device_rw(HTIFState *htifstate, uint64_t tohost,
+                                 uint64_t payload, int is_write)
+{
+    request_t req;
+    hwaddr addr, len;
+    uint64_t remaining;
+    void *buf;
+
+    htif_read_request(payload, &req);
+
+    htifstate->block_tohost = tohost;
+    htifstate->block_tag = req.tag;
+    htifstate->block_is_write = is_write;
+
+    if ((req.offset | req.size) & (BDRV_SECTOR_SIZE - 1)) {
+        error_report("htif: unaligned disk request, offset 0x%" PRIx64
+                     " size 0x%" PRIx64, req.offset, req.size);
+        htif_respond(htifstate, tohost, HTIF_BLOCK_ERROR(req.tag));
+        return;
+    }
+    if (req.size == 0) {
+        htif_respond(htifstate, tohost, req.tag);
+        return;
+    }
+
+    qemu_iovec_init(&htifstate->block_qiov, 1);
+    addr = req.addr;
+    remaining = req.size;
+    while (remaining) {
+        len = remaining;
+        buf = address_space_map(&address_space_memory, addr, &len, !is_write);
+        if (buf == NULL) {
+            error_report("htif: cannot map disk buffer at 0x%" PRIx64,
+                         (uint64_t)addr);
+            htif_block_device_unmap(htifstate);
+            htif_respond(htifstate, tohost, HTIF_BLOCK_ERROR(req.tag));
+            return;
+        }
+        qemu_iovec_add(&htifstate->block_qiov, buf, len);
+        addr += len;
+        remaining -= len;
+    }
+
+    htifstate->block_busy = 1;
+    bdrv_acct_start(htifstate->bs, &htifstate->block_acct, req.size,
+                    is_write ? BDRV_ACCT_WRITE : BDRV_ACCT_READ);
+    if (is_write) {
+        bdrv_aio_writev(htifstate->bs, req.offset >> BDRV_SECTOR_BITS,
+                        &htifstate->block_qiov, req.size >> BDRV_SECTOR_BITS,
+                        htif_block_device_complete, htifstate);
+    } else {
+        bdrv_aio_readv(htifstate->bs, req.offset >> BDRV_SECTOR_BITS,
+                       &htifstate->block_qiov, req.size >> BDRV_SECTOR_BITS,
+                       htif_block_device_complete, htifstate);
     }
-    return req.tag;
 }
 
 static void htif_handle_tohost_write(HTIFState *htifstate, uint64_t val_written) {
@@ -129,7 +350,12 @@ static void htif_handle_tohost_write(HTIFState *htifstate, uint64_t val_written)
 
     resp = 0; // stop gcc complaining
 
-    if (likely(device == 0x1 && htifstate->block_dev_present)) { 
+    if (!htif_can_accept(htifstate)) {
+        // picked up once the guest has taken a response
+        htifstate->tohost = val_written;
+        return;
+    }
+    if (likely(device == HTIF_DEV_BLOCK && htifstate->block_dev_present)) {
         // assume device 0x1 is permanently hooked to block dev for now
         if (unlikely(cmd == 0xFF)) { 
             if (what == 0xFF) { // register
@@ -142,24 +368,74 @@ static void htif_handle_tohost_write(HTIFState *htifstate, uint64_t val_written)
                 dma_strcopy(htifstate, (char*)"", real_addr);
             }
             resp = 0x1; // write to indicate device name placed
-        } else if (cmd == 0x0) {
-            // handle disk read
-            resp = htif_block_device_read(htifstate, payload);
-        } else if (cmd == 0x1) {
-            // handle disk write
-            resp = htif_block_device_write(htifstate, payload);
+        } else if (cmd == 0x0 || cmd == 0x1) {
+            // handle disk read/write
+            if (htifstate->block_busy) {
+                // one request at a time: leave tohost set, it is picked
+                // up once the guest has taken the response to this one
+                htifstate->tohost = val_written;
+                return;
+            }
+            htifstate->tohost = 0; // clear to indicate we read
+            htif_block_device_rw(htifstate, val_written, payload, cmd == 0x1);
+            return;
         } else {
             printf("INVALID HTIFBD COMMAND. exiting\n");
             exit(1);
         }
+    } else if (device == HTIF_DEV_CONSOLE) {
+        if (cmd == 0xFF) {
+            if (what == 0xFF) { // register
+                dma_strcopy(htifstate, (char*)"console", real_addr);
+            } else if (what == 0x0) {
+                dma_strcopy(htifstate, (char*)"read", real_addr);
+            } else if (what == 0x1) {
+                dma_strcopy(htifstate, (char*)"write", real_addr);
+            } else {
+                dma_strcopy(htifstate, (char*)"", real_addr);
+            }
+            resp = 0x1;
+        } else if (cmd == 0x0 || cmd == 0x1) {
+            htifstate->tohost = 0; // clear to indicate we read
+            if (cmd == 0x0) {
+                htif_console_read(htifstate, val_written, payload);
+            } else {
+                htif_console_write(htifstate, val_written, payload);
+            }
+            return;
+        }
     } else if (cmd == 0xFF && what == 0xFF) { // all other devices
-        stb_p((void*)(htifstate->main_mem_ram_ptr+real_addr), 0);
+        dma_strcopy(htifstate, (char*)"", real_addr);
         resp = 0x1; // write to indicate device name placed
     }
-    htifstate->fromhost = (val_written >> 48 << 48) | (resp << 16 >> 16);
+    htif_respond(htifstate, val_written, resp);
     htifstate->tohost = 0; // clear to indicate we read
 }
 
+// The guest has written fromhost, clearing it once it has taken a response
+static void htif_handle_fromhost_write(HTIFState *htifstate)
+{
+    int i;
+
+    if (htifstate->fromhost != 0) {
+        return;
+    }
+    if (htifstate->resp_count) {
+        htif_set_fromhost(htifstate, htifstate->resp_queue[0]);
+        htifstate->resp_count--;
+        for (i = 0; i < htifstate->resp_count; i++) {
+            htifstate->resp_queue[i] = htifstate->resp_queue[i + 1];
+        }
+    } else {
+        qemu_irq_lower(htifstate->irq);
+    }
+    if (htifstate->tohost != 0) {
+        // a request that was held back, it is held again if it still
+        // cannot be taken
+        htif_handle_tohost_write(htifstate, htifstate->tohost);
+    }
+}
+
 // CPU wants to read an HTIF register
 static uint64_t htif_mm_read(void *opaque, hwaddr addr, unsigned size)
 {
@@ -191,6 +467,7 @@ static void htif_mm_write(void *opaque, hwaddr addr,
         htifstate->fromhost = value & 0xFFFFFFFF;
     } else if (addr == 0xc) {
         htifstate->fromhost |= value << 32;
+        htif_handle_fromhost_write(htifstate);
     } else {
         printf("Invalid htif register address %016lx\n", (uint64_t)addr);
         exit(1);
@@ -206,13 +483,13 @@ static const MemoryRegionOps htif_mm_ops[3] = {
 };
 
 HTIFState *htif_mm_init(MemoryRegion *address_space, hwaddr base, qemu_irq irq, 
-                        MemoryRegion *main_mem, char* htifbd_fname)
+                        MemoryRegion *main_mem, BlockDriverState *bs,
+                        CharDriverState *chr)
 {
     // TODO: cleanup the constant buffer sizes
     HTIFState *htifstate;
-    size_t size;
+    int64_t size;
     char *rname;
-    char size_str_buf[400];
 
     htifstate = g_malloc0(sizeof(HTIFState));
     rname = g_malloc0(sizeof(char)*500);
@@ -231,25 +508,27 @@ HTIFState *htif_mm_init(MemoryRegion *address_space, hwaddr base, qemu_irq irq,
             htifstate, "htif", 16 /* 2 64-bit registers */);
     memory_region_add_subregion(address_space, base, &htifstate->io);
 
-    if (NULL == htifbd_fname) { // NULL means no -hda specified
+    htifstate->chr = chr;
+    htifstate->console_bh = qemu_bh_new(htif_console_bh, htifstate);
+    if (chr) {
+        qemu_chr_add_handlers(chr, htif_console_can_receive,
+                              htif_console_receive, NULL, htifstate);
+    }
+
+    if (NULL == bs) { // NULL means no -hda specified
         htifstate->block_dev_present = 0;
         return htifstate;
     }
 
-    htifstate->block_fname = htifbd_fname;
-    htifstate->block_fd = open(htifstate->block_fname, O_RDWR);
-
-    struct stat st;
-    if (fstat(htifstate->block_fd, &st) < 0) {
-        printf("WARN: Could not stat %s, continuing without block device.\n", 
-                htifstate->block_fname);
+    htifstate->bs = bs;
+    size = bdrv_getlength(bs);
+    if (size < 0) {
+        printf("WARN: Could not get the size of %s, continuing without block "
+               "device.\n", bdrv_get_device_name(bs));
         htifstate->block_dev_present = 0;
         return htifstate;
     }
-    size = st.st_size;
-    strcpy(rname, "disk size=");
-    snprintf(size_str_buf, sizeof(size_str_buf), "%zu", size);
-    strcat(rname, size_str_buf);
+    snprintf(rname, 500, "disk size=%" PRId64, size);
     htifstate->real_name = rname;
     htifstate->block_dev_present = 1;
     return htifstate;
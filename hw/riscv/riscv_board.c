@@ -54,8 +54,12 @@
 #include "sysemu/qtest.h"
 #include "qemu/error-report.h"
 #include "hw/empty_slot.h"
+#include "qemu/timer.h"
+#include "exec/ram_addr.h"
+#include <sys/mman.h>
 
 #define TYPE_RISCV_BOARD "riscv-board"
+#define RISCV_MAX_HARTS 32
 #define RISCV_BOARD(obj) OBJECT_CHECK(BoardState, (obj), TYPE_RISCV_BOARD)
 
 typedef struct {
@@ -69,6 +73,62 @@ static struct _loaderparams {
     const char *initrd_filename;
 } loaderparams;
 
+/* Guest RAM backed by a memory image, -machine mem-image=FILE. The file
+ * holds the RAM contents from physical address 0 up, with the ELF segments
+ * already in place, e.g. objcopy -O binary of a kernel linked at its load
+ * address. It is mapped privately, so pages are only read in when the guest
+ * touches them, shared with every other QEMU booting the same image through
+ * the host page cache, and copied when written. */
+static struct {
+    int fd;
+    void *ram;
+    ram_addr_t ram_size;
+    size_t image_size;
+} mem_image = { .fd = -1 };
+
+/* (Re)map the image over the start of the RAM and anonymous zero pages over
+ * the rest, dropping whatever the guest wrote */
+static void mem_image_map(void)
+{
+    if (mmap(mem_image.ram, mem_image.ram_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+             -1, 0) == MAP_FAILED ||
+        mmap(mem_image.ram, mem_image.image_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, mem_image.fd, 0) == MAP_FAILED) {
+        fprintf(stderr, "qemu: could not map memory image: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+}
+
+static void *mem_image_open(const char *filename, ram_addr_t ram_size)
+{
+    struct stat st;
+
+    mem_image.fd = qemu_open(filename, O_RDONLY);
+    if (mem_image.fd < 0 || fstat(mem_image.fd, &st) < 0) {
+        fprintf(stderr, "qemu: could not open memory image '%s': %s\n",
+                filename, strerror(errno));
+        exit(1);
+    }
+    if (st.st_size == 0 || st.st_size > ram_size) {
+        fprintf(stderr, "qemu: memory image '%s' is empty or larger than "
+                "the RAM\n", filename);
+        exit(1);
+    }
+    mem_image.ram = mmap(NULL, ram_size, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem_image.ram == MAP_FAILED) {
+        fprintf(stderr, "qemu: could not reserve the RAM: %s\n",
+                strerror(errno));
+        exit(1);
+    }
+    mem_image.ram_size = ram_size;
+    mem_image.image_size = st.st_size;
+    mem_image_map();
+    return mem_image.ram;
+}
+
 uint64_t identity_translate(void *opaque, uint64_t addr)
 {
     return addr;
@@ -96,6 +156,28 @@ static void main_cpu_reset(void *opaque)
     cpu_reset(CPU(cpu));
 }
 
+static void riscv_board_reset(void *opaque)
+{
+    MemoryRegion *main_mem = opaque;
+    uint8_t *ram = memory_region_get_ram_ptr(main_mem);
+
+    if (mem_image.fd >= 0) {
+        /* put the pristine image back, like the ROM loader copies a
+         * kernel again; QEMU did not see these writes, so drop the code
+         * translated from the old contents and have migration and
+         * loadvm_mem resend every page */
+        mem_image_map();
+        tb_flush(&RISCV_CPU(first_cpu)->env);
+        cpu_physical_memory_set_dirty_range(
+            memory_region_get_ram_addr(main_mem), mem_image.ram_size);
+    }
+
+    // write memory amount in MiB to 0x0
+    stl_p(ram, loaderparams.ram_size >> 20);
+    // and the number of harts to 0x4
+    stl_p(ram + 4, smp_cpus);
+}
+
 static void riscv_board_init(QEMUMachineInitArgs *args)
 {
     ram_addr_t ram_size = args->ram_size;
@@ -105,12 +187,14 @@ static void riscv_board_init(QEMUMachineInitArgs *args)
     const char *initrd_filename = args->initrd_filename;
     MemoryRegion *system_memory = get_system_memory();
     MemoryRegion *main_mem = g_new(MemoryRegion, 1);
+    const char *mem_image_file =
+        qemu_opt_get(qemu_get_machine_opts(), "mem-image");
+    int64_t boot_start_ns = get_clock();
     RISCVCPU *cpu;
     CPURISCVState *env;
     int i;
 #ifdef CONFIG_RISCV_HTIF
     DriveInfo *htifbd_drive;
-    char *htifbd_fname; // htif block device filename
 #endif
 
     DeviceState *dev = qdev_create(NULL, TYPE_RISCV_BOARD);
@@ -131,6 +215,13 @@ static void riscv_board_init(QEMUMachineInitArgs *args)
         cpu_model = "riscv-generic";
     }
 
+    /* the harts run round-robin on the one TCG thread, see
+       target-riscv/TODO */
+    if (smp_cpus > 1 && !qtest_enabled()) {
+        error_report("Warning: the %d harts share one host thread, -smp "
+                     "does not make the guest run in parallel", smp_cpus);
+    }
+
     for (i = 0; i < smp_cpus; i++) {
         cpu = cpu_riscv_init(cpu_model);
         if (cpu == NULL) {
@@ -138,19 +229,28 @@ static void riscv_board_init(QEMUMachineInitArgs *args)
             exit(1);
         }
         env = &cpu->env;
+        env->boot_start_ns = boot_start_ns;
 
-        /* Init internal devices */
+        /* Init internal devices, every hart has its own timer and IPI line */
         cpu_riscv_irq_init_cpu(env);
         cpu_riscv_clock_init(env);
         qemu_register_reset(main_cpu_reset, cpu);
     }
+    /* external interrupts are routed to hart 0 */
     cpu = RISCV_CPU(first_cpu);
     env = &cpu->env;
 
     /* register system main memory (actual RAM) */
-    memory_region_init_ram(main_mem, NULL, "riscv_board.ram", ram_size);
+    if (mem_image_file) {
+        memory_region_init_ram_ptr(main_mem, NULL, "riscv_board.ram", ram_size,
+                                   mem_image_open(mem_image_file, ram_size));
+    } else {
+        memory_region_init_ram(main_mem, NULL, "riscv_board.ram", ram_size);
+    }
     vmstate_register_ram_global(main_mem);
     memory_region_add_subregion(system_memory, 0x0, main_mem);
+    loaderparams.ram_size = ram_size;
+    qemu_register_reset(riscv_board_reset, main_mem);
 
     if (bios_name) {
         int bios_size;
@@ -170,16 +270,12 @@ static void riscv_board_init(QEMUMachineInitArgs *args)
 
     if (kernel_filename) {
         /* Write a small bootloader to the flash location. */
-        loaderparams.ram_size = ram_size;
         loaderparams.kernel_filename = kernel_filename;
         loaderparams.kernel_cmdline = kernel_cmdline;
         loaderparams.initrd_filename = initrd_filename;
         load_kernel();
     }
 
-    // write memory amount in MiB to 0x0
-    stl_p(memory_region_get_ram_ptr(main_mem), loaderparams.ram_size >> 20);
-
     // add serial device 0x3f8-0x3ff
     serial_mm_init(system_memory, 0x3f8, 0, env->irq[4], 1843200/16, serial_hds[0],
         DEVICE_NATIVE_ENDIAN);
@@ -187,14 +283,12 @@ static void riscv_board_init(QEMUMachineInitArgs *args)
 #ifdef CONFIG_RISCV_HTIF
     // setup HTIF Block Device if one is specified as -hda FILENAME
     htifbd_drive = drive_get_by_index(IF_IDE, 0);
-    if (NULL == htifbd_drive) {
-        htifbd_fname = NULL;
-    } else {
-        htifbd_fname = (*(htifbd_drive->bdrv)).filename;
-    }
 
-    // add htif device 0x400 - 0x410
-    htif_mm_init(system_memory, 0x400, env->irq[0], main_mem, htifbd_fname);
+    // add htif device 0x400 - 0x410. The 16550 keeps the first serial
+    // port, the HTIF console gets the second one (-serial null -serial
+    // stdio to use it instead)
+    htif_mm_init(system_memory, 0x400, env->irq[0], main_mem,
+                 htifbd_drive ? htifbd_drive->bdrv : NULL, serial_hds[1]);
 #else
     /* Create MMIO transports, to which virtio backends created by the
      * user are automatically connected as needed.  If no backend is
@@ -205,10 +299,6 @@ static void riscv_board_init(QEMUMachineInitArgs *args)
     sysbus_create_simple("virtio-mmio", 0x600, env->irq[2]);
     sysbus_create_simple("virtio-mmio", 0x800, env->irq[3]);
 #endif
-
-    /* Init internal devices */
-    cpu_riscv_irq_init_cpu(env);
-    cpu_riscv_clock_init(env);
 }
 
 static int riscv_board_sysbus_device_init(SysBusDevice *sysbusdev)
@@ -233,7 +323,7 @@ static QEMUMachine riscv_board_machine = {
     .name = "board",
     .desc = "RISCV Board",
     .init = riscv_board_init,
-    .max_cpus = 1,
+    .max_cpus = RISCV_MAX_HARTS,
     .is_default = 1,
 };
 
@@ -85,3 +85,21 @@ void cpu_riscv_soft_irq(CPURISCVState *env, int irq, int level)
     }
     qemu_set_irq(env->irq[irq], level);
 }
+
+/* CSR_SEND_IPI: raise the IPI line (irq 5) of the hart numbered hartid */
+void cpu_riscv_send_ipi(CPURISCVState *env, target_ulong hartid)
+{
+    CPUState *cs = qemu_get_cpu(hartid);
+
+    if (cs == NULL) {
+        // no such hart, the write is ignored
+        return;
+    }
+    qemu_irq_raise(RISCV_CPU(cs)->env.irq[5]);
+}
+
+/* CSR_CLEAR_IPI: set or clear this hart's own IPI line */
+void cpu_riscv_clear_ipi(CPURISCVState *env, int level)
+{
+    qemu_set_irq(env->irq[5], level);
+}
@@ -457,6 +457,23 @@ extern int mem_prealloc;
 /* Set if TLB entry is an IO callback.  */
 #define TLB_MMIO        (1 << 5)
 
+/* Number of entries in the TLB of an MMU mode */
+static inline size_t tlb_n_entries(CPUArchState *env, int mmu_idx)
+{
+#if CPU_TLB_DYN
+    return (env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS) + 1;
+#else
+    return CPU_TLB_SIZE;
+#endif
+}
+
+/* Index of the TLB entry for addr */
+static inline unsigned int tlb_index(CPUArchState *env, int mmu_idx,
+                                     target_ulong addr)
+{
+    return (addr >> TARGET_PAGE_BITS) & (tlb_n_entries(env, mmu_idx) - 1);
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf);
 ram_addr_t last_ram_offset(void);
 void qemu_mutex_lock_ramlist(void);
@@ -29,6 +29,7 @@
 #include "qemu/queue.h"
 #ifndef CONFIG_USER_ONLY
 #include "exec/hwaddr.h"
+#include "tcg-target.h"
 #endif
 
 #ifndef TARGET_LONG_BITS
@@ -69,8 +70,31 @@ typedef uint64_t target_ulong;
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
 #if !defined(CONFIG_USER_ONLY)
+/* The TLB of each MMU mode can be allocated at run time and resized when
+ * it is flushed, between 1 << CPU_TLB_DYN_MIN_BITS and
+ * 1 << CPU_TLB_DYN_MAX_BITS entries, see tlb_mmu_resize(). This needs a host
+ * backend that loads the table and the index mask from the env, and a
+ * target whose CPU reset does not clear CPU_COMMON, which then holds
+ * pointers. Otherwise the TLB has a fixed CPU_TLB_SIZE entries. */
+#if defined(TCG_TARGET_IMPLEMENTS_DYN_TLB) && defined(TARGET_DYN_TLB)
+#define CPU_TLB_DYN 1
+#else
+#define CPU_TLB_DYN 0
+#endif
+
+#if CPU_TLB_DYN
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+#if HOST_LONG_BITS == 32
+#define CPU_TLB_DYN_MAX_BITS 8
+#else
+#define CPU_TLB_DYN_MAX_BITS 16
+#endif
+#else
 #define CPU_TLB_BITS 8
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
+#endif
+#define CPU_VTLB_SIZE 8
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -100,12 +124,46 @@ typedef struct CPUTLBEntry {
 
 QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 
+/* The TLB only holds TARGET_PAGE_SIZE entries, so a page larger than that
+ * is filled in piece by piece. Each MMU mode remembers the areas covered by
+ * up to CPU_TLB_LARGE_PAGES large pages, so that invalidating any page of a
+ * large page evicts the entries of that area and nothing else. */
+#define CPU_TLB_LARGE_PAGES 4
+
+typedef struct CPUTLBLargePage {
+    target_ulong addr;          /* -1 if unused */
+    target_ulong mask;
+} CPUTLBLargePage;
+
+/* Occupancy of the TLB of one MMU mode, which drives its resizing, and
+ * the large pages it maps */
+typedef struct CPUTLBDesc {
+    size_t n_used_entries;      /* valid entries in the table */
+    int64_t window_begin_ns;    /* start of the current observation window */
+    size_t window_max_entries;  /* highest n_used_entries in the window */
+    size_t window_evictions;    /* valid entries replaced in the window */
+    CPUTLBLargePage large_page[CPU_TLB_LARGE_PAGES];
+} CPUTLBDesc;
+
+#if CPU_TLB_DYN
+#define CPU_COMMON_TLB_TABLES                                           \
+    /* (number of entries - 1) << CPU_TLB_ENTRY_BITS */                 \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    hwaddr *iotlb[NB_MMU_MODES];
+#else
+#define CPU_COMMON_TLB_TABLES                                           \
+    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
+    hwaddr iotlb[NB_MMU_MODES][CPU_TLB_SIZE];
+#endif
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
-    CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
-    hwaddr iotlb[NB_MMU_MODES][CPU_TLB_SIZE];               \
-    target_ulong tlb_flush_addr;                                        \
-    target_ulong tlb_flush_mask;
+    CPU_COMMON_TLB_TABLES                                               \
+    CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    hwaddr iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                        \
+    target_ulong vtlb_index;
 
 #else
 
@@ -21,6 +21,7 @@
 
 #if !defined(CONFIG_USER_ONLY)
 /* cputlb.c */
+void tlb_init(CPUState *cpu);
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code_phys(CPUState *cpu, ram_addr_t ram_addr,
                              target_ulong vaddr);
@@ -29,6 +30,38 @@ void tlb_reset_dirty_range(CPUTLBEntry *tlb_entry, uintptr_t start,
 void cpu_tlb_reset_dirty_all(ram_addr_t start1, ram_addr_t length);
 void tlb_set_dirty(CPUArchState *env, target_ulong vaddr);
 extern int tlb_flush_count;
+extern uint64_t tlb_victim_hit_count;
+extern int tlb_resize_count;
+extern int tlb_large_page_flush_count;
+
+/* We are about to do a page table walk. Our last hope is the victim tlb:
+ * look for page in the field at elt_ofs (addr_read, addr_write or
+ * addr_code) of the victim entries, and on a hit swap that entry and its
+ * iotlb with entry index of the main tlb. Returns whether it hit. */
+static inline bool tlb_victim_hit(CPUArchState *env, int mmu_idx,
+                                  unsigned int index, size_t elt_ofs,
+                                  target_ulong page)
+{
+    int vidx;
+
+    for (vidx = CPU_VTLB_SIZE - 1; vidx >= 0; --vidx) {
+        CPUTLBEntry *vtlb = &env->tlb_v_table[mmu_idx][vidx];
+        target_ulong cmp = *(target_ulong *)((uintptr_t)vtlb + elt_ofs);
+
+        if (cmp == page) {
+            CPUTLBEntry tmptlb = env->tlb_table[mmu_idx][index];
+            hwaddr tmpiotlb = env->iotlb[mmu_idx][index];
+
+            env->tlb_table[mmu_idx][index] = *vtlb;
+            *vtlb = tmptlb;
+            env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][vidx];
+            env->iotlb_v[mmu_idx][vidx] = tmpiotlb;
+            tlb_victim_hit_count++;
+            return true;
+        }
+    }
+    return false;
+}
 
 /* exec.c */
 void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr);
@@ -99,7 +99,9 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end,
 void tcg_cpu_address_space_init(CPUState *cpu, AddressSpace *as);
 /* cputlb.c */
 void tlb_flush_page(CPUState *cpu, target_ulong addr);
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len);
 void tlb_flush(CPUState *cpu, int flush_global);
+void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap);
 void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                   hwaddr paddr, int prot,
                   int mmu_idx, target_ulong size);
@@ -109,9 +111,18 @@ static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
 }
 
+static inline void tlb_flush_range(CPUState *cpu, target_ulong addr,
+                                   target_ulong len)
+{
+}
+
 static inline void tlb_flush(CPUState *cpu, int flush_global)
 {
 }
+
+static inline void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
+{
+}
 #endif
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
@@ -128,6 +139,13 @@ static inline void tlb_flush(CPUState *cpu, int flush_global)
 #define CODE_GEN_AVG_BLOCK_SIZE 64
 #endif
 
+/* The translation buffer is split into up to CODE_GEN_REGIONS regions of
+   at least CODE_GEN_MIN_REGION_SIZE bytes. When the current region is
+   full, the least recently used one is emptied and reused, so running
+   out of space does not throw away all of the translated code. */
+#define CODE_GEN_REGIONS            8
+#define CODE_GEN_MIN_REGION_SIZE    (4 * TCG_MAX_OP_SIZE * OPC_BUF_SIZE)
+
 #if defined(__arm__) || defined(_ARCH_PPC) \
     || defined(__x86_64__) || defined(__i386__) \
     || defined(__sparc__) || defined(__aarch64__) \
@@ -168,12 +186,24 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    int region;         /* index in tb_ctx.regions */
 };
 
 #include "exec/spinlock.h"
+#include "qemu/bitops.h"
 
 typedef struct TBContext TBContext;
 
+/* A part of the translation buffer and the TBs whose code it holds */
+typedef struct TBRegion {
+    uint8_t *start;
+    uint8_t *limit;             /* no new TB starts at or above this */
+    uint8_t *ptr;               /* end of the code, unless current */
+    TranslationBlock *tbs;      /* in code order */
+    int nb_tbs;
+    uint64_t last_used;         /* tb_ctx.region_clock, 0 if empty */
+} TBRegion;
+
 struct TBContext {
 
     TranslationBlock *tbs;
@@ -182,13 +212,33 @@ struct TBContext {
     /* any access to the tbs or the page table must use this lock */
     spinlock_t tb_lock;
 
+    TBRegion regions[CODE_GEN_REGIONS];
+    int nb_regions;
+    int cur_region;             /* where new TBs go */
+    int region_max_blocks;
+    uint64_t region_clock;
+    /* hashes of the physical PCs of evicted TBs, to spot retranslations */
+    unsigned long evicted_pc[BITS_TO_LONGS(CODE_GEN_PHYS_HASH_SIZE)];
+
     /* statistics */
     int tb_flush_count;
     int tb_phys_invalidate_count;
+    int region_evict_count;
+    int64_t tb_evict_count;
+    int64_t tb_retranslate_count;
+    int64_t tb_gen_count;
 
     int tb_invalidated_flag;
 };
 
+/* Note that code in tb's region ran, for the choice of region to evict.
+   TBs entered through a chained jump are only seen when execution leaves
+   the chain from them, see cpu_tb_exec(). */
+static inline void tb_mark_used(TBContext *tb_ctx, TranslationBlock *tb)
+{
+    tb_ctx->regions[tb->region].last_used = ++tb_ctx->region_clock;
+}
+
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
     target_ulong tmp;
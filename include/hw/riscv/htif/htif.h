@@ -26,6 +26,21 @@
 #include "hw/hw.h"
 #include "sysemu/sysemu.h"
 #include "exec/memory.h"
+#include "block/block.h"
+#include "sysemu/char.h"
+
+// HTIF device numbers, the top byte of tohost
+#define HTIF_DEV_BLOCK          0x1
+#define HTIF_DEV_CONSOLE        0x2
+
+#define HTIF_CONSOLE_FIFO_SIZE  4096
+// responses waiting behind fromhost. At least one slot for each request
+// that can be in flight at once, a disk request and a console read.
+#define HTIF_RESP_QUEUE_SIZE    4
+
+// A failed disk request is answered with this instead of its tag. The
+// guest driver sees the tag mismatch and fails the request with -EIO.
+#define HTIF_BLOCK_ERROR(tag)   (~(tag) & 0xFFFFFFFFFFFFULL)
 
 typedef struct HTIFState HTIFState;
 
@@ -42,10 +57,33 @@ struct HTIFState {
 
     int block_dev_present;
     // TODO: eventually move the following to a separate HTIF block device driver
-    const char *block_fname;
-    int block_fd;
+    BlockDriverState *bs;
     char *real_name;
+    // the disk request in flight, if any. tohost is left set, and not
+    // acted upon, while a request is in flight.
+    int block_busy;
+    uint64_t block_tohost; // tohost value that started the request
+    uint64_t block_tag;
+    int block_is_write;
+    QEMUIOVector block_qiov;
+    BlockAcctCookie block_acct;
+
+    // responses posted while the guest had not yet taken the one in
+    // fromhost, oldest first
+    uint64_t resp_queue[HTIF_RESP_QUEUE_SIZE];
+    int resp_count;
 
+    // console: input received from the chardev and not yet read by the
+    // guest, and the guest read request waiting for it, if any
+    CharDriverState *chr;
+    uint8_t console_fifo[HTIF_CONSOLE_FIFO_SIZE];
+    int console_fifo_head;
+    int console_fifo_len;
+    int console_read_pending;
+    uint64_t console_read_tohost;
+    uint64_t console_read_addr;
+    uint64_t console_read_size;
+    QEMUBH *console_bh;
 };
 
 typedef struct request_t request_t;
@@ -63,6 +101,7 @@ extern const MemoryRegionOps htif_io_ops;
 
 /* legacy pre qom */
 HTIFState *htif_mm_init(MemoryRegion *address_space, hwaddr base, 
-                    qemu_irq irq, MemoryRegion *main_mem, char *htifbd_fname);
+                    qemu_irq irq, MemoryRegion *main_mem,
+                    BlockDriverState *bs, CharDriverState *chr);
 
 #endif
@@ -74,6 +74,8 @@ void qemu_add_machine_init_done_notifier(Notifier *notify);
 void do_savevm(Monitor *mon, const QDict *qdict);
 int load_vmstate(const char *name);
 void do_delvm(Monitor *mon, const QDict *qdict);
+void do_savevm_mem(Monitor *mon, const QDict *qdict);
+void do_loadvm_mem(Monitor *mon, const QDict *qdict);
 void do_info_snapshots(Monitor *mon, const QDict *qdict);
 
 void qemu_announce_self(void);
@@ -120,6 +122,9 @@ extern int alt_grab;
 extern int ctrl_grab;
 extern int smp_cpus;
 extern int max_cpus;
+extern unsigned int tlb_entries;
+extern unsigned int tlb_entries_min;
+extern unsigned int tlb_entries_max;
 extern int cursor_hide;
 extern int graphic_rotate;
 extern int no_quit;
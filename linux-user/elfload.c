@@ -868,6 +868,43 @@ static void elf_core_copy_regs(target_elf_gregset_t *regs,
 
 #endif /* TARGET_OPENRISC */
 
+#ifdef TARGET_RISCV
+
+#define ELF_START_MMAP 0x80000000
+
+#define elf_check_arch(x) ((x) == EM_RISCV)
+
+#define ELF_ARCH EM_RISCV
+#define ELF_CLASS ELFCLASS64
+#define ELF_DATA  ELFDATA2LSB
+
+static inline void init_thread(struct target_pt_regs *regs,
+                               struct image_info *infop)
+{
+    regs->sepc = infop->entry;
+    regs->gpr[RISCV_REG_SP] = infop->start_stack;
+}
+
+#define USE_ELF_CORE_DUMP
+#define ELF_EXEC_PAGESIZE 8192
+
+#define ELF_NREG 33 /* pc and x1-x31, then status */
+typedef target_elf_greg_t target_elf_gregset_t[ELF_NREG];
+
+static void elf_core_copy_regs(target_elf_gregset_t *regs,
+                               const CPURISCVState *env)
+{
+    int i;
+
+    (*regs)[0] = tswapreg(env->active_tc.PC);
+    for (i = 1; i < 32; i++) {
+        (*regs)[i] = tswapreg(env->active_tc.gpr[i]);
+    }
+    (*regs)[32] = tswapreg(env->helper_csr[CSR_STATUS]);
+}
+
+#endif /* TARGET_RISCV */
+
 #ifdef TARGET_SH4
 
 #define ELF_START_MMAP 0x80000000
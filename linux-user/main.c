@@ -2738,6 +2738,100 @@ void cpu_loop(CPUOpenRISCState *env)
 
 #endif /* TARGET_OPENRISC */
 
+#ifdef TARGET_RISCV
+
+void cpu_loop(CPURISCVState *env)
+{
+    CPUState *cs = CPU(riscv_env_get_cpu(env));
+    int trapnr, sig;
+    target_siginfo_t info;
+
+    for (;;) {
+        cpu_exec_start(cs);
+        trapnr = cpu_riscv_exec(env);
+        cpu_exec_end(cs);
+
+        switch (trapnr) {
+        case RISCV_EXCP_SCALL:
+            /* straight to do_syscall: the number is in v0, the arguments
+             * in a0-a5 and the result goes back to v0 */
+            env->active_tc.PC += 4;
+            env->active_tc.gpr[RISCV_REG_V0] =
+                do_syscall(env,
+                           env->active_tc.gpr[RISCV_REG_V0],
+                           env->active_tc.gpr[RISCV_REG_A0],
+                           env->active_tc.gpr[RISCV_REG_A0 + 1],
+                           env->active_tc.gpr[RISCV_REG_A0 + 2],
+                           env->active_tc.gpr[RISCV_REG_A0 + 3],
+                           env->active_tc.gpr[RISCV_REG_A0 + 4],
+                           env->active_tc.gpr[RISCV_REG_A0 + 5],
+                           0, 0);
+            break;
+        case EXCP_INTERRUPT:
+            /* just indicate that signals should be handled asap */
+            break;
+        case RISCV_EXCP_ILLEGAL_INST:
+        case RISCV_EXCP_PRIV_INST:
+        case RISCV_EXCP_FP_DISABLED:
+            info.si_signo = TARGET_SIGILL;
+            info.si_errno = 0;
+            info.si_code = trapnr == RISCV_EXCP_ILLEGAL_INST ?
+                           TARGET_ILL_ILLOPC : TARGET_ILL_PRVOPC;
+            info._sifields._sigfault._addr = env->active_tc.PC;
+            queue_signal(env, info.si_signo, &info);
+            break;
+        case RISCV_EXCP_INST_ADDR_MIS:
+            info.si_signo = TARGET_SIGBUS;
+            info.si_errno = 0;
+            info.si_code = TARGET_BUS_ADRALN;
+            info._sifields._sigfault._addr = env->active_tc.PC;
+            queue_signal(env, info.si_signo, &info);
+            break;
+        case RISCV_EXCP_LOAD_ADDR_MIS:
+        case RISCV_EXCP_STORE_ADDR_MIS:
+            info.si_signo = TARGET_SIGBUS;
+            info.si_errno = 0;
+            info.si_code = TARGET_BUS_ADRALN;
+            info._sifields._sigfault._addr = env->helper_csr[CSR_BADVADDR];
+            queue_signal(env, info.si_signo, &info);
+            break;
+        case RISCV_EXCP_INST_ACCESS_FAULT:
+            info.si_signo = TARGET_SIGSEGV;
+            info.si_errno = 0;
+            info.si_code = TARGET_SEGV_MAPERR;
+            info._sifields._sigfault._addr = env->active_tc.PC;
+            queue_signal(env, info.si_signo, &info);
+            break;
+        case RISCV_EXCP_LOAD_ACCESS_FAULT:
+        case RISCV_EXCP_STORE_ACCESS_FAULT:
+            info.si_signo = TARGET_SIGSEGV;
+            info.si_errno = 0;
+            info.si_code = TARGET_SEGV_MAPERR;
+            info._sifields._sigfault._addr = env->helper_csr[CSR_BADVADDR];
+            queue_signal(env, info.si_signo, &info);
+            break;
+        case RISCV_EXCP_BREAK:
+        case EXCP_DEBUG:
+            sig = gdb_handlesig(cs, TARGET_SIGTRAP);
+            if (sig) {
+                info.si_signo = sig;
+                info.si_errno = 0;
+                info.si_code = TARGET_TRAP_BRKPT;
+                queue_signal(env, info.si_signo, &info);
+            }
+            break;
+        default:
+            fprintf(stderr, "qemu: unhandled CPU exception 0x%x - aborting\n",
+                    trapnr);
+            cpu_dump_state(cs, stderr, fprintf, 0);
+            abort();
+        }
+        process_pending_signals(env);
+    }
+}
+
+#endif /* TARGET_RISCV */
+
 #ifdef TARGET_SH4
 void cpu_loop(CPUSH4State *env)
 {
@@ -3902,6 +3996,8 @@ int main(int argc, char **argv, char **envp)
 #endif
 #elif defined TARGET_OPENRISC
         cpu_model = "or1200";
+#elif defined(TARGET_RISCV)
+        cpu_model = "riscv-generic";
 #elif defined(TARGET_PPC)
 #ifdef TARGET_PPC64
         cpu_model = "970fx";
@@ -4319,6 +4415,17 @@ int main(int argc, char **argv, char **envp)
         env->sr = regs->sr;
         env->pc = regs->pc;
     }
+#elif defined(TARGET_RISCV)
+    {
+        int i;
+
+        for (i = 1; i < 32; i++) {
+            env->active_tc.gpr[i] = regs->gpr[i];
+        }
+        env->active_tc.PC = regs->sepc;
+        /* 64-bit user mode with the FPU enabled */
+        env->helper_csr[CSR_STATUS] = SR_U64 | SR_EF;
+    }
 #elif defined(TARGET_SH4)
     {
         int i;
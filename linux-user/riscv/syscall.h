@@ -0,0 +1,17 @@
+/*
+ * RISC-V register state saved on a trap, in the order of the integer
+ * register file. The system call number is passed in v0 and the
+ * arguments in a0-a5; the result is returned in v0.
+ */
+struct target_pt_regs {
+    abi_ulong gpr[32];
+    abi_ulong sepc;
+    abi_ulong sstatus;
+    abi_ulong sbadaddr;
+    abi_ulong scause;
+    abi_ulong syscallno;
+};
+
+#define UNAME_MACHINE "riscv"
+#define UNAME_MINIMUM_RELEASE "3.14.0"
+#define TARGET_CLONE_BACKWARDS
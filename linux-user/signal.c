@@ -3897,6 +3897,181 @@ long do_rt_sigreturn(CPUCRISState *env)
     return -TARGET_ENOSYS;
 }
 
+#elif defined(TARGET_RISCV)
+
+/* Signal frames use the same layout as the kernel's rt_sigframe: siginfo,
+ * then a ucontext whose mcontext holds pc and x1-x31 followed by the FP
+ * registers, then a trampoline that calls rt_sigreturn. */
+
+struct target_sigcontext {
+    abi_ulong pc;
+    abi_ulong gpr[31]; /* x0 is not saved */
+    uint64_t fpr[32];
+    uint32_t fcsr;
+};
+
+struct target_ucontext {
+    abi_ulong tuc_flags;
+    abi_ulong tuc_link;
+    target_stack_t tuc_stack;
+    target_sigset_t tuc_sigmask;
+    /* glibc uses a 1024-bit sigset_t */
+    char __unused[1024 / 8 - sizeof(target_sigset_t)];
+    /* last for future expansion */
+    struct target_sigcontext tuc_mcontext;
+};
+
+struct target_rt_sigframe {
+    struct target_siginfo info;
+    struct target_ucontext uc;
+    uint32_t tramp[2];
+};
+
+static void setup_sigcontext(struct target_sigcontext *sc, CPURISCVState *env)
+{
+    int i;
+
+    __put_user(env->active_tc.PC, &sc->pc);
+    for (i = 1; i < 32; i++) {
+        __put_user(env->active_tc.gpr[i], &sc->gpr[i - 1]);
+    }
+    for (i = 0; i < 32; i++) {
+        __put_user(env->active_tc.fpr[i], &sc->fpr[i]);
+    }
+    __put_user(env->helper_csr[CSR_FFLAGS] | (env->helper_csr[CSR_FRM] << 5),
+               &sc->fcsr);
+}
+
+static void restore_sigcontext(CPURISCVState *env,
+                               struct target_sigcontext *sc)
+{
+    uint32_t fcsr;
+    int i;
+
+    __get_user(env->active_tc.PC, &sc->pc);
+    for (i = 1; i < 32; i++) {
+        __get_user(env->active_tc.gpr[i], &sc->gpr[i - 1]);
+    }
+    for (i = 0; i < 32; i++) {
+        __get_user(env->active_tc.fpr[i], &sc->fpr[i]);
+    }
+    __get_user(fcsr, &sc->fcsr);
+    env->helper_csr[CSR_FFLAGS] = fcsr & 0x1F;
+    env->helper_csr[CSR_FRM] = (fcsr >> 5) & 0x7;
+}
+
+static abi_ulong get_sigframe(struct target_sigaction *ka,
+                              CPURISCVState *env)
+{
+    abi_ulong sp = env->active_tc.gpr[RISCV_REG_SP];
+
+    /*
+     * This is the X/Open sanctioned signal stack switching.
+     */
+    if ((ka->sa_flags & TARGET_SA_ONSTACK) && !sas_ss_flags(sp)) {
+        sp = target_sigaltstack_used.ss_sp + target_sigaltstack_used.ss_size;
+    }
+
+    return (sp - sizeof(struct target_rt_sigframe)) & ~15;
+}
+
+static void setup_rt_frame(int sig, struct target_sigaction *ka,
+                           target_siginfo_t *info, target_sigset_t *set,
+                           CPURISCVState *env)
+{
+    struct target_rt_sigframe *frame;
+    abi_ulong frame_addr;
+    int i;
+
+    frame_addr = get_sigframe(ka, env);
+    if (!lock_user_struct(VERIFY_WRITE, frame, frame_addr, 0)) {
+        goto give_sigsegv;
+    }
+
+    __put_user(0, &frame->uc.tuc_flags);
+    __put_user(0, &frame->uc.tuc_link);
+    __put_user(target_sigaltstack_used.ss_sp, &frame->uc.tuc_stack.ss_sp);
+    __put_user(sas_ss_flags(env->active_tc.gpr[RISCV_REG_SP]),
+               &frame->uc.tuc_stack.ss_flags);
+    __put_user(target_sigaltstack_used.ss_size,
+               &frame->uc.tuc_stack.ss_size);
+    setup_sigcontext(&frame->uc.tuc_mcontext, env);
+    for (i = 0; i < TARGET_NSIG_WORDS; i++) {
+        __put_user(set->sig[i], &frame->uc.tuc_sigmask.sig[i]);
+    }
+
+    /* li v0, __NR_rt_sigreturn; scall */
+    __put_user(0x00000813 | (TARGET_NR_rt_sigreturn << 20), &frame->tramp[0]);
+    __put_user(0x00000073, &frame->tramp[1]);
+
+    if (info && copy_siginfo_to_user(&frame->info, info)) {
+        goto give_sigsegv;
+    }
+
+    env->active_tc.PC = ka->_sa_handler;
+    env->active_tc.gpr[RISCV_REG_SP] = frame_addr;
+    env->active_tc.gpr[RISCV_REG_RA] =
+        frame_addr + offsetof(struct target_rt_sigframe, tramp);
+    env->active_tc.gpr[RISCV_REG_A0] = sig;
+    env->active_tc.gpr[RISCV_REG_A0 + 1] =
+        frame_addr + offsetof(struct target_rt_sigframe, info);
+    env->active_tc.gpr[RISCV_REG_A0 + 2] =
+        frame_addr + offsetof(struct target_rt_sigframe, uc);
+
+    unlock_user_struct(frame, frame_addr, 1);
+    return;
+
+ give_sigsegv:
+    unlock_user_struct(frame, frame_addr, 1);
+    force_sig(TARGET_SIGSEGV);
+}
+
+static void setup_frame(int sig, struct target_sigaction *ka,
+                        target_sigset_t *set, CPURISCVState *env)
+{
+    setup_rt_frame(sig, ka, NULL, set, env);
+}
+
+long do_rt_sigreturn(CPURISCVState *env)
+{
+    struct target_rt_sigframe *frame;
+    abi_ulong frame_addr = env->active_tc.gpr[RISCV_REG_SP];
+    target_sigset_t target_set;
+    sigset_t set;
+    int i;
+
+    if (!lock_user_struct(VERIFY_READ, frame, frame_addr, 1)) {
+        goto badframe;
+    }
+
+    for (i = 0; i < TARGET_NSIG_WORDS; i++) {
+        __get_user(target_set.sig[i], &frame->uc.tuc_sigmask.sig[i]);
+    }
+    target_to_host_sigset_internal(&set, &target_set);
+    do_sigprocmask(SIG_SETMASK, &set, NULL);
+
+    restore_sigcontext(env, &frame->uc.tuc_mcontext);
+
+    if (do_sigaltstack(frame_addr +
+            offsetof(struct target_rt_sigframe, uc.tuc_stack),
+            0, get_sp_from_cpustate(env)) == -EFAULT) {
+        goto badframe;
+    }
+
+    unlock_user_struct(frame, frame_addr, 0);
+    return env->active_tc.gpr[RISCV_REG_V0];
+
+ badframe:
+    unlock_user_struct(frame, frame_addr, 0);
+    force_sig(TARGET_SIGSEGV);
+    return 0;
+}
+
+long do_sigreturn(CPURISCVState *env)
+{
+    return do_rt_sigreturn(env);
+}
+
 #elif defined(TARGET_OPENRISC)
 
 struct target_sigcontext {
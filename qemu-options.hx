@@ -35,7 +35,8 @@ DEF("machine", HAS_ARG, QEMU_OPTION_machine, \
     "                kernel_irqchip=on|off controls accelerated irqchip support\n"
     "                kvm_shadow_mem=size of KVM shadow MMU\n"
     "                dump-guest-core=on|off include guest memory in a core dump (default=on)\n"
-    "                mem-merge=on|off controls memory merge support (default: on)\n",
+    "                mem-merge=on|off controls memory merge support (default: on)\n"
+    "                mem-image=file maps a RAM image copy-on-write at address 0\n",
     QEMU_ARCH_ALL)
 STEXI
 @item -machine [type=]@var{name}[,prop=@var{value}[,...]]
@@ -58,6 +59,12 @@ Include guest memory in a core dump. The default is on.
 Enables or disables memory merge support. This feature, when supported by
 the host, de-duplicates identical memory pages among VMs instances
 (enabled by default).
+@item mem-image=@var{file}
+Map @var{file} copy-on-write as the contents of the RAM from physical
+address 0, instead of loading a kernel into it. Only the pages the guest
+touches are read, and the page cache is shared with other instances that
+use the same image. On reset the RAM reverts to the image. Supported by the
+RISC-V board.
 @end table
 ETEXI
 
@@ -2938,6 +2945,47 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tlb", HAS_ARG, QEMU_OPTION_tlb, \
+    "-tlb [size=]n[,min=n][,max=n]\n"
+    "                set the initial, minimum and maximum number of TLB\n"
+    "                entries of each MMU mode\n", QEMU_ARCH_ALL)
+STEXI
+@item -tlb [size=]@var{n}[,min=@var{n}][,max=@var{n}]
+@findex -tlb
+Size the software TLB of each MMU mode of the emulated CPUs. The TLB starts
+with @var{size} entries and is resized when it is flushed, growing while its
+entries are in short supply and shrinking when few of them are used, within
+@var{min} and @var{max} entries. All values are rounded up to a power of two
+and limited to what the host supports. On hosts or targets where the TLB has
+a fixed size this option is ignored.
+ETEXI
+
+DEF("tb-cache", HAS_ARG, QEMU_OPTION_tb_cache, \
+    "-tb-cache [file=]path[,size=n]\n"
+    "                reuse translated code saved in path by earlier runs\n"
+    "                and keep at most n bytes of it (default: 64M)\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-cache [file=]@var{path}[,size=@var{n}]
+@findex -tb-cache
+Keep the translated host code in @var{path} across runs. QEMU loads it at
+startup, uses it instead of translating guest code that it has seen before,
+and writes back what it used or translated on exit. This saves time when
+the same guest is started over and over, for example to boot a test image.
+The file is only valid for the QEMU binary and host CPU that wrote it, and
+is replaced when it does not match. Code that a run did not use is dropped
+from the file. At most @var{n} bytes of translated code are kept, in memory
+and in the file, 64M by default; once that is reached, new translations are
+not added. Only some hosts and targets support the cache; it is ignored
+elsewhere, and when TCG is not used.
+
+The file holds host code that QEMU runs without translating it again, so
+anyone who can write it can run code inside QEMU. QEMU ignores @var{path}
+unless it is a regular file owned by the user running QEMU and not
+writable by group or others, and creates it with mode 0600. Keep it in a
+directory that other users cannot write either.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming p     prepare for incoming migration, listen on port p\n",
     QEMU_ARCH_ALL)
@@ -41,6 +41,8 @@
 #include "qemu/iov.h"
 #include "block/snapshot.h"
 #include "block/qapi.h"
+#include "exec/cpu-all.h"
+#include "exec/ram_addr.h"
 
 #define SELF_ANNOUNCE_ROUNDS 5
 
@@ -1027,6 +1029,192 @@ void qmp_xen_save_devices_state(const char *filename, Error **errp)
     }
 }
 
+/* In-memory snapshots
+ *
+ * savevm_mem keeps a copy of guest RAM and of the device state in host
+ * memory, and loadvm_mem goes back to it as often as needed, which is what
+ * fuzzers do. Only the RAM pages written since the snapshot was taken or
+ * last restored are copied back; the TCG dirty bitmap for migration tracks
+ * them, so a migration must not run at the same time. Disks are not
+ * rolled back.
+ */
+typedef struct MemSnapshot {
+    uint8_t *ram;           /* all RAM blocks, in ram_list order */
+    ram_addr_t ram_size;
+    uint32_t ram_version;   /* ram_list.version the copy was taken at */
+    uint8_t *dev;           /* device state, as qemu_save_device_state */
+    size_t dev_len;
+    size_t dev_alloc;
+} MemSnapshot;
+
+static MemSnapshot mem_snapshot;
+
+static int mem_snapshot_put_buffer(void *opaque, const uint8_t *buf,
+                                   int64_t pos, int size)
+{
+    MemSnapshot *s = opaque;
+
+    if (pos + size > s->dev_alloc) {
+        s->dev_alloc = MAX(s->dev_alloc * 2, pos + size);
+        s->dev = g_realloc(s->dev, s->dev_alloc);
+    }
+    memcpy(s->dev + pos, buf, size);
+    s->dev_len = MAX(s->dev_len, pos + size);
+    return size;
+}
+
+static int mem_snapshot_get_buffer(void *opaque, uint8_t *buf,
+                                   int64_t pos, int size)
+{
+    MemSnapshot *s = opaque;
+
+    if (pos >= s->dev_len) {
+        return 0;
+    }
+    size = MIN(size, s->dev_len - pos);
+    memcpy(buf, s->dev + pos, size);
+    return size;
+}
+
+static const QEMUFileOps mem_snapshot_write_ops = {
+    .put_buffer = mem_snapshot_put_buffer,
+};
+
+static const QEMUFileOps mem_snapshot_read_ops = {
+    .get_buffer = mem_snapshot_get_buffer,
+};
+
+static int mem_snapshot_save(MemSnapshot *s)
+{
+    RAMBlock *block;
+    ram_addr_t size = 0;
+    QEMUFile *f;
+    int ret;
+
+    qemu_mutex_lock_ramlist();
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        size += block->length;
+    }
+    if (size != s->ram_size) {
+        g_free(s->ram);
+        s->ram = g_malloc(size);
+        s->ram_size = size;
+    }
+    size = 0;
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        memcpy(s->ram + size, block->host, block->length);
+        cpu_physical_memory_reset_dirty(block->offset, block->length,
+                                        DIRTY_MEMORY_MIGRATION);
+        size += block->length;
+    }
+    s->ram_version = ram_list.version;
+    qemu_mutex_unlock_ramlist();
+
+    s->dev_len = 0;
+    f = qemu_fopen_ops(s, &mem_snapshot_write_ops);
+    ret = qemu_save_device_state(f);
+    qemu_fclose(f);
+    return ret;
+}
+
+static int mem_snapshot_load(MemSnapshot *s, uint64_t *pages)
+{
+    unsigned long *dirty = ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION];
+    unsigned long page, first, last;
+    RAMBlock *block;
+    ram_addr_t base = 0, offset;
+    QEMUFile *f;
+    int ret;
+
+    *pages = 0;
+    qemu_mutex_lock_ramlist();
+    if (ram_list.version != s->ram_version) {
+        // RAM was hotplugged or unplugged since
+        qemu_mutex_unlock_ramlist();
+        return -EINVAL;
+    }
+    QTAILQ_FOREACH(block, &ram_list.blocks, next) {
+        first = block->offset >> TARGET_PAGE_BITS;
+        last = (block->offset + block->length) >> TARGET_PAGE_BITS;
+        for (page = find_next_bit(dirty, last, first); page < last;
+             page = find_next_bit(dirty, last, page + 1)) {
+            offset = (page << TARGET_PAGE_BITS) - block->offset;
+            memcpy(block->host + offset, s->ram + base + offset,
+                   TARGET_PAGE_SIZE);
+            (*pages)++;
+        }
+        cpu_physical_memory_reset_dirty(block->offset, block->length,
+                                        DIRTY_MEMORY_MIGRATION);
+        base += block->length;
+    }
+    qemu_mutex_unlock_ramlist();
+
+    // the pages copied back may hold code that was translated since
+    if (*pages) {
+        tb_flush(first_cpu->env_ptr);
+    }
+
+    f = qemu_fopen_ops(s, &mem_snapshot_read_ops);
+    ret = qemu_loadvm_state(f);
+    qemu_fclose(f);
+    return ret;
+}
+
+void do_savevm_mem(Monitor *mon, const QDict *qdict)
+{
+    int saved_vm_running = runstate_is_running();
+    int ret;
+
+    if (!tcg_enabled()) {
+        monitor_printf(mon, "In-memory snapshots need TCG dirty tracking\n");
+        return;
+    }
+    if (qemu_savevm_state_blocked(NULL)) {
+        monitor_printf(mon, "A device does not support snapshots\n");
+        return;
+    }
+
+    vm_stop(RUN_STATE_SAVE_VM);
+    bdrv_drain_all();
+    ret = mem_snapshot_save(&mem_snapshot);
+    if (ret < 0) {
+        monitor_printf(mon, "Error %d while saving VM state\n", ret);
+        g_free(mem_snapshot.ram);
+        mem_snapshot.ram = NULL;
+        mem_snapshot.ram_size = 0;
+    }
+    if (saved_vm_running) {
+        vm_start();
+    }
+}
+
+void do_loadvm_mem(Monitor *mon, const QDict *qdict)
+{
+    int saved_vm_running = runstate_is_running();
+    uint64_t pages;
+    int ret;
+
+    if (!mem_snapshot.ram) {
+        monitor_printf(mon, "No in-memory snapshot, use savevm_mem\n");
+        return;
+    }
+
+    vm_stop(RUN_STATE_RESTORE_VM);
+    // no request may complete into the RAM being restored
+    bdrv_drain_all();
+    ret = mem_snapshot_load(&mem_snapshot, &pages);
+    if (ret < 0) {
+        monitor_printf(mon, "Error %d while loading VM state\n", ret);
+        return;
+    }
+    if (qdict_get_try_bool(qdict, "verbose", 0)) {
+        monitor_printf(mon, "%" PRIu64 " pages restored\n", pages);
+    }
+    if (saved_vm_running) {
+        vm_start();
+    }
+}
+
 int load_vmstate(const char *name)
 {
     BlockDriverState *bs, *bs_vm_state;
@@ -57,6 +57,10 @@ typedef struct RISCVCPU {
     /*< public >*/
 
     CPURISCVState env;
+
+    /* cycle/time/instret count retired instructions instead of reading
+     * the virtual clock, see the "icount-counters" property */
+    bool icount_counters;
 } RISCVCPU;
 
 static inline RISCVCPU *riscv_env_get_cpu(CPURISCVState *env)
@@ -68,9 +72,15 @@ static inline RISCVCPU *riscv_env_get_cpu(CPURISCVState *env)
 
 #define ENV_OFFSET offsetof(RISCVCPU, env)
 
+#ifndef CONFIG_USER_ONLY
+extern const struct VMStateDescription vmstate_riscv_cpu;
+#endif
+
 void riscv_cpu_do_interrupt(CPUState *cpu);
 void riscv_cpu_dump_state(CPUState *cpu, FILE *f, fprintf_function cpu_fprintf,
                          int flags);
+void riscv_cpu_dump_statistics(CPUState *cpu, FILE *f,
+                               fprintf_function cpu_fprintf, int flags);
 hwaddr riscv_cpu_get_phys_page_debug(CPUState *cpu, vaddr addr);
 int riscv_cpu_gdb_read_register(CPUState *cpu, uint8_t *buf, int reg);
 int riscv_cpu_gdb_write_register(CPUState *cpu, uint8_t *buf, int reg);
@@ -21,6 +21,7 @@
 
 #include "cpu.h"
 #include "qemu-common.h"
+#include "hw/qdev-properties.h"
 
 static void riscv_cpu_set_pc(CPUState *cs, vaddr value)
 {
@@ -42,11 +43,11 @@ static bool riscv_cpu_has_work(CPUState *cs)
     CPURISCVState *env = &cpu->env;
     bool has_work = false;
 
-    /* It is implementation dependent if non-enabled interrupts
-       wake-up the CPU, however most of the implementations only
-       check for interrupts that can be taken. */
+    /* A hart halted in WFI wakes up for any interrupt enabled in the
+       mask, whether or not interrupts are globally enabled; it is only
+       taken once the guest sets EI. */
     if ((cs->interrupt_request & CPU_INTERRUPT_HARD) &&
-        cpu_riscv_hw_interrupts_pending(env)) {
+        cpu_riscv_wfi_wakeup(env)) {
         has_work = true;
     }
 
@@ -89,6 +90,11 @@ static void riscv_cpu_initfn(Object *obj)
     }
 }
 
+static Property riscv_cpu_properties[] = {
+    DEFINE_PROP_BOOL("icount-counters", RISCVCPU, icount_counters, false),
+    DEFINE_PROP_END_OF_LIST()
+};
+
 static void riscv_cpu_class_init(ObjectClass *c, void *data)
 {
     RISCVCPUClass *mcc = RISCV_CPU_CLASS(c);
@@ -97,6 +103,7 @@ static void riscv_cpu_class_init(ObjectClass *c, void *data)
 
     mcc->parent_realize = dc->realize;
     dc->realize = riscv_cpu_realizefn;
+    dc->props = riscv_cpu_properties;
 
     mcc->parent_reset = cc->reset;
     cc->reset = riscv_cpu_reset;
@@ -104,6 +111,7 @@ static void riscv_cpu_class_init(ObjectClass *c, void *data)
     cc->has_work = riscv_cpu_has_work;
     cc->do_interrupt = riscv_cpu_do_interrupt;
     cc->dump_state = riscv_cpu_dump_state;
+    cc->dump_statistics = riscv_cpu_dump_statistics;
     cc->set_pc = riscv_cpu_set_pc;
     cc->synchronize_from_tb = riscv_cpu_synchronize_from_tb;
     cc->gdb_read_register = riscv_cpu_gdb_read_register;
@@ -113,6 +121,7 @@ static void riscv_cpu_class_init(ObjectClass *c, void *data)
 #else
     cc->do_unassigned_access = riscv_cpu_unassigned_access;
     cc->get_phys_page_debug = riscv_cpu_get_phys_page_debug;
+    cc->vmsd = &vmstate_riscv_cpu;
 #endif
 
     cc->gdb_num_core_regs = 73;
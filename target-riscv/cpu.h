@@ -14,9 +14,17 @@
 #include "config.h"
 #include "qemu-common.h"
 #include "riscv-defs.h"
+
+// CPU reset leaves CPU_COMMON alone, so the TLB can be sized at run time
+#define TARGET_DYN_TLB 1
+
 #include "exec/cpu-defs.h"
 
-#define NB_MMU_MODES 2
+// MMU mode = (ASID slot << 1) | SR_S. Each of the RISCV_ASID_SLOTS most
+// recently used ASIDs has its own user and supervisor TLBs, so switching
+// between them does not flush anything. See riscv_set_asid.
+#define RISCV_ASID_SLOTS 3 // softmmu_exec.h supports up to 6 MMU modes
+#define NB_MMU_MODES (2 * RISCV_ASID_SLOTS)
 
 struct CPURISCVState;
 
@@ -63,9 +71,10 @@ struct CPURISCVState;
 #define RISCV_EXCP_LOAD_ACCESS_FAULT    0xa
 #define RISCV_EXCP_STORE_ACCESS_FAULT   0xb
 #define RISCV_EXCP_STORE_ACCEL_DISABLED 0xc
+#define RISCV_EXCP_COUNT                16 // synchronous causes counted
 #define RISCV_EXCP_TIMER_INTERRUPT      (0x7 | (1 << 31)) 
 #define RISCV_EXCP_HOST_INTERRUPT       (0x6 | (1 << 31)) 
-#define RISCV_EXCP_SERIAL_INTERRUPT     (0x4 | (1 << 31)) // not part of ISA
+#define RISCV_EXCP_IPI_INTERRUPT        (0x5 | (1 << 31))
 
 // RISCV Status Reg Bits
 #define SR_S           0x1
@@ -91,6 +100,38 @@ struct CPURISCVState;
 #define PTE_SW  0x80
 #define PTE_SX 0x100
 
+// Integer registers with a fixed role in the calling convention
+#define RISCV_REG_RA  1
+#define RISCV_REG_SP 14
+#define RISCV_REG_TP 15
+#define RISCV_REG_V0 16
+#define RISCV_REG_A0 18
+#define RISCV_REG_GP 31
+
+// Return address stack, only kept to count how often it would predict the
+// target of function returns ("info cpustats"). It costs a few TCG ops on
+// every call, so it is compiled out unless this is defined.
+//#define RISCV_RAS_STATS
+#define RISCV_RAS_SIZE 16
+
+// Reasons for leaving generated code for the main loop, see tb_exit
+enum {
+    RISCV_TB_EXIT_UNCHAINED,   // goto_tb that cpu_exec has not patched yet
+    RISCV_TB_EXIT_NOCHAIN,     // chaining disabled, or no goto_ptr
+    RISCV_TB_EXIT_LOOKUP_MISS, // lookup helper found no TB
+    RISCV_TB_EXIT_IRQ,         // lookup helper saw a pending interrupt
+    RISCV_TB_EXIT_COUNT
+};
+
+// Page walk cache: non-leaf PTEs of the two upper levels, direct mapped
+// on the virtual address bits they translate. tag is -1 when invalid.
+#define RISCV_PWC_SIZE 16
+
+typedef struct riscv_pwc_entry {
+    target_ulong tag;
+    uint64_t base;  // physical address of the next level table
+} riscv_pwc_entry;
+
 typedef struct riscv_def_t riscv_def_t;
 
 typedef struct TCState TCState;
@@ -111,6 +152,60 @@ struct CPURISCVState {
 
     uint64_t helper_csr[32]; // RISCV CSR registers
 
+    // LR/SC reservation: address and value seen by the last LR, load_res
+    // is -1 when no reservation is held
+    target_ulong load_res;
+    target_ulong load_val;
+
+#ifdef RISCV_RAS_STATS
+    // Return address stack, pushed by calls (rd == ra), popped by
+    // jalr x0, ra. Only used for statistics, never for correctness.
+    target_ulong ras[RISCV_RAS_SIZE];
+    uint32_t ras_top;
+#endif
+
+    riscv_pwc_entry pwc[2][RISCV_PWC_SIZE];
+
+    // ASID cached in each TLB slot, -1 if none. asid_victim is the next
+    // slot to recycle for an ASID that has none.
+    target_ulong asid_slot_tag[RISCV_ASID_SLOTS];
+    uint32_t asid_slot;
+    uint32_t asid_victim;
+
+    // Indirect branch statistics, see "info cpustats"
+    uint64_t tb_lookup_hit;
+    uint64_t tb_lookup_miss;
+#ifdef RISCV_RAS_STATS
+    uint64_t ras_hit;
+    uint64_t ras_miss;
+#endif
+    uint64_t xpage_hit;      // direct jumps to another page kept in TCG code
+    uint64_t xpage_miss;
+    uint64_t tb_lookup_phys; // jump cache misses resolved by physical address
+    uint64_t tb_exit[RISCV_TB_EXIT_COUNT];
+
+    // MMU and trap statistics, see "info cpustats"
+    uint64_t tlb_fill;       // calls to riscv_cpu_handle_mmu_fault
+    uint64_t tlb_fill_fault; // ...of which raised an access fault
+    uint64_t ptw_load;       // page table entries read by the walker
+    uint64_t pwc_hit;        // walks started from the page walk cache
+    uint64_t asid_switch;    // ASID writes that found their TLB slot
+    uint64_t asid_recycle;   // ...and that had to flush a slot
+    uint64_t wfi_halt;       // WFI instructions that put the hart to sleep
+    uint64_t excp_count[RISCV_EXCP_COUNT];
+    uint64_t irq_count[8];
+
+    // Translation statistics, see "info cpustats". Retranslations done to
+    // recover the guest state after a fault are not counted.
+    uint64_t tr_tb;          // TBs translated
+    uint64_t tr_insns;       // guest instructions translated
+    uint64_t tr_ops;         // TCG ops generated for them
+    uint64_t tr_ns;          // host time spent in the front end
+
+    // Instructions retired, maintained at TB exits when the icount-counters
+    // property is set. cycle and time read it too (one cycle per insn).
+    uint64_t instret;
+
     /* QEMU */
     CPU_COMMON
 
@@ -118,10 +213,15 @@ struct CPURISCVState {
     const riscv_def_t *cpu_model;
     void *irq[8];
     QEMUTimer *timer; /* Internal timer */
+    uint64_t last_count_update; /* QEMU_CLOCK_VIRTUAL ns of last COUNT write */
+    int64_t boot_start_ns;      /* host clock at board init, 0 if unknown */
+    int64_t first_tb_ns;        /* host clock at the first translation */
 };
 
 #include "cpu-qom.h"
 
+extern const char * const riscv_excp_names[13];
+
 #if !defined(CONFIG_USER_ONLY)
 void riscv_cpu_unassigned_access(CPUState *cpu, hwaddr addr,
                                 bool is_write, bool is_exec, int unused,
@@ -138,11 +238,10 @@ void riscv_cpu_list (FILE *f, fprintf_function cpu_fprintf);
 extern void cpu_wrdsp(uint32_t rs, uint32_t mask_num, CPURISCVState *env);
 extern uint32_t cpu_rddsp(uint32_t mask_num, CPURISCVState *env);
 
-#define CPU_SAVE_VERSION 3
 
 static inline int cpu_mmu_index (CPURISCVState *env)
 {
-    return env->helper_csr[CSR_STATUS] & SR_S;
+    return (env->asid_slot << 1) | (env->helper_csr[CSR_STATUS] & SR_S);
 }
 
 static inline int cpu_riscv_hw_interrupts_pending(CPURISCVState *env)
@@ -164,6 +263,15 @@ static inline int cpu_riscv_hw_interrupts_pending(CPURISCVState *env)
     return r;
 }
 
+/* WFI resumes on any pending interrupt that is enabled in the mask, even
+ * with interrupts globally disabled */
+static inline int cpu_riscv_wfi_wakeup(CPURISCVState *env)
+{
+    target_ulong status = env->helper_csr[CSR_STATUS];
+
+    return (status >> 24) & (status >> 16) & 0xFF;
+}
+
 #include "exec/cpu-all.h"
 
 /* Memory access type :
@@ -208,10 +316,14 @@ void cpu_riscv_start_count(CPURISCVState *env);
 
 /* hw/riscv/riscv_int.c */
 void cpu_riscv_soft_irq(CPURISCVState *env, int irq, int level);
+void cpu_riscv_send_ipi(CPURISCVState *env, target_ulong hartid);
+void cpu_riscv_clear_ipi(CPURISCVState *env, int level);
 
 /* helper.c */
 int riscv_cpu_handle_mmu_fault(CPUState *cpu, vaddr address, int rw,
                               int mmu_idx);
+void riscv_pwc_flush(CPURISCVState *env);
+void riscv_asid_slots_reset(CPURISCVState *env);
 #if !defined(CONFIG_USER_ONLY)
 hwaddr cpu_riscv_translate_address (CPURISCVState *env, target_ulong address,
 		                               int rw);
@@ -222,7 +334,15 @@ static inline void cpu_get_tb_cpu_state(CPURISCVState *env, target_ulong *pc,
 {
     *pc = env->active_tc.PC;
     *cs_base = 0;
-    *flags = 0; // necessary to avoid compiler warning
+    // generated code bakes in the MMU mode, see gen_intermediate_code
+    *flags = cpu_mmu_index(env);
+}
+
+// What else gen_intermediate_code depends on, for the persistent TB cache
+#define TARGET_TB_CACHE 1
+static inline uint32_t cpu_tb_cache_config(CPURISCVState *env)
+{
+    return riscv_env_get_cpu(env)->icount_counters;
 }
 
 #include "exec/exec-all.h"
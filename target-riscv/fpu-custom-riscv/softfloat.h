@@ -41,10 +41,20 @@ these four paragraphs for those parts of this code that are retained.
 
 #include "softfloat_types.h"
 
+/*----------------------------------------------------------------------------
+| The global state below is per host thread, so that harts running on
+| different threads do not see each other's rounding mode and flags.
+*----------------------------------------------------------------------------*/
+#ifdef __linux__
+#define softfloat_thread_local __thread
+#else
+#define softfloat_thread_local
+#endif
+
 /*----------------------------------------------------------------------------
 | Software floating-point underflow tininess-detection mode.
 *----------------------------------------------------------------------------*/
-extern int_fast8_t softfloat_detectTininess;
+extern softfloat_thread_local int_fast8_t softfloat_detectTininess;
 enum {
     softfloat_tininess_beforeRounding = 0,
     softfloat_tininess_afterRounding  = 1
@@ -53,7 +63,7 @@ enum {
 /*----------------------------------------------------------------------------
 | Software floating-point rounding mode.
 *----------------------------------------------------------------------------*/
-extern int_fast8_t softfloat_roundingMode;
+extern softfloat_thread_local int_fast8_t softfloat_roundingMode;
 enum {
     softfloat_round_nearest_even   = 0,
     softfloat_round_minMag         = 1,
@@ -65,7 +75,7 @@ enum {
 /*----------------------------------------------------------------------------
 | Software floating-point exception flags.
 *----------------------------------------------------------------------------*/
-extern int_fast8_t softfloat_exceptionFlags;
+extern softfloat_thread_local int_fast8_t softfloat_exceptionFlags;
 enum {
     softfloat_flag_inexact   =  1,
     softfloat_flag_underflow =  2,
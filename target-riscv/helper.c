@@ -25,6 +25,7 @@
 #include <signal.h>
 
 #include "cpu.h"
+#include "trace.h"
 
 // allow the optimized permissions checking if certain values in 
 // include/exec/cpu-all.h match what we expect
@@ -37,60 +38,98 @@ enum {
     TLBRET_MATCH = 0
 };
 
+void riscv_pwc_flush(CPURISCVState *env)
+{
+    memset(env->pwc, -1, sizeof(env->pwc));
+}
+
+// Forget the ASIDs cached in the TLB slots and give the current one slot 0
+void riscv_asid_slots_reset(CPURISCVState *env)
+{
+    memset(env->asid_slot_tag, -1, sizeof(env->asid_slot_tag));
+    env->asid_slot_tag[0] = env->helper_csr[CSR_ASID];
+    env->asid_slot = 0;
+    env->asid_victim = 1;
+}
+
 #if !defined(CONFIG_USER_ONLY)
 
+// Find the deepest table for address in the page walk cache. Returns the
+// level to continue the walk at, with *base set to that level's table.
+static inline int pwc_lookup(CPURISCVState *env, target_ulong address,
+                             uint64_t *base)
+{
+    int i;
+
+    for (i = 1; i >= 0; i--) {
+        target_ulong tag = address >> (13 + 20 - 10 * i);
+        riscv_pwc_entry *e = &env->pwc[i][tag & (RISCV_PWC_SIZE - 1)];
+        if (e->tag == tag) {
+            *base = e->base;
+            env->pwc_hit++;
+            return i + 1;
+        }
+    }
+    *base = env->helper_csr[CSR_PTBR];
+    return 0;
+}
+
+/* *page_size is set to the size of the mapping that was found, which is
+ * larger than TARGET_PAGE_SIZE for megapage and gigapage leaves. *global
+ * is set if the mapping is the same in every address space (PTE_G). */
 static int get_physical_address (CPURISCVState *env, hwaddr *physical,
-                                int *prot, target_ulong address,
+                                int *prot, target_ulong *page_size,
+                                bool *global, target_ulong address,
                                 int rw, int access_type)
 {
     /* NOTE: the env->active_tc.PC value visible here will not be
      * correct, but the value visible to the exception handler 
      * (riscv_cpu_do_interrupt) is correct */
 
+    *page_size = TARGET_PAGE_SIZE;
+    *global = false;
+
     // first, check if VM is on:
     if(unlikely(!(env->helper_csr[CSR_STATUS] & SR_VM))) {
         *physical = address;
         *prot = PAGE_READ | PAGE_WRITE | PAGE_EXEC;
     } else {
         // handle translation
-        if ((address >= 0x3f8) && (address < 0x400)) {
-            // TODO: fix linux so that this is not necessary
-            *physical = address;
-            *prot = PAGE_READ | PAGE_WRITE;
-            return TLBRET_MATCH;
-        }
-        if ((address >= 0x400) && (address <= 0x410)) {
-            // hacky memory hole to watch HTIF registers
-            *physical = address;
-            *prot = PAGE_READ | PAGE_WRITE;
-            return TLBRET_MATCH;
-        }
-
         CPUState *cs = CPU(riscv_env_get_cpu(env));
         uint64_t pte = 0; 
-        uint64_t base = env->helper_csr[CSR_PTBR];
+        uint64_t base;
         uint64_t ptd;
-        int ptshift = 20;
-        int64_t i = 0;
+        int64_t i = pwc_lookup(env, address, &base);
+        int ptshift = 20 - 10 * i;
 #ifdef OPTIMIZED_PERMISSIONS_CHECK
         uint8_t protcheck;
 #endif
-        for (i = 0; i < 3; i++, ptshift -= 10) {
+        for (; i < 3; i++, ptshift -= 10) {
             uint64_t idx = (address >> (13+ptshift)) & ((1 << 10)-1);
             uint64_t pte_addr = base + (idx << 3);
 
             ptd = ldq_phys(cs->as, pte_addr);
+            env->ptw_load++;
 
             if (!(ptd & PTE_V)) { 
                 return TLBRET_NOMATCH;
             } else if (ptd & PTE_T) { 
                 base = (ptd >> 13) << 13;
+                if (i < 2) {
+                    target_ulong tag = address >> (13 + ptshift);
+                    riscv_pwc_entry *e =
+                        &env->pwc[i][tag & (RISCV_PWC_SIZE - 1)];
+                    e->tag = tag;
+                    e->base = base;
+                }
             } else {
                 uint64_t vpn = address >> 13;
                 ptd |= (vpn & ((1 <<(ptshift))-1)) << 13;
        
                 // TODO: fault if physical addr is out of range
                 pte = ptd;
+                *page_size = (target_ulong)TARGET_PAGE_SIZE << ptshift;
+                *global = (pte & PTE_G) != 0;
                 break;
             }
         }
@@ -188,9 +227,11 @@ hwaddr riscv_cpu_get_phys_page_debug(CPUState *cs, vaddr addr)
     RISCVCPU *cpu = RISCV_CPU(cs);
     hwaddr phys_addr;
     int prot;
+    target_ulong page_size;
+    bool global;
 
-    if (get_physical_address(&cpu->env, &phys_addr, &prot, addr, 0,
-                             ACCESS_INT) != 0) {
+    if (get_physical_address(&cpu->env, &phys_addr, &prot, &page_size,
+                             &global, addr, 0, ACCESS_INT) != 0) {
         return -1;
     }
     return phys_addr;
@@ -206,35 +247,53 @@ int riscv_cpu_handle_mmu_fault(CPUState *cs, vaddr address, int rw,
 #if !defined(CONFIG_USER_ONLY)
     hwaddr physical;
     int prot;
+    target_ulong page_size;
+    bool global;
     int access_type;
-#endif
     int ret = 0;
+#else
+    // user mode has no page tables: any fault is an access fault
+    int ret = TLBRET_NOMATCH;
+#endif
 
-    qemu_log("%s pc " TARGET_FMT_lx " ad %" VADDR_PRIx " rw %d mmu_idx %d\n",
-              __func__, env->active_tc.PC, address, rw, mmu_idx);
+    trace_riscv_mmu_fault(env->active_tc.PC, address, rw, mmu_idx);
+    env->tlb_fill++;
 
 #if !defined(CONFIG_USER_ONLY)
     access_type = ACCESS_INT; // TODO: huh? this was here from mips
-    ret = get_physical_address(env, &physical, &prot,
+    ret = get_physical_address(env, &physical, &prot, &page_size, &global,
                                address, rw, access_type);
-    qemu_log("%s address=%" VADDR_PRIx " ret %d physical " TARGET_FMT_plx
-             " prot %d\n",
-             __func__, address, ret, physical, prot);
+    trace_riscv_mmu_fault_ret(address, ret, physical, prot);
     if (ret == TLBRET_MATCH) {
         tlb_set_page(cs, address & TARGET_PAGE_MASK,
                      physical & TARGET_PAGE_MASK, prot | PAGE_EXEC,
-                     mmu_idx, TARGET_PAGE_SIZE);
+                     mmu_idx, page_size);
+        if (global) {
+            // global mappings are valid for every ASID: fill them into the
+            // other live slots too, so they survive context switches
+            int slot;
+            for (slot = 0; slot < RISCV_ASID_SLOTS; slot++) {
+                if (slot != (mmu_idx >> 1) &&
+                    env->asid_slot_tag[slot] != (target_ulong)-1) {
+                    tlb_set_page(cs, address & TARGET_PAGE_MASK,
+                                 physical & TARGET_PAGE_MASK,
+                                 prot | PAGE_EXEC,
+                                 (slot << 1) | (mmu_idx & 1), page_size);
+                }
+            }
+        }
         ret = 0;
     } else if (ret < 0)
 #endif
     {
         raise_mmu_exception(env, address, rw, ret);
+        env->tlb_fill_fault++;
         ret = 1;
     }
     return ret;
 }
 
-static const char * const riscv_excp_names[13] = {
+const char * const riscv_excp_names[13] = {
     "instruction_address_misaligned",
     "instruction_access_fault",
     "illegal_instruction",
@@ -265,18 +324,17 @@ void riscv_cpu_do_interrupt(CPUState *cs)
     }
 #endif
 
+    trace_riscv_cpu_do_interrupt(env->active_tc.PC, cs->exception_index);
+
     // Store Cause in CSR_CAUSE. this comes from cs->exception_index
     if (cs->exception_index & (0x1 << 31)) {
+        env->irq_count[cs->exception_index & 0x7]++;
         // hacky for now. the MSB (bit 63) indicates interrupt but cs->exception 
         // index is only 32 bits wide
-        if (cs->exception_index == RISCV_EXCP_SERIAL_INTERRUPT) {
-            // help out the slow serial device so the driver doesn't get confused
-            // turn off it's irq line
-            env->helper_csr[CSR_STATUS] &= ~(0x1 << 28);
-        }
         env->helper_csr[CSR_CAUSE] = cs->exception_index & 0x1F;
         env->helper_csr[CSR_CAUSE] |= (1L << 63);
     } else {
+        env->excp_count[cs->exception_index & (RISCV_EXCP_COUNT - 1)]++;
         env->helper_csr[CSR_CAUSE] = cs->exception_index;
     }
 
@@ -306,6 +364,9 @@ void riscv_cpu_do_interrupt(CPUState *cs)
     // may be used.
     env->helper_csr[CSR_EPC] = env->active_tc.PC;
 
+    // Any trap drops the LR/SC reservation
+    env->load_res = -1;
+
     // FINALLY, set PC to value in evec register and return
     env->active_tc.PC = env->helper_csr[CSR_EVEC];
 
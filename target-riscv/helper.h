@@ -3,6 +3,18 @@
 // Exceptions
 DEF_HELPER_2(raise_exception, noreturn, env, i32)
 
+// TB lookup for indirect branches and jumps to another page
+DEF_HELPER_FLAGS_2(lookup_tb_ptr, TCG_CALL_NO_WG, ptr, env, tl)
+#ifdef RISCV_RAS_STATS
+DEF_HELPER_FLAGS_2(lookup_tb_ptr_ret, TCG_CALL_NO_WG, ptr, env, tl)
+#endif
+DEF_HELPER_FLAGS_2(lookup_tb_ptr_direct, TCG_CALL_NO_WG, ptr, env, tl)
+
+// Atomics: LR/SC and AMOs, the last argument is the access size in bytes
+DEF_HELPER_3(lr, tl, env, tl, i32)
+DEF_HELPER_4(sc, tl, env, tl, tl, i32)
+DEF_HELPER_5(amo, tl, env, i32, tl, tl, i32)
+
 // MULHSU helper
 DEF_HELPER_3(mulhsu, tl, env, tl, tl)
 
@@ -21,9 +33,6 @@ DEF_HELPER_4(fadd_s, tl, env, tl, tl, tl)
 DEF_HELPER_4(fsub_s, tl, env, tl, tl, tl)
 DEF_HELPER_4(fmul_s, tl, env, tl, tl, tl)
 DEF_HELPER_4(fdiv_s, tl, env, tl, tl, tl)
-DEF_HELPER_3(fsgnj_s, tl, env, tl, tl)
-DEF_HELPER_3(fsgnjn_s, tl, env, tl, tl)
-DEF_HELPER_3(fsgnjx_s, tl, env, tl, tl)
 DEF_HELPER_3(fmin_s, tl, env, tl, tl)
 DEF_HELPER_3(fmax_s, tl, env, tl, tl)
 DEF_HELPER_3(fsqrt_s, tl, env, tl, tl)
@@ -38,16 +47,12 @@ DEF_HELPER_3(fcvt_s_w, tl, env, tl, tl)
 DEF_HELPER_3(fcvt_s_wu, tl, env, tl, tl)
 DEF_HELPER_3(fcvt_s_l, tl, env, tl, tl)
 DEF_HELPER_3(fcvt_s_lu, tl, env, tl, tl)
-DEF_HELPER_2(fclass_s, tl, env, tl)
 
 // Floating Point - Double Precision
 DEF_HELPER_4(fadd_d, tl, env, tl, tl, tl)
 DEF_HELPER_4(fsub_d, tl, env, tl, tl, tl)
 DEF_HELPER_4(fmul_d, tl, env, tl, tl, tl)
 DEF_HELPER_4(fdiv_d, tl, env, tl, tl, tl)
-DEF_HELPER_3(fsgnj_d, tl, env, tl, tl)
-DEF_HELPER_3(fsgnjn_d, tl, env, tl, tl)
-DEF_HELPER_3(fsgnjx_d, tl, env, tl, tl)
 DEF_HELPER_3(fmin_d, tl, env, tl, tl)
 DEF_HELPER_3(fmax_d, tl, env, tl, tl)
 DEF_HELPER_3(fcvt_s_d, tl, env, tl, tl)
@@ -64,17 +69,16 @@ DEF_HELPER_3(fcvt_d_w, tl, env, tl, tl)
 DEF_HELPER_3(fcvt_d_wu, tl, env, tl, tl)
 DEF_HELPER_3(fcvt_d_l, tl, env, tl, tl)
 DEF_HELPER_3(fcvt_d_lu, tl, env, tl, tl)
-DEF_HELPER_2(fclass_d, tl, env, tl)
 
 /* Special functions */
-#ifndef CONFIG_USER_ONLY
 DEF_HELPER_3(csrrw, tl, env, tl, tl)
 DEF_HELPER_3(csrrs, tl, env, tl, tl)
 DEF_HELPER_3(csrrc, tl, env, tl, tl)
 DEF_HELPER_1(sret, tl, env)
 DEF_HELPER_2(scall, tl, env, tl)
 DEF_HELPER_1(tlb_flush, void, env)
-#endif /* !CONFIG_USER_ONLY */
-//DEF_HELPER_1(wait, void, env)
+DEF_HELPER_2(htif_read, tl, env, tl)
+DEF_HELPER_3(htif_write, void, env, tl, tl)
+DEF_HELPER_1(wfi, noreturn, env)
 
 #include "exec/def-helper.h"
@@ -23,67 +23,34 @@
 
 #include "cpu.h"
 
-static void save_tc(QEMUFile *f, TCState *tc)
+/* The TLB, the page walk cache and the ASID slot assignment are caches of
+ * state that is saved; start them afresh. */
+static int riscv_cpu_post_load(void *opaque, int version_id)
 {
-    int i;
-    /* Save active TC */
-    for (i = 0; i < 32; i++) {
-        qemu_put_betls(f, &tc->gpr[i]);
-    }
-    for (i = 0; i < 32; i++) {
-        qemu_put_betls(f, &tc->fpr[i]);
-    }
-    qemu_put_betls(f, &tc->PC);
-}
-
-void cpu_save(QEMUFile *f, void *opaque)
-{
-    CPURISCVState *env = opaque;
-    int i;
-
-    /* Save active TC */
-    save_tc(f, &env->active_tc);
-
-    /* Save CPU metastate */
-    qemu_put_be32s(f, &env->current_tc);
-
-    for (i = 0; i < 32; i++) {
-        qemu_put_betls(f, &env->helper_csr[i]);
-    }
-}
-
-static void load_tc(QEMUFile *f, TCState *tc)
-{
-    int i;
-    /* Save active TC */
-    for(i = 0; i < 32; i++) {
-        qemu_get_betls(f, &tc->gpr[i]);
-    }
-    for(i = 0; i < 32; i++) {
-        qemu_get_betls(f, &tc->fpr[i]);
-    }
-    qemu_get_betls(f, &tc->PC);
-}
-
-int cpu_load(QEMUFile *f, void *opaque, int version_id)
-{
-    CPURISCVState *env = opaque;
-    RISCVCPU *cpu = riscv_env_get_cpu(env);
-    int i;
-
-    if (version_id != 3)
-        return -EINVAL;
-
-    /* Load active TC */
-    load_tc(f, &env->active_tc);
-
-    /* Load CPU metastate */
-    qemu_get_be32s(f, &env->current_tc);
-
-    for (i = 0; i < 32; i++) {
-        qemu_get_betls(f, &env->helper_csr[i]);
-    }
+    RISCVCPU *cpu = opaque;
 
+    riscv_asid_slots_reset(&cpu->env);
+    riscv_pwc_flush(&cpu->env);
     tlb_flush(CPU(cpu), 1);
     return 0;
 }
+
+/* The timer lives in hw/riscv/cputimer.c, which saves it separately */
+const VMStateDescription vmstate_riscv_cpu = {
+    .name = "cpu",
+    .version_id = 4,
+    .minimum_version_id = 4,
+    .minimum_version_id_old = 4,
+    .post_load = riscv_cpu_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINTTL_ARRAY(env.active_tc.gpr, RISCVCPU, 32),
+        VMSTATE_UINTTL_ARRAY(env.active_tc.fpr, RISCVCPU, 32),
+        VMSTATE_UINTTL(env.active_tc.PC, RISCVCPU),
+        VMSTATE_UINT32(env.current_tc, RISCVCPU),
+        VMSTATE_UINT64_ARRAY(env.helper_csr, RISCVCPU, 32),
+        VMSTATE_UINTTL(env.load_res, RISCVCPU),
+        VMSTATE_UINTTL(env.load_val, RISCVCPU),
+        VMSTATE_UINT64(env.instret, RISCVCPU),
+        VMSTATE_END_OF_LIST()
+    }
+};
@@ -18,13 +18,20 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 #include <stdlib.h>
+#include <math.h>
+#include <float.h>
 #include "cpu.h"
 #include "qemu/host-utils.h"
+#include "trace.h"
 
 #include "helper.h"
+#include "tcg.h"
 
 #if !defined(CONFIG_USER_ONLY)
 #include "exec/softmmu_exec.h"
+#include "exec/cputlb.h"
+#else
+#include "qemu/timer.h"
 #endif /* !defined(CONFIG_USER_ONLY) */
 
 // custom floating point includes. use this instead of qemu's included 
@@ -33,12 +40,10 @@
 #include "fpu-custom-riscv/platform.h"
 #include "fpu-custom-riscv/internals.h"
 
-#ifndef CONFIG_USER_ONLY
 static inline void cpu_riscv_tlb_flush (CPURISCVState *env, int flush_global);
 void csr_write_helper(CPURISCVState *env, target_ulong val_to_write, target_ulong csrno);
 target_ulong csr_read_helper(CPURISCVState *env, target_ulong csrno);
 
-#endif
 
 #define RISCV_RM ({ if(rm == 7) rm = env->helper_csr[CSR_FRM]; \
                     /* TODO: throw trap for rm > 4 */ \
@@ -47,13 +52,117 @@ target_ulong csr_read_helper(CPURISCVState *env, target_ulong csrno);
 #define set_fp_exceptions ({ env->helper_csr[CSR_FFLAGS] |= softfloat_exceptionFlags;\
                              softfloat_exceptionFlags = 0; })
 
+#if defined(CONFIG_RISCV_HOSTFP) && FLT_EVAL_METHOD == 0
+/* Host FPU fast path (configure --enable-riscv-hostfp)
+ *
+ * The host computes the result when that is guaranteed to match softfloat
+ * bit for bit and leave fflags unchanged:
+ *  - the rounding mode is RNE, the host default;
+ *  - fflags already has NX set, so there is no need to find out whether
+ *    this particular result was rounded;
+ *  - all inputs are normal numbers or zero, so no NaN handling is needed;
+ *  - the result is a normal number above the smallest binade, so it
+ *    neither overflowed nor underflowed.
+ * Anything else is recomputed with softfloat, which also sets the flags.
+ * Fused multiply-add is only done on the host if it has a fast fma. */
+#define RISCV_HOSTFP
+
+static inline bool hostfp_enabled(CPURISCVState *env, uint64_t rm)
+{
+    return rm == softfloat_round_nearest_even &&
+           (env->helper_csr[CSR_FFLAGS] & softfloat_flag_inexact);
+}
+
+static inline bool hostfp_in_s(uint32_t a)
+{
+    uint32_t exp = (a >> 23) & 0xFF;
+    return (exp != 0 && exp != 0xFF) || (a & INT32_MAX) == 0;
+}
+
+static inline bool hostfp_out_s(uint32_t a)
+{
+    uint32_t exp = (a >> 23) & 0xFF;
+    // skip the lowest binade too: it may have been tiny before rounding
+    return exp > 1 && exp != 0xFF;
+}
+
+static inline bool hostfp_in_d(uint64_t a)
+{
+    uint64_t exp = (a >> 52) & 0x7FF;
+    return (exp != 0 && exp != 0x7FF) || (a & INT64_MAX) == 0;
+}
+
+static inline bool hostfp_out_d(uint64_t a)
+{
+    uint64_t exp = (a >> 52) & 0x7FF;
+    return exp > 1 && exp != 0x7FF;
+}
+
+static inline float hostfp_s(uint32_t a)
+{
+    union { uint32_t u; float f; } x = { .u = a };
+    return x.f;
+}
+
+static inline uint32_t hostfp_from_s(float f)
+{
+    union { uint32_t u; float f; } x = { .f = f };
+    return x.u;
+}
+
+static inline double hostfp_d(uint64_t a)
+{
+    union { uint64_t u; double d; } x = { .u = a };
+    return x.d;
+}
+
+static inline uint64_t hostfp_from_d(double d)
+{
+    union { uint64_t u; double d; } x = { .d = d };
+    return x.u;
+}
+
+// return from the helper if the host result for expr can be used
+#define HOSTFP_S(inputs_ok, expr)                                       \
+    if (hostfp_enabled(env, rm) && (inputs_ok)) {                       \
+        uint32_t r_ = hostfp_from_s(expr);                              \
+        if (hostfp_out_s(r_)) {                                         \
+            return r_;                                                  \
+        }                                                               \
+    }
+#define HOSTFP_D(inputs_ok, expr)                                       \
+    if (hostfp_enabled(env, rm) && (inputs_ok)) {                       \
+        uint64_t r_ = hostfp_from_d(expr);                              \
+        if (hostfp_out_d(r_)) {                                         \
+            return r_;                                                  \
+        }                                                               \
+    }
+#ifdef FP_FAST_FMAF
+#define HOSTFP_FMA_S HOSTFP_S
+#endif
+#ifdef FP_FAST_FMA
+#define HOSTFP_FMA_D HOSTFP_D
+#endif
+#endif /* CONFIG_RISCV_HOSTFP */
+
+#ifndef RISCV_HOSTFP
+#define HOSTFP_S(inputs_ok, expr)
+#define HOSTFP_D(inputs_ok, expr)
+#endif
+#ifndef HOSTFP_FMA_S
+#define HOSTFP_FMA_S(inputs_ok, expr)
+#endif
+#ifndef HOSTFP_FMA_D
+#define HOSTFP_FMA_D(inputs_ok, expr)
+#endif
+
 /* Exceptions processing helpers */
 static inline void QEMU_NORETURN do_raise_exception_err(CPURISCVState *env,
                                                         uint32_t exception,
                                                         uintptr_t pc)
 {
     CPUState *cs = CPU(riscv_env_get_cpu(env));
-    qemu_log("%s: %d\n", __func__, exception);
+    trace_riscv_raise_exception(exception, pc);
     cs->exception_index = exception;
     if (pc) {
         /* now we have a real cpu fault */
@@ -67,10 +176,116 @@ void helper_raise_exception(CPURISCVState *env, uint32_t exception)
     do_raise_exception_err(env, exception, 0);
 }
 
+/* The jump cache missed: look addr up by physical address, as tb_find_slow
+ * does. Only done when the code TLB already maps addr, so that the lookup
+ * cannot fault; a TB found this way matches the current mapping. */
+static TranslationBlock *lookup_tb_phys(CPURISCVState *env, target_ulong addr,
+                                        target_ulong cs_base, int flags)
+{
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc;
+#ifdef CONFIG_USER_ONLY
+    phys_pc = addr;
+#else
+    int mmu_idx = cpu_mmu_index(env);
+    int index = tlb_index(env, mmu_idx, addr);
+    CPUTLBEntry *entry = &env->tlb_table[mmu_idx][index];
+    ram_addr_t ram_addr;
+
+    // I/O and not-present pages have flag bits set and never compare equal
+    if (entry->addr_code != (addr & TARGET_PAGE_MASK) ||
+        !qemu_ram_addr_from_host((void *)((uintptr_t)addr + entry->addend),
+                                 &ram_addr)) {
+        return NULL;
+    }
+    phys_pc = ram_addr;
+#endif
+    // other threads translate in user mode
+    spin_lock(&tcg_ctx.tb_ctx.tb_lock);
+    for (tb = tcg_ctx.tb_ctx.tb_phys_hash[tb_phys_hash_func(phys_pc)]; tb;
+         tb = tb->phys_hash_next) {
+        if (tb->pc == addr && tb->page_addr[0] == (phys_pc & TARGET_PAGE_MASK)
+            && tb->page_addr[1] == -1 && tb->cs_base == cs_base &&
+            tb->flags == flags) {
+            env->tb_lookup_phys++;
+            break;
+        }
+    }
+    spin_unlock(&tcg_ctx.tb_ctx.tb_lock);
+    return tb;
+}
+
+/* Find the TB for addr so that JALR/SRET, and direct jumps to another page,
+ * can jump straight to it without leaving generated code. On a miss, or
+ * when an interrupt must be taken first, return the epilogue and let
+ * cpu_exec do the full lookup. */
+static inline void *lookup_tb_ptr(CPURISCVState *env, target_ulong addr,
+                                  uint64_t *hit, uint64_t *miss)
+{
+    CPUState *cs = CPU(riscv_env_get_cpu(env));
+    TranslationBlock *tb;
+    target_ulong pc, cs_base;
+    int flags;
+
+    if (unlikely((cs->interrupt_request & ~CPU_INTERRUPT_HARD) ||
+                 ((cs->interrupt_request & CPU_INTERRUPT_HARD) &&
+                  cpu_riscv_hw_interrupts_pending(env)))) {
+        (*miss)++;
+        env->tb_exit[RISCV_TB_EXIT_IRQ]++;
+        return tcg_ctx.code_gen_epilogue;
+    }
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = cs->tb_jmp_cache[tb_jmp_cache_hash_func(addr)];
+    if (unlikely(!tb || tb->pc != addr || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        tb = lookup_tb_phys(env, addr, cs_base, flags);
+        if (!tb) {
+            (*miss)++;
+            env->tb_exit[RISCV_TB_EXIT_LOOKUP_MISS]++;
+            return tcg_ctx.code_gen_epilogue;
+        }
+        cs->tb_jmp_cache[tb_jmp_cache_hash_func(addr)] = tb;
+    }
+    (*hit)++;
+    tb_mark_used(&tcg_ctx.tb_ctx, tb);
+    return tb->tc_ptr;
+}
+
+void *helper_lookup_tb_ptr(CPURISCVState *env, target_ulong addr)
+{
+    return lookup_tb_ptr(env, addr, &env->tb_lookup_hit, &env->tb_lookup_miss);
+}
+
+void *helper_lookup_tb_ptr_direct(CPURISCVState *env, target_ulong addr)
+{
+    return lookup_tb_ptr(env, addr, &env->xpage_hit, &env->xpage_miss);
+}
+
+#ifdef RISCV_RAS_STATS
+/* jalr x0, ra: pop the return address stack and check the prediction */
+void *helper_lookup_tb_ptr_ret(CPURISCVState *env, target_ulong addr)
+{
+    uint32_t top = env->ras_top;
+
+    if (env->ras[top] == addr) {
+        env->ras_hit++;
+    } else {
+        env->ras_miss++;
+    }
+    env->ras[top] = 0;
+    env->ras_top = (top - 1) & (RISCV_RAS_SIZE - 1);
+
+    return lookup_tb_ptr(env, addr, &env->tb_lookup_hit, &env->tb_lookup_miss);
+}
+#endif
+
 /* floating point */
 uint64_t helper_fmadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t frs3, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_FMA_S(hostfp_in_s(frs1) && hostfp_in_s(frs2) && hostfp_in_s(frs3),
+                 fmaf(hostfp_s(frs1), hostfp_s(frs2), hostfp_s(frs3)));
     frs1 = f32_mulAdd(frs1, frs2, frs3);
     set_fp_exceptions;
     return frs1;
@@ -79,6 +294,8 @@ uint64_t helper_fmadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64
 uint64_t helper_fmadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t frs3, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_FMA_D(hostfp_in_d(frs1) && hostfp_in_d(frs2) && hostfp_in_d(frs3),
+                 fma(hostfp_d(frs1), hostfp_d(frs2), hostfp_d(frs3)));
     frs1 = f64_mulAdd(frs1, frs2, frs3);
     set_fp_exceptions;
     return frs1;
@@ -87,6 +304,8 @@ uint64_t helper_fmadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64
 uint64_t helper_fmsub_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t frs3, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_FMA_S(hostfp_in_s(frs1) && hostfp_in_s(frs2) && hostfp_in_s(frs3),
+                 fmaf(hostfp_s(frs1), hostfp_s(frs2), -hostfp_s(frs3)));
     frs1 = f32_mulAdd(frs1, frs2, frs3 ^ (uint32_t)INT32_MIN);
     set_fp_exceptions;
     return frs1;
@@ -95,6 +314,8 @@ uint64_t helper_fmsub_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64
 uint64_t helper_fmsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t frs3, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_FMA_D(hostfp_in_d(frs1) && hostfp_in_d(frs2) && hostfp_in_d(frs3),
+                 fma(hostfp_d(frs1), hostfp_d(frs2), -hostfp_d(frs3)));
     frs1 = f64_mulAdd(frs1, frs2, frs3 ^ (uint64_t)INT64_MIN);
     set_fp_exceptions;
     return frs1;
@@ -103,6 +324,8 @@ uint64_t helper_fmsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64
 uint64_t helper_fnmsub_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t frs3, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_FMA_S(hostfp_in_s(frs1) && hostfp_in_s(frs2) && hostfp_in_s(frs3),
+                 fmaf(-hostfp_s(frs1), hostfp_s(frs2), hostfp_s(frs3)));
     frs1 = f32_mulAdd(frs1 ^ (uint32_t)INT32_MIN, frs2, frs3);
     set_fp_exceptions;
     return frs1;
@@ -111,6 +334,8 @@ uint64_t helper_fnmsub_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint6
 uint64_t helper_fnmsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t frs3, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_FMA_D(hostfp_in_d(frs1) && hostfp_in_d(frs2) && hostfp_in_d(frs3),
+                 fma(-hostfp_d(frs1), hostfp_d(frs2), hostfp_d(frs3)));
     frs1 = f64_mulAdd(frs1 ^ (uint64_t)INT64_MIN, frs2, frs3);
     set_fp_exceptions;
     return frs1;
@@ -119,6 +344,8 @@ uint64_t helper_fnmsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint6
 uint64_t helper_fnmadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t frs3, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_FMA_S(hostfp_in_s(frs1) && hostfp_in_s(frs2) && hostfp_in_s(frs3),
+                 fmaf(-hostfp_s(frs1), hostfp_s(frs2), -hostfp_s(frs3)));
     frs1 = f32_mulAdd(frs1 ^ (uint32_t)INT32_MIN, frs2, frs3 ^ (uint32_t)INT32_MIN);
     set_fp_exceptions;
     return frs1;
@@ -127,6 +354,8 @@ uint64_t helper_fnmadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint6
 uint64_t helper_fnmadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t frs3, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_FMA_D(hostfp_in_d(frs1) && hostfp_in_d(frs2) && hostfp_in_d(frs3),
+                 fma(-hostfp_d(frs1), hostfp_d(frs2), -hostfp_d(frs3)));
     frs1 = f64_mulAdd(frs1 ^ (uint64_t)INT64_MIN, frs2, frs3 ^ (uint64_t)INT64_MIN);
     set_fp_exceptions;
     return frs1;
@@ -135,6 +364,8 @@ uint64_t helper_fnmadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint6
 uint64_t helper_fadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_S(hostfp_in_s(frs1) && hostfp_in_s(frs2),
+             hostfp_s(frs1) + hostfp_s(frs2));
     frs1 = f32_mulAdd(frs1, 0x3f800000, frs2);
     set_fp_exceptions;
     return frs1;
@@ -143,6 +374,8 @@ uint64_t helper_fadd_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_
 uint64_t helper_fsub_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_S(hostfp_in_s(frs1) && hostfp_in_s(frs2),
+             hostfp_s(frs1) - hostfp_s(frs2));
     frs1 = f32_mulAdd(frs1, 0x3f800000, frs2 ^ (uint32_t)INT32_MIN);
     set_fp_exceptions;
     return frs1;
@@ -151,6 +384,8 @@ uint64_t helper_fsub_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_
 uint64_t helper_fmul_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_S(hostfp_in_s(frs1) && hostfp_in_s(frs2),
+             hostfp_s(frs1) * hostfp_s(frs2));
     frs1 = f32_mulAdd(frs1, frs2, (frs1 ^ frs2) & (uint32_t)INT32_MIN);
     set_fp_exceptions;
     return frs1;
@@ -159,29 +394,13 @@ uint64_t helper_fmul_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_
 uint64_t helper_fdiv_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_S(hostfp_in_s(frs1) && hostfp_in_s(frs2),
+             hostfp_s(frs1) / hostfp_s(frs2));
     frs1 = f32_div(frs1, frs2);
     set_fp_exceptions;
     return frs1;
 }
 
-uint64_t helper_fsgnj_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
-{
-    frs1 = (frs1 &~ (uint32_t)INT32_MIN) | (frs2 & (uint32_t)INT32_MIN);
-    return frs1;
-}
-
-uint64_t helper_fsgnjn_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
-{
-    frs1 = (frs1 &~ (uint32_t)INT32_MIN) | ((~frs2) & (uint32_t)INT32_MIN);
-    return frs1;
-}
-
-uint64_t helper_fsgnjx_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
-{
-    frs1 = frs1 ^ (frs2 & (uint32_t)INT32_MIN);
-    return frs1;
-}
-
 uint64_t helper_fmin_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
 {
     frs1 = isNaNF32UI(frs2) || f32_lt_quiet(frs1, frs2) ? frs1 : frs2;
@@ -199,6 +418,8 @@ uint64_t helper_fmax_s(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
 uint64_t helper_fsqrt_s(CPURISCVState *env, uint64_t frs1, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_S(hostfp_in_s(frs1) && !(frs1 & (uint32_t)INT32_MIN),
+             sqrtf(hostfp_s(frs1)));
     frs1 = f32_sqrt(frs1);
     set_fp_exceptions;
     return frs1;
@@ -289,15 +510,11 @@ uint64_t helper_fcvt_s_lu(CPURISCVState *env, uint64_t rs1, uint64_t rm)
     return rs1;
 }
 
-uint64_t helper_fclass_s(CPURISCVState *env, uint64_t frs1)
-{
-    frs1 = f32_classify(frs1);
-    return frs1;
-}
-
 uint64_t helper_fadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_D(hostfp_in_d(frs1) && hostfp_in_d(frs2),
+             hostfp_d(frs1) + hostfp_d(frs2));
     frs1 = f64_mulAdd(frs1, 0x3ff0000000000000ULL, frs2);
     set_fp_exceptions;
     return frs1;
@@ -306,6 +523,8 @@ uint64_t helper_fadd_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_
 uint64_t helper_fsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_D(hostfp_in_d(frs1) && hostfp_in_d(frs2),
+             hostfp_d(frs1) - hostfp_d(frs2));
     frs1 = f64_mulAdd(frs1, 0x3ff0000000000000ULL, frs2 ^ (uint64_t)INT64_MIN);
     set_fp_exceptions;
     return frs1;
@@ -314,6 +533,8 @@ uint64_t helper_fsub_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_
 uint64_t helper_fmul_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_D(hostfp_in_d(frs1) && hostfp_in_d(frs2),
+             hostfp_d(frs1) * hostfp_d(frs2));
     frs1 = f64_mulAdd(frs1, frs2, (frs1 ^ frs2) & (uint64_t)INT64_MIN);
     set_fp_exceptions;
     return frs1;
@@ -322,29 +543,13 @@ uint64_t helper_fmul_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_
 uint64_t helper_fdiv_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_D(hostfp_in_d(frs1) && hostfp_in_d(frs2),
+             hostfp_d(frs1) / hostfp_d(frs2));
     frs1 = f64_div(frs1, frs2);
     set_fp_exceptions;
     return frs1;
 }
 
-uint64_t helper_fsgnj_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
-{
-    frs1 = (frs1 &~ INT64_MIN) | (frs2 & INT64_MIN);
-    return frs1;
-}
-
-uint64_t helper_fsgnjn_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
-{
-    frs1 = (frs1 &~ INT64_MIN) | ((~frs2) & INT64_MIN);
-    return frs1;
-}
-
-uint64_t helper_fsgnjx_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
-{
-    frs1 = frs1 ^ (frs2 & INT64_MIN);
-    return frs1;
-}
-
 uint64_t helper_fmin_d(CPURISCVState *env, uint64_t frs1, uint64_t frs2)
 {
     frs1 = isNaNF64UI(frs2) || f64_lt_quiet(frs1, frs2) ? frs1 : frs2;
@@ -378,6 +583,8 @@ uint64_t helper_fcvt_d_s(CPURISCVState *env, uint64_t rs1, uint64_t rm)
 uint64_t helper_fsqrt_d(CPURISCVState *env, uint64_t frs1, uint64_t rm)
 {
     softfloat_roundingMode = RISCV_RM;
+    HOSTFP_D(hostfp_in_d(frs1) && !(frs1 & (uint64_t)INT64_MIN),
+             sqrt(hostfp_d(frs1)));
     frs1 = f64_sqrt(frs1);
     set_fp_exceptions;
     return frs1;
@@ -468,12 +675,6 @@ uint64_t helper_fcvt_d_lu(CPURISCVState *env, uint64_t frs1, uint64_t rm)
     return frs1;
 }
 
-uint64_t helper_fclass_d(CPURISCVState *env, uint64_t frs1)
-{
-    frs1 = f64_classify(frs1);
-    return frs1;
-}
-
 target_ulong helper_mulhsu(CPURISCVState *env, target_ulong arg1,
                           target_ulong arg2)
 {
@@ -482,6 +683,262 @@ target_ulong helper_mulhsu(CPURISCVState *env, target_ulong arg1,
     return (int64_t)((__int128_t)a*b >> 64);
 }
 
+/* Atomic memory operations
+ *
+ * LR/SC and the AMOs operate directly on host memory with host atomic
+ * instructions whenever the target is ordinary RAM, so they are atomic
+ * with respect to other harts and to device DMA. I/O and not-dirty pages
+ * (pages holding translated code) take the regular softmmu slow path.
+ */
+
+// AMO function codes, instruction bits 31:27
+enum {
+    RISCV_AMO_ADD  = 0x00,
+    RISCV_AMO_SWAP = 0x01,
+    RISCV_AMO_XOR  = 0x04,
+    RISCV_AMO_OR   = 0x08,
+    RISCV_AMO_AND  = 0x0C,
+    RISCV_AMO_MIN  = 0x10,
+    RISCV_AMO_MAX  = 0x14,
+    RISCV_AMO_MINU = 0x18,
+    RISCV_AMO_MAXU = 0x1C,
+};
+
+/* 32 bit operands are passed sign extended, which preserves both the
+ * signed and the unsigned ordering, so one implementation covers .W and .D */
+static inline int64_t amo_alu(uint32_t op, int64_t a, int64_t b)
+{
+    switch (op) {
+    case RISCV_AMO_ADD:
+        return a + b;
+    case RISCV_AMO_SWAP:
+        return b;
+    case RISCV_AMO_XOR:
+        return a ^ b;
+    case RISCV_AMO_OR:
+        return a | b;
+    case RISCV_AMO_AND:
+        return a & b;
+    case RISCV_AMO_MIN:
+        return a < b ? a : b;
+    case RISCV_AMO_MAX:
+        return a > b ? a : b;
+    case RISCV_AMO_MINU:
+        return (uint64_t)a < (uint64_t)b ? a : b;
+    case RISCV_AMO_MAXU:
+        return (uint64_t)a > (uint64_t)b ? a : b;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+#define GEN_AMO_ATOMIC(name, type)                                      \
+static type name(uint32_t op, type *p, type src)                        \
+{                                                                       \
+    type old;                                                           \
+                                                                        \
+    switch (op) {                                                       \
+    case RISCV_AMO_ADD:                                                 \
+        return atomic_fetch_add(p, src);                                \
+    case RISCV_AMO_SWAP:                                                \
+        return atomic_xchg(p, src);                                     \
+    case RISCV_AMO_XOR:                                                 \
+        return __sync_fetch_and_xor(p, src);                            \
+    case RISCV_AMO_OR:                                                  \
+        return atomic_fetch_or(p, src);                                 \
+    case RISCV_AMO_AND:                                                 \
+        return atomic_fetch_and(p, src);                                \
+    default:                                                            \
+        /* min/max have no host instruction, use a cmpxchg loop */      \
+        do {                                                            \
+            old = atomic_read(p);                                       \
+        } while (atomic_cmpxchg(p, old, (type)amo_alu(op, old, src))    \
+                 != old);                                               \
+        return old;                                                     \
+    }                                                                   \
+}
+
+GEN_AMO_ATOMIC(amo_atomic_w, int32_t)
+GEN_AMO_ATOMIC(amo_atomic_d, int64_t)
+
+/* Return a host pointer for an aligned read-modify-write of size bytes at
+ * addr, or NULL if the slow path has to be used. Takes the same faults a
+ * store would. */
+static void *amo_host_addr(CPURISCVState *env, target_ulong addr,
+                           uint32_t size, uintptr_t retaddr)
+{
+    if (unlikely(addr & (size - 1))) {
+        env->helper_csr[CSR_BADVADDR] = addr;
+        do_raise_exception_err(env, RISCV_EXCP_STORE_ADDR_MIS, retaddr);
+    }
+#if defined(HOST_WORDS_BIGENDIAN)
+    // guest memory is little endian, host atomics would see it swapped
+    return NULL;
+#elif defined(CONFIG_USER_ONLY)
+    return g2h(addr);
+#else
+    {
+        int mmu_idx = cpu_mmu_index(env);
+        int index = tlb_index(env, mmu_idx, addr);
+        target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
+
+        if ((addr & TARGET_PAGE_MASK)
+            != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+            if (!tlb_victim_hit(env, mmu_idx, index,
+                                offsetof(CPUTLBEntry, addr_write),
+                                addr & TARGET_PAGE_MASK)) {
+                tlb_fill(CPU(riscv_env_get_cpu(env)), addr, 1, mmu_idx,
+                         retaddr);
+            }
+            tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
+        }
+        if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
+            // I/O or not-dirty page
+            return NULL;
+        }
+        return (void *)((uintptr_t)addr
+                        + env->tlb_table[mmu_idx][index].addend);
+    }
+#endif
+}
+
+/* Slow path accessors, used when amo_host_addr() returns NULL. Unlike the
+ * host atomics above, a load/store pair issued from within one helper is
+ * only atomic with respect to the other harts because TCG runs all harts
+ * from a single thread. Per-hart host threads would have to change this. */
+static int64_t amo_load(CPURISCVState *env, target_ulong addr,
+                        uint32_t size, uintptr_t retaddr)
+{
+#ifdef CONFIG_USER_ONLY
+    return size == 4 ? (int32_t)cpu_ldl_data(env, addr)
+                     : (int64_t)cpu_ldq_data(env, addr);
+#else
+    int mmu_idx = cpu_mmu_index(env);
+    return size == 4 ? (int32_t)helper_le_ldul_mmu(env, addr, mmu_idx, retaddr)
+                     : (int64_t)helper_le_ldq_mmu(env, addr, mmu_idx, retaddr);
+#endif
+}
+
+static void amo_store(CPURISCVState *env, target_ulong addr, int64_t val,
+                      uint32_t size, uintptr_t retaddr)
+{
+#ifdef CONFIG_USER_ONLY
+    if (size == 4) {
+        cpu_stl_data(env, addr, val);
+    } else {
+        cpu_stq_data(env, addr, val);
+    }
+#else
+    int mmu_idx = cpu_mmu_index(env);
+    if (size == 4) {
+        helper_le_stl_mmu(env, addr, val, mmu_idx, retaddr);
+    } else {
+        helper_le_stq_mmu(env, addr, val, mmu_idx, retaddr);
+    }
+#endif
+}
+
+target_ulong helper_lr(CPURISCVState *env, target_ulong addr, uint32_t size)
+{
+    uintptr_t retaddr = GETPC();
+    int64_t val;
+
+    if (unlikely(addr & (size - 1))) {
+        env->helper_csr[CSR_BADVADDR] = addr;
+        do_raise_exception_err(env, RISCV_EXCP_LOAD_ADDR_MIS, retaddr);
+    }
+    val = amo_load(env, addr, size, retaddr);
+    env->load_res = addr;
+    env->load_val = val;
+    return val;
+}
+
+/* SC succeeds if the reservation is still held and memory still holds the
+ * value the LR saw. Returns 0 on success, 1 on failure.
+ *
+ * In system mode every hart runs from the one TCG thread, and cpu_exec()
+ * drops the reservation whenever it is entered, so a reservation that is
+ * still held means no other hart stored anywhere since the LR.
+ *
+ * Known limitations: the reservation is only checked by value wherever
+ * stores come from another host thread, so a store of A, B and then A
+ * again between the LR and the SC (ABA) goes unnoticed and the SC
+ * succeeds. In user mode that is any other guest thread. In system mode
+ * it is device DMA: block devices using zero-copy AIO write guest RAM from
+ * worker threads while the hart runs, and nothing drops the reservation
+ * for those writes. Guests that hand a buffer to a device should not
+ * hold an LR reservation on it. */
+target_ulong helper_sc(CPURISCVState *env, target_ulong addr,
+                       target_ulong src, uint32_t size)
+{
+    uintptr_t retaddr = GETPC();
+    void *haddr = amo_host_addr(env, addr, size, retaddr);
+    target_ulong res = env->load_res;
+    int64_t expected = env->load_val;
+
+    env->load_res = -1;
+    if (res != addr) {
+        return 1;
+    }
+    if (likely(haddr != NULL)) {
+        if (size == 4) {
+            return atomic_cmpxchg((int32_t *)haddr, (int32_t)expected,
+                                  (int32_t)src) != (int32_t)expected;
+        }
+        return atomic_cmpxchg((int64_t *)haddr, expected,
+                              (int64_t)src) != expected;
+    }
+    if (amo_load(env, addr, size, retaddr) != expected) {
+        return 1;
+    }
+    amo_store(env, addr, src, size, retaddr);
+    return 0;
+}
+
+target_ulong helper_amo(CPURISCVState *env, uint32_t op, target_ulong addr,
+                        target_ulong src, uint32_t size)
+{
+    uintptr_t retaddr = GETPC();
+    void *haddr = amo_host_addr(env, addr, size, retaddr);
+    int64_t old;
+
+    if (likely(haddr != NULL)) {
+        if (size == 4) {
+            return (int32_t)amo_atomic_w(op, haddr, src);
+        }
+        return amo_atomic_d(op, haddr, src);
+    }
+    old = amo_load(env, addr, size, retaddr);
+    amo_store(env, addr, amo_alu(op, old, size == 4 ? (int32_t)src : src),
+              size, retaddr);
+    return old;
+}
+
+/* Switch to the TLB slot for asid, recycling the oldest slot if it has
+ * none. Only a recycled slot is flushed; the other slots keep their
+ * entries, tagged by their MMU mode. */
+static void riscv_set_asid(CPURISCVState *env, target_ulong asid)
+{
+    CPUState *cs = CPU(riscv_env_get_cpu(env));
+    int i;
+
+    env->helper_csr[CSR_ASID] = asid;
+    for (i = 0; i < RISCV_ASID_SLOTS; i++) {
+        if (env->asid_slot_tag[i] == asid) {
+            env->asid_slot = i;
+            env->asid_switch++;
+            return;
+        }
+    }
+
+    i = env->asid_victim;
+    env->asid_victim = (i + 1) % RISCV_ASID_SLOTS;
+    env->asid_slot_tag[i] = asid;
+    env->asid_slot = i;
+    env->asid_recycle++;
+    tlb_flush_by_mmuidx(cs, 3 << (i << 1));
+}
+
 inline void csr_write_helper(CPURISCVState *env, target_ulong val_to_write, target_ulong csrno)
 {
 
@@ -498,6 +955,22 @@ inline void csr_write_helper(CPURISCVState *env, target_ulong val_to_write, targ
         case CSR_CYCLE:
             // DO NOT WRITE TO CSR_CYCLE
             break;
+        case CSR_HARTID:
+            // read only
+            break;
+        case CSR_SEND_IPI:
+            cpu_riscv_send_ipi(env, val_to_write);
+            break;
+        case CSR_CLEAR_IPI:
+            cpu_riscv_clear_ipi(env, val_to_write & 0x1);
+            break;
+        case CSR_PTBR:
+            env->helper_csr[CSR_PTBR] = val_to_write;
+            riscv_pwc_flush(env);
+            break;
+        case CSR_ASID:
+            riscv_set_asid(env, val_to_write);
+            break;
         case CSR_FCSR:
             env->helper_csr[CSR_FFLAGS] = val_to_write & 0x1F;
             env->helper_csr[CSR_FRM] = (val_to_write >> 5) & 0x7;
@@ -515,6 +988,8 @@ inline target_ulong csr_read_helper(CPURISCVState *env, target_ulong csrno)
             return cpu_riscv_get_count(env);
             break;
         case CSR_CYCLE:
+        case CSR_TIME:
+        case CSR_INSTRET:
             return cpu_riscv_get_cycle(env);
             break;
         case CSR_FCSR:
@@ -583,10 +1058,10 @@ target_ulong helper_scall(CPURISCVState *env, target_ulong bad_pc)
     }
     env->helper_csr[CSR_STATUS] &= ~((uint64_t)SR_EI);
     env->helper_csr[CSR_EPC] = bad_pc;
+    env->load_res = -1;
     return env->helper_csr[CSR_EVEC];
 }
 
-#ifndef CONFIG_USER_ONLY
 /* TLB management */
 inline static void cpu_riscv_tlb_flush (CPURISCVState *env, int flush_global)
 {
@@ -594,6 +1069,7 @@ inline static void cpu_riscv_tlb_flush (CPURISCVState *env, int flush_global)
 
     /* Flush qemu's TLB and discard all shadowed entries.  */
     tlb_flush(CPU(cpu), flush_global);
+    riscv_pwc_flush(env);
 }
 
 
@@ -602,19 +1078,73 @@ void helper_tlb_flush(CPURISCVState *env)
     cpu_riscv_tlb_flush(env, 1);
 }
 
+/* tohost and fromhost live in the HTIF device. They are reached by
+ * physical address, whatever the MMU state; user mode has no HTIF. */
+target_ulong helper_htif_read(CPURISCVState *env, target_ulong addr)
+{
+#ifdef CONFIG_USER_ONLY
+    return 0;
+#else
+    return ldq_phys(CPU(riscv_env_get_cpu(env))->as, addr);
+#endif
+}
 
-#endif /* !CONFIG_USER_ONLY */
+void helper_htif_write(CPURISCVState *env, target_ulong addr,
+                       target_ulong val)
+{
+#ifndef CONFIG_USER_ONLY
+    stq_phys(CPU(riscv_env_get_cpu(env))->as, addr, val);
+#endif
+}
 
-// todo implement for RISC-V?
-/*void helper_wait(CPURISCVState *env)
+#ifdef CONFIG_USER_ONLY
+/* The timer and interrupt controller live in hw/riscv, which is not part of
+ * user mode. The counters read from the host clock and the remaining CSR
+ * side effects have nothing to act on. */
+uint64_t cpu_riscv_get_cycle (CPURISCVState *env)
+{
+    if (riscv_env_get_cpu(env)->icount_counters) {
+        return env->instret;
+    }
+    return cpu_get_real_ticks();
+}
+
+uint32_t cpu_riscv_get_count (CPURISCVState *env)
+{
+    return (uint32_t)cpu_get_real_ticks();
+}
+
+void cpu_riscv_store_count (CPURISCVState *env, uint32_t value)
+{
+}
+
+void cpu_riscv_store_compare (CPURISCVState *env, uint32_t value)
+{
+}
+
+void cpu_riscv_send_ipi(CPURISCVState *env, target_ulong hartid)
+{
+}
+
+void cpu_riscv_clear_ipi(CPURISCVState *env, int level)
+{
+}
+#endif /* CONFIG_USER_ONLY */
+
+/* Halt the hart until an interrupt arrives. The translator has already
+ * moved the PC past the WFI. cpu_exec resumes straight away if an
+ * interrupt is pending; otherwise the vCPU thread sleeps on its halt
+ * condition until cpu_riscv_irq_request kicks it, e.g. when the cputimer
+ * or a device raises a line. */
+void helper_wfi(CPURISCVState *env)
 {
     CPUState *cs = CPU(riscv_env_get_cpu(env));
 
+    env->wfi_halt++;
     cs->halted = 1;
-    cpu_reset_interrupt(cs, CPU_INTERRUPT_WAKE);
-    printf("NOT IMPLEMENTED FOR RISCV\n");
-    exit(1);
-}*/
+    cs->exception_index = EXCP_HLT;
+    cpu_loop_exit(cs);
+}
 
 #if !defined(CONFIG_USER_ONLY)
 
@@ -21,6 +21,7 @@
 #include "cpu.h"
 #include "disas/disas.h"
 #include "tcg-op.h"
+#include "qemu/timer.h"
 
 #include "helper.h"
 #define GEN_HELPER 1
@@ -367,11 +368,22 @@ static TCGv cpu_gpr[32], cpu_PC, cpu_fpr[32];
 typedef struct DisasContext {
     struct TranslationBlock *tb;
     target_ulong pc;
+    /* address of the following instruction, pc + 2 for RVC */
+    target_ulong next_pc;
     uint32_t opcode;
     int singlestep_enabled;
     /* Routine used to access memory */
     int mem_idx;
     int bstate;
+    /* per-instruction temps handed out by get_gpr/dest_gpr */
+    TCGv zero;
+    TCGv sink;
+    bool zero_live;
+    bool sink_live;
+    /* icount-counters: instructions of this TB up to and including the
+     * current one, added to env->instret on the way out */
+    bool count_insns;
+    int num_insns;
 } DisasContext;
 
 static inline void kill_unknown(DisasContext *ctx, int excp);
@@ -420,8 +432,25 @@ static const char * const fpr_regnames[] = {
         }                                                                     \
     } while (0)
 
+/* Retire n instructions of this TB into env->instret */
+static inline void gen_instret_add(DisasContext *ctx, int n)
+{
+    TCGv_i64 t0;
+
+    if (!ctx->count_insns || n == 0) {
+        return;
+    }
+    t0 = tcg_temp_new_i64();
+    tcg_gen_ld_i64(t0, cpu_env, offsetof(CPURISCVState, instret));
+    tcg_gen_addi_i64(t0, t0, n);
+    tcg_gen_st_i64(t0, cpu_env, offsetof(CPURISCVState, instret));
+    tcg_temp_free_i64(t0);
+}
+
 static inline void generate_exception (DisasContext *ctx, int excp)
 {
+    // the trapping instruction does not retire
+    gen_instret_add(ctx, ctx->num_insns - 1);
     tcg_gen_movi_tl(cpu_PC, ctx->pc);
     TCGv_i32 helper_tmp = tcg_const_i32(excp);
     gen_helper_raise_exception(cpu_env, helper_tmp);
@@ -434,24 +463,108 @@ static inline void kill_unknown(DisasContext *ctx, int excp) {
     ctx->bstate = BS_STOP;
 }
 
+/* Count a return to the main loop, see RISCV_TB_EXIT_* */
+static inline void gen_tb_exit_count(int reason)
+{
+    TCGv_i64 t0 = tcg_temp_new_i64();
+    int offset = offsetof(CPURISCVState, tb_exit[reason]);
+
+    tcg_gen_ld_i64(t0, cpu_env, offset);
+    tcg_gen_addi_i64(t0, t0, 1);
+    tcg_gen_st_i64(t0, cpu_env, offset);
+    tcg_temp_free_i64(t0);
+}
+
+enum {
+    LOOKUP_DIRECT,   // direct jump to another page
+    LOOKUP_INDIRECT, // jalr, sret, CSR writes
+    LOOKUP_RET,      // jalr x0, ra: count return address stack hits
+};
+
+/* Leave the TB for the address in cpu_PC. If the backend supports it, look
+ * the next TB up from generated code and jump straight to it instead of
+ * going back to cpu_exec. */
+static inline void gen_lookup_and_goto_ptr(DisasContext *ctx, int kind)
+{
+    if (TCG_TARGET_HAS_goto_ptr && !ctx->singlestep_enabled) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        switch (kind) {
+        case LOOKUP_DIRECT:
+            gen_helper_lookup_tb_ptr_direct(ptr, cpu_env, cpu_PC);
+            break;
+#ifdef RISCV_RAS_STATS
+        case LOOKUP_RET:
+            gen_helper_lookup_tb_ptr_ret(ptr, cpu_env, cpu_PC);
+            break;
+#endif
+        default:
+            gen_helper_lookup_tb_ptr(ptr, cpu_env, cpu_PC);
+            break;
+        }
+        tcg_gen_goto_ptr(ptr);
+        tcg_temp_free_ptr(ptr);
+    } else {
+        gen_tb_exit_count(RISCV_TB_EXIT_NOCHAIN);
+        tcg_gen_exit_tb(0);
+    }
+}
+
 static inline void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest)
 {
     TranslationBlock *tb;
     tb = ctx->tb;
+    gen_instret_add(ctx, ctx->num_insns);
     if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK)) {
-        // we only allow direct chaining when the jump is to the same page
-        // otherwise, we could produce incorrect chains when address spaces
-        // change. see
-        // http://lists.gnu.org/archive/html/qemu-devel/2007-06/msg00213.html
         tcg_gen_goto_tb(n);
         tcg_gen_movi_tl(cpu_PC, dest);
+        // only reached until cpu_exec patches the jump
+        gen_tb_exit_count(RISCV_TB_EXIT_UNCHAINED);
         tcg_gen_exit_tb((uintptr_t)tb + n);
     } else {
+        // A direct chain to another page could go stale when the mapping
+        // of that page changes, which does not invalidate this TB, see
+        // http://lists.gnu.org/archive/html/qemu-devel/2007-06/msg00213.html
+        // Look the destination up at run time instead; the helper only
+        // returns a TB that matches the current mapping.
         tcg_gen_movi_tl(cpu_PC, dest);
-        tcg_gen_exit_tb(0);
+        gen_lookup_and_goto_ptr(ctx, LOOKUP_DIRECT);
     }
 }
 
+/* Push the return address of a call onto the return address stack. A no-op
+ * unless RISCV_RAS_STATS is defined. */
+static inline void gen_ras_push(target_ulong ret_pc)
+{
+#ifdef RISCV_RAS_STATS
+    TCGv_i32 top = tcg_temp_new_i32();
+    TCGv_ptr slot = tcg_temp_new_ptr();
+    TCGv t0 = tcg_const_tl(ret_pc);
+
+    tcg_gen_ld_i32(top, cpu_env, offsetof(CPURISCVState, ras_top));
+    tcg_gen_addi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, RISCV_RAS_SIZE - 1);
+    tcg_gen_st_i32(top, cpu_env, offsetof(CPURISCVState, ras_top));
+    tcg_gen_muli_i32(top, top, sizeof(target_ulong));
+    tcg_gen_ext_i32_ptr(slot, top);
+    tcg_gen_add_ptr(slot, slot, cpu_env);
+    tcg_gen_st_tl(t0, slot, offsetof(CPURISCVState, ras));
+
+    tcg_temp_free_i32(top);
+    tcg_temp_free_ptr(slot);
+    tcg_temp_free(t0);
+#endif
+}
+
+/* Leave the TB after an indirect branch. cpu_PC must already hold the
+ * target. is_ret marks jalr x0, ra, for the return address stack
+ * statistics.
+ */
+static inline void gen_goto_indirect(DisasContext *ctx, bool is_ret)
+{
+    gen_instret_add(ctx, ctx->num_insns);
+    gen_lookup_and_goto_ptr(ctx, is_ret ? LOOKUP_RET : LOOKUP_INDIRECT);
+}
+
 /* Wrapper for getting reg values - need to check of reg is zero since 
  * cpu_gpr[0] is not actually allocated 
  */
@@ -476,508 +589,344 @@ static inline void gen_set_gpr (int reg_num_dst, TCGv t)
     }
 }
 
-inline static void gen_arith(DisasContext *ctx, uint32_t opc, 
-                      int rd, int rs1, int rs2)
+/* Source operand for reg. Non-zero registers are used straight from
+ * cpu_gpr[] without a copy; x0 reads share one zero constant that lives
+ * until the end of the instruction. The result must not be written. */
+static inline TCGv get_gpr(DisasContext *ctx, int reg)
 {
-    TCGv source1, source2;
+    if (reg != 0) {
+        return cpu_gpr[reg];
+    }
+    if (!ctx->zero_live) {
+        ctx->zero = tcg_const_tl(0);
+        ctx->zero_live = true;
+    }
+    return ctx->zero;
+}
 
-    source1 = tcg_temp_new();
-    source2 = tcg_temp_new();
+/* Destination for a result that has to be computed even when it goes to
+ * x0, for example a load that may fault. Writes to x0 land in a scratch
+ * temp that is dropped at the end of the instruction. */
+static inline TCGv dest_gpr(DisasContext *ctx, int reg)
+{
+    if (reg != 0) {
+        return cpu_gpr[reg];
+    }
+    if (!ctx->sink_live) {
+        ctx->sink = tcg_temp_new();
+        ctx->sink_live = true;
+    }
+    return ctx->sink;
+}
 
-    gen_get_gpr(source1, rs1);
-    gen_get_gpr(source2, rs2);
+/* Release the temps handed out by get_gpr/dest_gpr for this instruction */
+static inline void gen_free_operands(DisasContext *ctx)
+{
+    if (ctx->zero_live) {
+        tcg_temp_free(ctx->zero);
+        ctx->zero_live = false;
+    }
+    if (ctx->sink_live) {
+        tcg_temp_free(ctx->sink);
+        ctx->sink_live = false;
+    }
+}
+
+/* Division and remainder (funct3 4-7) without branches. A zero divisor,
+ * and MIN / -1 for the signed ops, would trap on the host, so those
+ * divide by 1 instead and the result is then patched the way the ISA
+ * defines it: x / 0 is all ones, x % 0 is x, MIN / -1 is MIN and
+ * MIN % -1 is 0 (both of which dividing by 1 already gives). */
+static void gen_div_rem(TCGv dest, TCGv source1, TCGv source2, int funct3)
+{
+    TCGv zero = tcg_const_tl(0);
+    TCGv one = tcg_const_tl(1);
+    TCGv divisor = tcg_temp_new();
+    TCGv result = tcg_temp_new();
+
+    if (funct3 == 4 || funct3 == 6) {
+        tcg_gen_setcondi_tl(TCG_COND_EQ, result, source1,
+                            (target_ulong)1 << (TARGET_LONG_BITS - 1));
+        tcg_gen_setcondi_tl(TCG_COND_EQ, divisor, source2, -1);
+        tcg_gen_and_tl(result, result, divisor);
+        tcg_gen_movcond_tl(TCG_COND_NE, divisor, result, zero, one, source2);
+        tcg_gen_movcond_tl(TCG_COND_EQ, divisor, source2, zero, one, divisor);
+    } else {
+        tcg_gen_movcond_tl(TCG_COND_EQ, divisor, source2, zero, one, source2);
+    }
+
+    switch (funct3) {
+    case 4:
+        tcg_gen_div_tl(result, source1, divisor);
+        tcg_gen_movi_tl(one, -1);
+        tcg_gen_movcond_tl(TCG_COND_EQ, dest, source2, zero, one, result);
+        break;
+    case 5:
+        tcg_gen_divu_tl(result, source1, divisor);
+        tcg_gen_movi_tl(one, -1);
+        tcg_gen_movcond_tl(TCG_COND_EQ, dest, source2, zero, one, result);
+        break;
+    case 6:
+        tcg_gen_rem_tl(result, source1, divisor);
+        tcg_gen_movcond_tl(TCG_COND_EQ, dest, source2, zero, source1, result);
+        break;
+    default:
+        tcg_gen_remu_tl(result, source1, divisor);
+        tcg_gen_movcond_tl(TCG_COND_EQ, dest, source2, zero, source1, result);
+        break;
+    }
+
+    tcg_temp_free(zero);
+    tcg_temp_free(one);
+    tcg_temp_free(divisor);
+    tcg_temp_free(result);
+}
+
+/* rd is never x0 here, the decoder drops those as nops */
+inline static void gen_arith(DisasContext *ctx, uint32_t opc, 
+                      int rd, int rs1, int rs2)
+{
+    TCGv dest = cpu_gpr[rd];
+    TCGv source1 = get_gpr(ctx, rs1);
+    TCGv source2 = get_gpr(ctx, rs2);
+    TCGv t0, t1;
 
     switch (opc) {
 
     case OPC_RISC_ADD:
-        tcg_gen_add_tl(source1, source1, source2);
+        tcg_gen_add_tl(dest, source1, source2);
         break;
     case OPC_RISC_SUB:
-        tcg_gen_sub_tl(source1, source1, source2);
+        tcg_gen_sub_tl(dest, source1, source2);
         break;
     case OPC_RISC_SLL:
-        tcg_gen_andi_tl(source2, source2, 0x3F);
-        tcg_gen_shl_tl(source1, source1, source2);
+        t0 = tcg_temp_new();
+        tcg_gen_andi_tl(t0, source2, 0x3F);
+        tcg_gen_shl_tl(dest, source1, t0);
+        tcg_temp_free(t0);
         break;
     case OPC_RISC_SLT:
-        tcg_gen_setcond_tl(TCG_COND_LT, source1, source1, source2);
+        tcg_gen_setcond_tl(TCG_COND_LT, dest, source1, source2);
         break;
     case OPC_RISC_SLTU:
-        tcg_gen_setcond_tl(TCG_COND_LTU, source1, source1, source2);
+        tcg_gen_setcond_tl(TCG_COND_LTU, dest, source1, source2);
         break;
     case OPC_RISC_XOR:
-        tcg_gen_xor_tl(source1, source1, source2);
+        tcg_gen_xor_tl(dest, source1, source2);
         break;
     case OPC_RISC_SRL:
-        tcg_gen_andi_tl(source2, source2, 0x3F);
-        tcg_gen_shr_tl(source1, source1, source2);
+        t0 = tcg_temp_new();
+        tcg_gen_andi_tl(t0, source2, 0x3F);
+        tcg_gen_shr_tl(dest, source1, t0);
+        tcg_temp_free(t0);
         break;
     case OPC_RISC_SRA:
-        tcg_gen_andi_tl(source2, source2, 0x3F);
-        tcg_gen_sar_tl(source1, source1, source2);
+        t0 = tcg_temp_new();
+        tcg_gen_andi_tl(t0, source2, 0x3F);
+        tcg_gen_sar_tl(dest, source1, t0);
+        tcg_temp_free(t0);
         break;
     case OPC_RISC_OR:
-        tcg_gen_or_tl(source1, source1, source2);
+        tcg_gen_or_tl(dest, source1, source2);
         break;
     case OPC_RISC_AND:
-        tcg_gen_and_tl(source1, source1, source2);
+        tcg_gen_and_tl(dest, source1, source2);
         break;
     case OPC_RISC_MUL:
-        tcg_gen_muls2_tl(source1, source2, source1, source2);
+        tcg_gen_mul_tl(dest, source1, source2);
         break;
     case OPC_RISC_MULH:
-        tcg_gen_muls2_tl(source2, source1, source1, source2);
+        t0 = tcg_temp_new();
+        t1 = tcg_temp_new();
+        tcg_gen_muls2_tl(t0, t1, source1, source2);
+        tcg_gen_mov_tl(dest, t1);
+        tcg_temp_free(t0);
+        tcg_temp_free(t1);
         break;
     case OPC_RISC_MULHSU:
-        gen_helper_mulhsu(source1, cpu_env, source1, source2);
+        gen_helper_mulhsu(dest, cpu_env, source1, source2);
         break;
     case OPC_RISC_MULHU:
-        tcg_gen_mulu2_tl(source2, source1, source1, source2);
+        t0 = tcg_temp_new();
+        t1 = tcg_temp_new();
+        tcg_gen_mulu2_tl(t0, t1, source1, source2);
+        tcg_gen_mov_tl(dest, t1);
+        tcg_temp_free(t0);
+        tcg_temp_free(t1);
         break;
     case OPC_RISC_DIV:
-        {
-            TCGv spec_source1, spec_source2;
-            TCGv cond1, cond2;
-            int handle_zero = gen_new_label();
-            int handle_overflow = gen_new_label();
-            int done = gen_new_label();
-            spec_source1 = tcg_temp_local_new();
-            spec_source2 = tcg_temp_local_new();
-            cond1 = tcg_temp_local_new();
-            cond2 = tcg_temp_local_new();
-
-            gen_get_gpr(spec_source1, rs1);
-            gen_get_gpr(spec_source2, rs2);
-            tcg_gen_brcondi_tl(TCG_COND_EQ, spec_source2, 0x0, handle_zero);
-
-            // now, use temp reg to check if both overflow conditions satisfied
-            tcg_gen_setcondi_tl(TCG_COND_EQ, cond2, spec_source2, 0xFFFFFFFFFFFFFFFF); // divisor = -1
-            tcg_gen_setcondi_tl(TCG_COND_EQ, cond1, spec_source1, 0x8000000000000000);
-            tcg_gen_and_tl(cond1, cond1, cond2);
-
-            tcg_gen_brcondi_tl(TCG_COND_EQ, cond1, 1, handle_overflow);
-            // normal case
-            tcg_gen_div_tl(spec_source1, spec_source1, spec_source2);
-            tcg_gen_br(done);
-            // special zero case
-            gen_set_label(handle_zero);
-            tcg_gen_movi_tl(spec_source1, -1);
-            tcg_gen_br(done);
-            // special overflow case
-            gen_set_label(handle_overflow);
-            tcg_gen_movi_tl(spec_source1, 0x8000000000000000); 
-            // done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, spec_source1);
-            tcg_temp_free(spec_source1);
-            tcg_temp_free(spec_source2);
-        }                
-        break;
     case OPC_RISC_DIVU:
-        {
-            TCGv spec_source1, spec_source2;
-            int handle_zero = gen_new_label();
-            int done = gen_new_label();
-            spec_source1 = tcg_temp_local_new();
-            spec_source2 = tcg_temp_local_new();
-
-            gen_get_gpr(spec_source1, rs1);
-            gen_get_gpr(spec_source2, rs2);
-            tcg_gen_brcondi_tl(TCG_COND_EQ, spec_source2, 0x0, handle_zero);
-
-            // normal case
-            tcg_gen_divu_tl(spec_source1, spec_source1, spec_source2);
-            tcg_gen_br(done);
-            // special zero case
-            gen_set_label(handle_zero);
-            tcg_gen_movi_tl(spec_source1, -1);
-            tcg_gen_br(done);
-            // done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, spec_source1);
-            tcg_temp_free(spec_source1);
-            tcg_temp_free(spec_source2);
-        }                
-        break;
     case OPC_RISC_REM:
-        {
-            TCGv spec_source1, spec_source2;
-            TCGv cond1, cond2;
-            int handle_zero = gen_new_label();
-            int handle_overflow = gen_new_label();
-            int done = gen_new_label();
-            spec_source1 = tcg_temp_local_new();
-            spec_source2 = tcg_temp_local_new();
-            cond1 = tcg_temp_local_new();
-            cond2 = tcg_temp_local_new();
-
-            gen_get_gpr(spec_source1, rs1);
-            gen_get_gpr(spec_source2, rs2);
-            tcg_gen_brcondi_tl(TCG_COND_EQ, spec_source2, 0x0, handle_zero);
-
-            // now, use temp reg to check if both overflow conditions satisfied
-            tcg_gen_setcondi_tl(TCG_COND_EQ, cond2, spec_source2, 0xFFFFFFFFFFFFFFFF); // divisor = -1
-            tcg_gen_setcondi_tl(TCG_COND_EQ, cond1, spec_source1, 0x8000000000000000);
-            tcg_gen_and_tl(cond1, cond1, cond2);
-
-            tcg_gen_brcondi_tl(TCG_COND_EQ, cond1, 1, handle_overflow);
-            // normal case
-            tcg_gen_rem_tl(spec_source1, spec_source1, spec_source2);
-            tcg_gen_br(done);
-            // special zero case
-            gen_set_label(handle_zero);
-            tcg_gen_mov_tl(spec_source1, spec_source1); // even though it's a nop, just for clarity
-            tcg_gen_br(done);
-            // special overflow case
-            gen_set_label(handle_overflow);
-            tcg_gen_movi_tl(spec_source1, 0); 
-            // done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, spec_source1);
-            tcg_temp_free(spec_source1);
-            tcg_temp_free(spec_source2);
-        }                
-        break;
     case OPC_RISC_REMU:
-        {
-            TCGv spec_source1, spec_source2;
-            int handle_zero = gen_new_label();
-            int done = gen_new_label();
-            spec_source1 = tcg_temp_local_new();
-            spec_source2 = tcg_temp_local_new();
-
-            gen_get_gpr(spec_source1, rs1);
-            gen_get_gpr(spec_source2, rs2);
-            tcg_gen_brcondi_tl(TCG_COND_EQ, spec_source2, 0x0, handle_zero);
-
-            // normal case
-            tcg_gen_remu_tl(spec_source1, spec_source1, spec_source2);
-            tcg_gen_br(done);
-            // special zero case
-            gen_set_label(handle_zero);
-            tcg_gen_mov_tl(spec_source1, spec_source1); // even though it's a nop, just for clarity
-            tcg_gen_br(done);
-            // done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, spec_source1);
-            tcg_temp_free(spec_source1);
-            tcg_temp_free(spec_source2);
-        }                
+        gen_div_rem(dest, source1, source2, (opc >> 12) & 0x7);
         break;
     default:
         kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         break;
 
     }
-
-    // set and free
-    gen_set_gpr(rd, source1);
-    tcg_temp_free(source1);
-    tcg_temp_free(source2);
 }
 
-/* lower 12 bits of imm are valid */
+/* lower 12 bits of imm are valid; rd is never x0 */
 inline static void gen_arith_imm(DisasContext *ctx, uint32_t opc, 
                       int rd, int rs1, int16_t imm)
 {
-    TCGv source1;
-    source1 = tcg_temp_new();
-    gen_get_gpr(source1, rs1);
+    TCGv dest = cpu_gpr[rd];
+    TCGv source1 = get_gpr(ctx, rs1);
     target_ulong uimm = (target_long)imm; /* sign ext 16->64 bits */
 
     switch (opc) {
     case OPC_RISC_ADDI:
-        tcg_gen_addi_tl(source1, source1, uimm);
+        tcg_gen_addi_tl(dest, source1, uimm);
         break;
     case OPC_RISC_SLTI:
-        tcg_gen_setcondi_tl(TCG_COND_LT, source1, source1, uimm);
+        tcg_gen_setcondi_tl(TCG_COND_LT, dest, source1, uimm);
         break;
     case OPC_RISC_SLTIU:
-        tcg_gen_setcondi_tl(TCG_COND_LTU, source1, source1, uimm);
+        tcg_gen_setcondi_tl(TCG_COND_LTU, dest, source1, uimm);
         break;
     case OPC_RISC_XORI:
-        tcg_gen_xori_tl(source1, source1, uimm);
+        tcg_gen_xori_tl(dest, source1, uimm);
         break;
     case OPC_RISC_ORI:
-        tcg_gen_ori_tl(source1, source1, uimm);
+        tcg_gen_ori_tl(dest, source1, uimm);
         break;
     case OPC_RISC_ANDI:
-        tcg_gen_andi_tl(source1, source1, uimm);
+        tcg_gen_andi_tl(dest, source1, uimm);
         break;
     case OPC_RISC_SLLI: // TODO: add immediate upper bits check?
-        tcg_gen_shli_tl(source1, source1, uimm);
+        tcg_gen_shli_tl(dest, source1, uimm & 0x3F);
         break;
     case OPC_RISC_SHIFT_RIGHT_I: // SRLI, SRAI, TODO: upper bits check
         // differentiate on IMM
         if (uimm & 0x400) {
-            // SRAI
-            tcg_gen_sari_tl(source1, source1, uimm ^ 0x400);
+            tcg_gen_sari_tl(dest, source1, uimm & 0x3F);
         } else {
-            tcg_gen_shri_tl(source1, source1, uimm);
+            tcg_gen_shri_tl(dest, source1, uimm & 0x3F);
         }
         break;
     default:
         kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         break;
     }
-
-    gen_set_gpr(rd, source1);
-    tcg_temp_free(source1);
 }
 
-
-
-/* lower 12 bits of imm are valid */
+/* lower 12 bits of imm are valid; rd is never x0 */
 inline static void gen_arith_imm_w(DisasContext *ctx, uint32_t opc, 
                       int rd, int rs1, int16_t imm)
 {
-    TCGv source1;
-    source1 = tcg_temp_new();
-    gen_get_gpr(source1, rs1);
+    TCGv dest = cpu_gpr[rd];
+    TCGv source1 = get_gpr(ctx, rs1);
     target_ulong uimm = (target_long)imm; /* sign ext 16->64 bits */
 
     switch (opc) {
     case OPC_RISC_ADDIW:
-        tcg_gen_addi_tl(source1, source1, uimm);
-        tcg_gen_ext32s_tl(source1, source1);
+        tcg_gen_addi_tl(dest, source1, uimm);
+        tcg_gen_ext32s_tl(dest, dest);
         break;
     case OPC_RISC_SLLIW: // TODO: add immediate upper bits check?
-        tcg_gen_shli_tl(source1, source1, uimm);
-        tcg_gen_ext32s_tl(source1, source1);
+        tcg_gen_shli_tl(dest, source1, uimm & 0x1F);
+        tcg_gen_ext32s_tl(dest, dest);
         break;
     case OPC_RISC_SHIFT_RIGHT_IW: // SRLIW, SRAIW, TODO: upper bits check
         // differentiate on IMM
         if (uimm & 0x400) {
-            // SRAI
-            // first, trick to get it to act like working on 32 bits:
-            tcg_gen_shli_tl(source1, source1, 32);
-            // now shift back to the right by shamt + 32 to get proper upper 
-            // bits filling
-            tcg_gen_sari_tl(source1, source1, (uimm ^ 0x400) + 32);
-            tcg_gen_ext32s_tl(source1, source1);
+            // the sign extended low word shifted right stays sign extended
+            tcg_gen_ext32s_tl(dest, source1);
+            tcg_gen_sari_tl(dest, dest, uimm & 0x1F);
         } else {
-            // first, trick to get it to act like working on 32 bits (get rid 
-            // of upper 32):
-            tcg_gen_shli_tl(source1, source1, 32);
-            // now shift back to the right by shamt + 32 to get proper upper 
-            // bits filling
-            tcg_gen_shri_tl(source1, source1, uimm + 32);
-            tcg_gen_ext32s_tl(source1, source1);
+            tcg_gen_ext32u_tl(dest, source1);
+            tcg_gen_shri_tl(dest, dest, uimm & 0x1F);
+            tcg_gen_ext32s_tl(dest, dest);
         }
         break;
     default:
         kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         break;
     }
-    gen_set_gpr(rd, source1);
-    tcg_temp_free(source1);
 }
 
+/* rd is never x0 here, the decoder drops those as nops */
 inline static void gen_arith_w(DisasContext *ctx, uint32_t opc, 
                       int rd, int rs1, int rs2)
 {
-    TCGv source1, source2;
-    source1 = tcg_temp_new();
-    source2 = tcg_temp_new();
-    gen_get_gpr(source1, rs1);
-    gen_get_gpr(source2, rs2);
+    TCGv dest = cpu_gpr[rd];
+    TCGv source1 = get_gpr(ctx, rs1);
+    TCGv source2 = get_gpr(ctx, rs2);
+    TCGv t0, t1;
 
     switch (opc) {
     case OPC_RISC_ADDW:
-        tcg_gen_add_tl(source1, source1, source2);
-        tcg_gen_ext32s_tl(source1, source1);
+        tcg_gen_add_tl(dest, source1, source2);
+        tcg_gen_ext32s_tl(dest, dest);
         break;
     case OPC_RISC_SUBW:
-        tcg_gen_sub_tl(source1, source1, source2);
-        tcg_gen_ext32s_tl(source1, source1);
+        tcg_gen_sub_tl(dest, source1, source2);
+        tcg_gen_ext32s_tl(dest, dest);
         break;
     case OPC_RISC_SLLW:
-        tcg_gen_andi_tl(source2, source2, 0x1F);
-        tcg_gen_shl_tl(source1, source1, source2);
-        tcg_gen_ext32s_tl(source1, source1);
+        t0 = tcg_temp_new();
+        tcg_gen_andi_tl(t0, source2, 0x1F);
+        tcg_gen_shl_tl(dest, source1, t0);
+        tcg_gen_ext32s_tl(dest, dest);
+        tcg_temp_free(t0);
         break;
     case OPC_RISC_SRLW:
-        tcg_gen_andi_tl(source1, source1, 0x00000000FFFFFFFFLL); // clear upper 32
-        tcg_gen_andi_tl(source2, source2, 0x1F);
-        tcg_gen_shr_tl(source1, source1, source2); // do actual right shift
-        tcg_gen_ext32s_tl(source1, source1); // sign ext
+        t0 = tcg_temp_new();
+        t1 = tcg_temp_new();
+        tcg_gen_ext32u_tl(t1, source1); // clear upper 32
+        tcg_gen_andi_tl(t0, source2, 0x1F);
+        tcg_gen_shr_tl(dest, t1, t0);
+        tcg_gen_ext32s_tl(dest, dest);
+        tcg_temp_free(t0);
+        tcg_temp_free(t1);
         break;
     case OPC_RISC_SRAW:
-        // first, trick to get it to act like working on 32 bits (get rid of 
-        // upper 32)
-        tcg_gen_shli_tl(source1, source1, 32); // clear upper 32
-        tcg_gen_sari_tl(source1, source1, 32); // smear the sign bit into upper 32
-        tcg_gen_andi_tl(source2, source2, 0x1F);
-        tcg_gen_sar_tl(source1, source1, source2); // do the actual right shift
-        tcg_gen_ext32s_tl(source1, source1); // sign ext
+        t0 = tcg_temp_new();
+        t1 = tcg_temp_new();
+        tcg_gen_ext32s_tl(t1, source1); // smear the sign bit into upper 32
+        tcg_gen_andi_tl(t0, source2, 0x1F);
+        tcg_gen_sar_tl(dest, t1, t0);
+        tcg_temp_free(t0);
+        tcg_temp_free(t1);
         break;
     case OPC_RISC_MULW:
-        tcg_gen_muls2_tl(source1, source2, source1, source2);
-        tcg_gen_ext32s_tl(source1, source1);
+        tcg_gen_mul_tl(dest, source1, source2);
+        tcg_gen_ext32s_tl(dest, dest);
         break;
     case OPC_RISC_DIVW:
-        {
-            TCGv spec_source1, spec_source2;
-            TCGv cond1, cond2;
-            int handle_zero = gen_new_label();
-            int handle_overflow = gen_new_label();
-            int done = gen_new_label();
-            spec_source1 = tcg_temp_local_new();
-            spec_source2 = tcg_temp_local_new();
-            cond1 = tcg_temp_local_new();
-            cond2 = tcg_temp_local_new();
-
-            gen_get_gpr(spec_source1, rs1);
-            gen_get_gpr(spec_source2, rs2);
-            tcg_gen_ext32s_tl(spec_source1, spec_source1);
-            tcg_gen_ext32s_tl(spec_source2, spec_source2);
-
-            tcg_gen_brcondi_tl(TCG_COND_EQ, spec_source2, 0x0, handle_zero);
-
-            // now, use temp reg to check if both overflow conditions satisfied
-            tcg_gen_setcondi_tl(TCG_COND_EQ, cond2, spec_source2, 0xFFFFFFFFFFFFFFFF); // divisor = -1
-            tcg_gen_setcondi_tl(TCG_COND_EQ, cond1, spec_source1, 0x8000000000000000);
-            tcg_gen_and_tl(cond1, cond1, cond2);
-
-            tcg_gen_brcondi_tl(TCG_COND_EQ, cond1, 1, handle_overflow);
-            // normal case
-            tcg_gen_div_tl(spec_source1, spec_source1, spec_source2);
-            tcg_gen_br(done);
-            // special zero case
-            gen_set_label(handle_zero);
-            tcg_gen_movi_tl(spec_source1, -1);
-            tcg_gen_br(done);
-            // special overflow case
-            gen_set_label(handle_overflow);
-            tcg_gen_movi_tl(spec_source1, 0x8000000000000000); 
-            // done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, spec_source1);
-            tcg_temp_free(spec_source1);
-            tcg_temp_free(spec_source2);
-            tcg_gen_ext32s_tl(source1, source1);
-        }                
-        break;
     case OPC_RISC_DIVUW:
-        {
-            TCGv spec_source1, spec_source2;
-            int handle_zero = gen_new_label();
-            int done = gen_new_label();
-            spec_source1 = tcg_temp_local_new();
-            spec_source2 = tcg_temp_local_new();
-
-            gen_get_gpr(spec_source1, rs1);
-            gen_get_gpr(spec_source2, rs2);
-            tcg_gen_ext32u_tl(spec_source1, spec_source1);
-            tcg_gen_ext32u_tl(spec_source2, spec_source2);
-
-            tcg_gen_brcondi_tl(TCG_COND_EQ, spec_source2, 0x0, handle_zero);
-
-            // normal case
-            tcg_gen_divu_tl(spec_source1, spec_source1, spec_source2);
-            tcg_gen_br(done);
-            // special zero case
-            gen_set_label(handle_zero);
-            tcg_gen_movi_tl(spec_source1, -1);
-            tcg_gen_br(done);
-            // done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, spec_source1);
-            tcg_temp_free(spec_source1);
-            tcg_temp_free(spec_source2);
-            tcg_gen_ext32s_tl(source1, source1);
-        }                
-        break;
     case OPC_RISC_REMW:
-        {
-            TCGv spec_source1, spec_source2;
-            TCGv cond1, cond2;
-            int handle_zero = gen_new_label();
-            int handle_overflow = gen_new_label();
-            int done = gen_new_label();
-            spec_source1 = tcg_temp_local_new();
-            spec_source2 = tcg_temp_local_new();
-            cond1 = tcg_temp_local_new();
-            cond2 = tcg_temp_local_new();
-
-            gen_get_gpr(spec_source1, rs1);
-            gen_get_gpr(spec_source2, rs2);
-            tcg_gen_ext32s_tl(spec_source1, spec_source1);
-            tcg_gen_ext32s_tl(spec_source2, spec_source2);
-
-            tcg_gen_brcondi_tl(TCG_COND_EQ, spec_source2, 0x0, handle_zero);
-
-            // now, use temp reg to check if both overflow conditions satisfied
-            tcg_gen_setcondi_tl(TCG_COND_EQ, cond2, spec_source2, 0xFFFFFFFFFFFFFFFF); // divisor = -1
-            tcg_gen_setcondi_tl(TCG_COND_EQ, cond1, spec_source1, 0x8000000000000000);
-            tcg_gen_and_tl(cond1, cond1, cond2);
-
-            tcg_gen_brcondi_tl(TCG_COND_EQ, cond1, 1, handle_overflow);
-            // normal case
-            tcg_gen_rem_tl(spec_source1, spec_source1, spec_source2);
-            tcg_gen_br(done);
-            // special zero case
-            gen_set_label(handle_zero);
-            tcg_gen_mov_tl(spec_source1, spec_source1); // even though it's a nop, just for clarity
-            tcg_gen_br(done);
-            // special overflow case
-            gen_set_label(handle_overflow);
-            tcg_gen_movi_tl(spec_source1, 0); 
-            // done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, spec_source1);
-            tcg_temp_free(spec_source1);
-            tcg_temp_free(spec_source2);
-            tcg_gen_ext32s_tl(source1, source1);
-        }                
-        break;
     case OPC_RISC_REMUW:
-        {
-            TCGv spec_source1, spec_source2;
-            int handle_zero = gen_new_label();
-            int done = gen_new_label();
-            spec_source1 = tcg_temp_local_new();
-            spec_source2 = tcg_temp_local_new();
-
-            gen_get_gpr(spec_source1, rs1);
-            gen_get_gpr(spec_source2, rs2);
-            tcg_gen_ext32u_tl(spec_source1, spec_source1);
-            tcg_gen_ext32u_tl(spec_source2, spec_source2);
-
-            tcg_gen_brcondi_tl(TCG_COND_EQ, spec_source2, 0x0, handle_zero);
-// normal case
-            tcg_gen_remu_tl(spec_source1, spec_source1, spec_source2);
-            tcg_gen_br(done);
-            // special zero case
-            gen_set_label(handle_zero);
-            tcg_gen_mov_tl(spec_source1, spec_source1); // even though it's a nop, just for clarity
-            tcg_gen_br(done);
-            // done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, spec_source1);
-            tcg_temp_free(spec_source1);
-            tcg_temp_free(spec_source2);
-            tcg_gen_ext32s_tl(source1, source1);
-        }                
+        // widen the operands and use the 64 bit ops. For the signed ops
+        // MIN32 / -1 cannot overflow at 64 bits, and truncating the
+        // result gives the 32 bit answer
+        t0 = tcg_temp_new();
+        t1 = tcg_temp_new();
+        if (opc == OPC_RISC_DIVW || opc == OPC_RISC_REMW) {
+            tcg_gen_ext32s_tl(t0, source1);
+            tcg_gen_ext32s_tl(t1, source2);
+        } else {
+            tcg_gen_ext32u_tl(t0, source1);
+            tcg_gen_ext32u_tl(t1, source2);
+        }
+        gen_div_rem(dest, t0, t1, (opc >> 12) & 0x7);
+        tcg_gen_ext32s_tl(dest, dest);
+        tcg_temp_free(t0);
+        tcg_temp_free(t1);
         break;
     default:
         kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         break;
     }
-    gen_set_gpr(rd, source1);
-    tcg_temp_free(source1);
-    tcg_temp_free(source2);
 }
 
 inline static void gen_branch(DisasContext *ctx, uint32_t opc, 
                        int rs1, int rs2, int16_t bimm) {
 
     int l = gen_new_label();
-    TCGv source1, source2;
-    source1 = tcg_temp_new();
-    source2 = tcg_temp_new();
-    gen_get_gpr(source1, rs1);
-    gen_get_gpr(source2, rs2);
+    TCGv source1 = get_gpr(ctx, rs1);
+    TCGv source2 = get_gpr(ctx, rs2);
     target_ulong ubimm = (target_long)bimm; /* sign ext 16->64 bits */
 
     switch (opc) {
@@ -1005,14 +954,18 @@ inline static void gen_branch(DisasContext *ctx, uint32_t opc,
     }
 
 #ifdef DISABLE_CHAINING_BRANCH
-    tcg_gen_movi_tl(cpu_PC, ctx->pc + 4);
+    gen_instret_add(ctx, ctx->num_insns);
+    tcg_gen_movi_tl(cpu_PC, ctx->next_pc);
+    gen_tb_exit_count(RISCV_TB_EXIT_NOCHAIN);
     tcg_gen_exit_tb(0);
 #else
-    gen_goto_tb(ctx, 1, ctx->pc + 4); // must use this for safety
+    gen_goto_tb(ctx, 1, ctx->next_pc); // must use this for safety
 #endif
     gen_set_label(l); // branch taken
 #ifdef DISABLE_CHAINING_BRANCH
+    gen_instret_add(ctx, ctx->num_insns);
     tcg_gen_movi_tl(cpu_PC, ctx->pc + ubimm);
+    gen_tb_exit_count(RISCV_TB_EXIT_NOCHAIN);
     tcg_gen_exit_tb(0);
 #else
     gen_goto_tb(ctx, 0, ctx->pc + ubimm); // must use this for safety
@@ -1020,38 +973,57 @@ inline static void gen_branch(DisasContext *ctx, uint32_t opc,
     ctx->bstate = BS_BRANCH;
 }
 
+/* Effective address rs1 + imm. With a zero offset the base register is
+ * used as is; otherwise the sum goes to *tmp, which the caller frees. */
+static inline TCGv gen_address(DisasContext *ctx, TCGv *tmp, int rs1,
+                               target_long imm)
+{
+    if (imm == 0) {
+        TCGV_UNUSED(*tmp);
+        return get_gpr(ctx, rs1);
+    }
+    *tmp = tcg_temp_new();
+    tcg_gen_addi_tl(*tmp, get_gpr(ctx, rs1), imm);
+    return *tmp;
+}
+
+static inline void gen_free_address(TCGv tmp)
+{
+    if (!TCGV_IS_UNUSED(tmp)) {
+        tcg_temp_free(tmp);
+    }
+}
+
 inline static void gen_load(DisasContext *ctx, uint32_t opc, 
                       int rd, int rs1, int16_t imm)
 {
+    TCGv tmp;
+    TCGv addr = gen_address(ctx, &tmp, rs1, imm);
+    // loads into x0 still have to happen, they may fault
+    TCGv dest = dest_gpr(ctx, rd);
 
-    target_ulong uimm = (target_long)imm; /* sign ext 16->64 bits */
-
-    TCGv t0 = tcg_temp_new();
-    gen_get_gpr(t0, rs1);
-    tcg_gen_addi_tl(t0, t0, uimm); // 
-    
     switch (opc) {
 
     case OPC_RISC_LB:
-        tcg_gen_qemu_ld8s(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld8s(dest, addr, ctx->mem_idx);
         break;
     case OPC_RISC_LH:
-        tcg_gen_qemu_ld16s(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld16s(dest, addr, ctx->mem_idx);
         break;
     case OPC_RISC_LW:
-        tcg_gen_qemu_ld32s(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld32s(dest, addr, ctx->mem_idx);
         break;
     case OPC_RISC_LD:
-        tcg_gen_qemu_ld64(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld64(dest, addr, ctx->mem_idx);
         break;
     case OPC_RISC_LBU:
-        tcg_gen_qemu_ld8u(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld8u(dest, addr, ctx->mem_idx);
         break;
     case OPC_RISC_LHU:
-        tcg_gen_qemu_ld16u(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld16u(dest, addr, ctx->mem_idx);
         break;
     case OPC_RISC_LWU:
-        tcg_gen_qemu_ld32u(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld32u(dest, addr, ctx->mem_idx);
         break;
     default:
         kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
@@ -1059,35 +1031,30 @@ inline static void gen_load(DisasContext *ctx, uint32_t opc,
 
     }
 
-    gen_set_gpr(rd, t0);
-    tcg_temp_free(t0);
+    gen_free_address(tmp);
 }
 
 
 inline static void gen_store(DisasContext *ctx, uint32_t opc, 
                       int rs1, int rs2, int16_t imm)
 {
-    target_ulong uimm = (target_long)imm; /* sign ext 16->64 bits */
-
-    TCGv t0 = tcg_temp_new();
-    TCGv dat = tcg_temp_new();
-    gen_get_gpr(t0, rs1);
-    tcg_gen_addi_tl(t0, t0, uimm);
-    gen_get_gpr(dat, rs2);
+    TCGv tmp;
+    TCGv addr = gen_address(ctx, &tmp, rs1, imm);
+    TCGv dat = get_gpr(ctx, rs2);
 
     switch (opc) {
 
     case OPC_RISC_SB:
-        tcg_gen_qemu_st8(dat, t0, ctx->mem_idx);
+        tcg_gen_qemu_st8(dat, addr, ctx->mem_idx);
         break;
     case OPC_RISC_SH:
-        tcg_gen_qemu_st16(dat, t0, ctx->mem_idx);
+        tcg_gen_qemu_st16(dat, addr, ctx->mem_idx);
         break;
     case OPC_RISC_SW:
-        tcg_gen_qemu_st32(dat, t0, ctx->mem_idx);
+        tcg_gen_qemu_st32(dat, addr, ctx->mem_idx);
         break;
     case OPC_RISC_SD:
-        tcg_gen_qemu_st64(dat, t0, ctx->mem_idx);
+        tcg_gen_qemu_st64(dat, addr, ctx->mem_idx);
         break;
 
     default:
@@ -1095,32 +1062,30 @@ inline static void gen_store(DisasContext *ctx, uint32_t opc,
         break;
     }
 
-    tcg_temp_free(t0);
-    tcg_temp_free(dat);
+    gen_free_address(tmp);
 }
 
 inline static void gen_jalr(DisasContext *ctx, uint32_t opc, 
                       int rd, int rs1, int16_t imm)
 {
     target_ulong uimm = (target_long)imm; /* sign ext 16->64 bits */
-    TCGv t0, t1;
-    t0 = tcg_temp_new();
-    t1 = tcg_temp_new();
 
     switch (opc) {
     
-    case OPC_RISC_JALR: // CANNOT HAVE CHAINING WITH JALR
-        gen_get_gpr(t0, rs1);
-        tcg_gen_addi_tl(t0, t0, uimm);
-        tcg_gen_andi_tl(t0, t0, 0xFFFFFFFFFFFFFFFEll);
-
-        // store pc+4 to rd as necessary
-        tcg_gen_movi_tl(t1, 4);
-        tcg_gen_addi_tl(t1, t1, ctx->pc);
-        gen_set_gpr(rd, t1);
-
-        tcg_gen_mov_tl(cpu_PC, t0);
-        tcg_gen_exit_tb(0); // NO CHAINING FOR JALR
+    case OPC_RISC_JALR: // no direct chaining, target is only known at runtime
+        // compute the target first, rd may be the same register as rs1
+        tcg_gen_addi_tl(cpu_PC, get_gpr(ctx, rs1), uimm);
+        tcg_gen_andi_tl(cpu_PC, cpu_PC, 0xFFFFFFFFFFFFFFFEll);
+
+        // store the return address to rd as necessary
+        if (rd != 0) {
+            tcg_gen_movi_tl(cpu_gpr[rd], ctx->next_pc);
+        }
+        if (rd == 1) {
+            gen_ras_push(ctx->next_pc);
+        }
+
+        gen_goto_indirect(ctx, rd == 0 && rs1 == 1);
         ctx->bstate = BS_BRANCH;
         break;
     default:
@@ -1128,298 +1093,52 @@ inline static void gen_jalr(DisasContext *ctx, uint32_t opc,
         break;
 
     }
-    tcg_temp_free(t0);
-    tcg_temp_free(t1);
 }
 
 inline static void gen_atomic(DisasContext *ctx, uint32_t opc, 
                       int rd, int rs1, int rs2)
 {
-    // TODO: handle aq, rl bits? - for now just get rid of them:
+    // aq/rl need no extra fences: every atomic is a single helper call,
+    // which is already ordered against the surrounding loads and stores
     opc = MASK_OP_ATOMIC_NO_AQ_RL(opc);
 
-    TCGv source1, source2, dat;
+    TCGv source1 = get_gpr(ctx, rs1);
+    TCGv source2 = get_gpr(ctx, rs2);
+    TCGv dest = dest_gpr(ctx, rd);
+    TCGv_i32 op, size;
 
-    source1 = tcg_temp_new();
-    source2 = tcg_temp_new();
-    dat = tcg_temp_new();
-
-    gen_get_gpr(source1, rs1);
-    gen_get_gpr(source2, rs2);
+    op = tcg_const_i32((opc >> 27) & 0x1F);
+    // funct3 is 2 for .W and 3 for .D
+    size = tcg_const_i32(1 << ((opc >> 12) & 0x7));
 
     switch (opc) {
-        // all currently implemented as non-atomics
     case OPC_RISC_LR_W:
-        tcg_gen_qemu_ld32s(source1, source1, ctx->mem_idx);
+    case OPC_RISC_LR_D:
+        gen_helper_lr(dest, cpu_env, source1, size);
         break;
     case OPC_RISC_SC_W:
-        tcg_gen_qemu_st32(source2, source1, ctx->mem_idx);
-        tcg_gen_movi_tl(source1, 0);
+    case OPC_RISC_SC_D:
+        gen_helper_sc(dest, cpu_env, source1, source2, size);
         break;
     case OPC_RISC_AMOSWAP_W:
-        tcg_gen_qemu_ld32s(dat, source1, ctx->mem_idx);
-        tcg_gen_qemu_st32(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
-    case OPC_RISC_AMOADD_W:   
-        tcg_gen_qemu_ld32s(dat, source1, ctx->mem_idx);
-        tcg_gen_add_tl(source2, dat, source2);
-        tcg_gen_qemu_st32(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
+    case OPC_RISC_AMOADD_W:
     case OPC_RISC_AMOXOR_W:
-        tcg_gen_qemu_ld32s(dat, source1, ctx->mem_idx);
-        tcg_gen_xor_tl(source2, dat, source2);
-        tcg_gen_qemu_st32(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
     case OPC_RISC_AMOAND_W:
-        tcg_gen_qemu_ld32s(dat, source1, ctx->mem_idx);
-        tcg_gen_and_tl(source2, dat, source2);
-        tcg_gen_qemu_st32(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
     case OPC_RISC_AMOOR_W:
-        tcg_gen_qemu_ld32s(dat, source1, ctx->mem_idx);
-        tcg_gen_or_tl(source2, dat, source2); 
-        tcg_gen_qemu_st32(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
     case OPC_RISC_AMOMIN_W:
-        {
-            TCGv source1_l, source2_l, dat_l;
-            source1_l = tcg_temp_local_new();
-            source2_l = tcg_temp_local_new();
-            dat_l = tcg_temp_local_new();
-            int j = gen_new_label();
-            int done = gen_new_label();
-            tcg_gen_mov_tl(source1_l, source1);
-            tcg_gen_mov_tl(source2_l, source2);
-            tcg_gen_qemu_ld32s(dat_l, source1_l, ctx->mem_idx);
-            tcg_gen_brcond_tl(TCG_COND_LT, dat_l, source2_l, j);
-            tcg_gen_qemu_st32(source2_l, source1_l, ctx->mem_idx);
-            tcg_gen_br(done);
-            // here we store the thing on the left
-            gen_set_label(j);
-            tcg_gen_qemu_st32(dat_l, source1_l, ctx->mem_idx);
-            //done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, dat_l);
-            tcg_temp_free(source1_l);
-            tcg_temp_free(source2_l);
-            tcg_temp_free(dat_l);
-        }
-        break;
     case OPC_RISC_AMOMAX_W:
-        {
-            TCGv source1_l, source2_l, dat_l;
-            source1_l = tcg_temp_local_new();
-            source2_l = tcg_temp_local_new();
-            dat_l = tcg_temp_local_new();
-            int j = gen_new_label();
-            int done = gen_new_label();
-            tcg_gen_mov_tl(source1_l, source1);
-            tcg_gen_mov_tl(source2_l, source2);
-            tcg_gen_qemu_ld32s(dat_l, source1_l, ctx->mem_idx);
-            tcg_gen_brcond_tl(TCG_COND_GT, dat_l, source2_l, j);
-            tcg_gen_qemu_st32(source2_l, source1_l, ctx->mem_idx);
-            tcg_gen_br(done);
-            // here we store the thing on the left
-            gen_set_label(j);
-            tcg_gen_qemu_st32(dat_l, source1_l, ctx->mem_idx);
-            //done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, dat_l);
-            tcg_temp_free(source1_l);
-            tcg_temp_free(source2_l);
-            tcg_temp_free(dat_l);
-        }
-        break;
     case OPC_RISC_AMOMINU_W:
-        {
-            TCGv source1_l, source2_l, dat_l;
-            source1_l = tcg_temp_local_new();
-            source2_l = tcg_temp_local_new();
-            dat_l = tcg_temp_local_new();
-            int j = gen_new_label();
-            int done = gen_new_label();
-            tcg_gen_mov_tl(source1_l, source1);
-            tcg_gen_mov_tl(source2_l, source2);
-            tcg_gen_qemu_ld32s(dat_l, source1_l, ctx->mem_idx);
-            tcg_gen_brcond_tl(TCG_COND_LTU, dat_l, source2_l, j);
-            tcg_gen_qemu_st32(source2_l, source1_l, ctx->mem_idx);
-            tcg_gen_br(done);
-            // here we store the thing on the left
-            gen_set_label(j);
-            tcg_gen_qemu_st32(dat_l, source1_l, ctx->mem_idx);
-            //done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, dat_l);
-            tcg_temp_free(source1_l);
-            tcg_temp_free(source2_l);
-            tcg_temp_free(dat_l);
-        }
-        break;
     case OPC_RISC_AMOMAXU_W:
-        {
-            TCGv source1_l, source2_l, dat_l;
-            source1_l = tcg_temp_local_new();
-            source2_l = tcg_temp_local_new();
-            dat_l = tcg_temp_local_new();
-            int j = gen_new_label();
-            int done = gen_new_label();
-            tcg_gen_mov_tl(source1_l, source1);
-            tcg_gen_mov_tl(source2_l, source2);
-            tcg_gen_qemu_ld32s(dat_l, source1_l, ctx->mem_idx);
-            tcg_gen_brcond_tl(TCG_COND_GTU, dat_l, source2_l, j);
-            tcg_gen_qemu_st32(source2_l, source1_l, ctx->mem_idx);
-            tcg_gen_br(done);
-            // here we store the thing on the left
-            gen_set_label(j);
-            tcg_gen_qemu_st32(dat_l, source1_l, ctx->mem_idx);
-            //done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, dat_l);
-            tcg_temp_free(source1_l);
-            tcg_temp_free(source2_l);
-            tcg_temp_free(dat_l);
-        }
-        break;
-    case OPC_RISC_LR_D:
-        tcg_gen_qemu_ld64(source1, source1, ctx->mem_idx);
-        break;
-    case OPC_RISC_SC_D:       
-        tcg_gen_qemu_st64(source2, source1, ctx->mem_idx);
-        tcg_gen_movi_tl(source1, 0); // assume always success
-        break;
     case OPC_RISC_AMOSWAP_D:
-        tcg_gen_qemu_ld64(dat, source1, ctx->mem_idx);
-        tcg_gen_qemu_st64(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
     case OPC_RISC_AMOADD_D:
-        tcg_gen_qemu_ld64(dat, source1, ctx->mem_idx);
-        tcg_gen_add_tl(source2, dat, source2);
-        tcg_gen_qemu_st64(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
-    case OPC_RISC_AMOXOR_D: 
-        tcg_gen_qemu_ld64(dat, source1, ctx->mem_idx);
-        tcg_gen_xor_tl(source2, dat, source2);
-        tcg_gen_qemu_st64(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
+    case OPC_RISC_AMOXOR_D:
     case OPC_RISC_AMOAND_D:
-        tcg_gen_qemu_ld64(dat, source1, ctx->mem_idx);
-        tcg_gen_and_tl(source2, dat, source2);
-        tcg_gen_qemu_st64(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
     case OPC_RISC_AMOOR_D:
-        tcg_gen_qemu_ld64(dat, source1, ctx->mem_idx);
-        tcg_gen_or_tl(source2, dat, source2);
-        tcg_gen_qemu_st64(source2, source1, ctx->mem_idx);
-        tcg_gen_mov_tl(source1, dat);
-        break;
     case OPC_RISC_AMOMIN_D:
-        {
-            TCGv source1_l, source2_l, dat_l;
-            source1_l = tcg_temp_local_new();
-            source2_l = tcg_temp_local_new();
-            dat_l = tcg_temp_local_new();
-            int j = gen_new_label();
-            int done = gen_new_label();
-            tcg_gen_mov_tl(source1_l, source1);
-            tcg_gen_mov_tl(source2_l, source2);
-            tcg_gen_qemu_ld64(dat_l, source1_l, ctx->mem_idx);
-            tcg_gen_brcond_tl(TCG_COND_LT, dat_l, source2_l, j);
-            tcg_gen_qemu_st64(source2_l, source1_l, ctx->mem_idx);
-            tcg_gen_br(done);
-            // here we store the thing on the left
-            gen_set_label(j);
-            tcg_gen_qemu_st64(dat_l, source1_l, ctx->mem_idx);
-            //done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, dat_l);
-            tcg_temp_free(source1_l);
-            tcg_temp_free(source2_l);
-            tcg_temp_free(dat_l);
-        }
-        break;
     case OPC_RISC_AMOMAX_D:
-        {
-            TCGv source1_l, source2_l, dat_l;
-            source1_l = tcg_temp_local_new();
-            source2_l = tcg_temp_local_new();
-            dat_l = tcg_temp_local_new();
-            int j = gen_new_label();
-            int done = gen_new_label();
-            tcg_gen_mov_tl(source1_l, source1);
-            tcg_gen_mov_tl(source2_l, source2);
-            tcg_gen_qemu_ld64(dat_l, source1_l, ctx->mem_idx);
-            tcg_gen_brcond_tl(TCG_COND_GT, dat_l, source2_l, j);
-            tcg_gen_qemu_st64(source2_l, source1_l, ctx->mem_idx);
-            tcg_gen_br(done);
-            // here we store the thing on the left
-            gen_set_label(j);
-            tcg_gen_qemu_st64(dat_l, source1_l, ctx->mem_idx);
-            //done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, dat_l);
-            tcg_temp_free(source1_l);
-            tcg_temp_free(source2_l);
-            tcg_temp_free(dat_l);
-        }
-        break;
     case OPC_RISC_AMOMINU_D:
-        {
-            TCGv source1_l, source2_l, dat_l;
-            source1_l = tcg_temp_local_new();
-            source2_l = tcg_temp_local_new();
-            dat_l = tcg_temp_local_new();
-            int j = gen_new_label();
-            int done = gen_new_label();
-            tcg_gen_mov_tl(source1_l, source1);
-            tcg_gen_mov_tl(source2_l, source2);
-            tcg_gen_qemu_ld64(dat_l, source1_l, ctx->mem_idx);
-            tcg_gen_brcond_tl(TCG_COND_LTU, dat_l, source2_l, j);
-            tcg_gen_qemu_st64(source2_l, source1_l, ctx->mem_idx);
-            tcg_gen_br(done);
-            // here we store the thing on the left
-            gen_set_label(j);
-            tcg_gen_qemu_st64(dat_l, source1_l, ctx->mem_idx);
-            //done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, dat_l);
-            tcg_temp_free(source1_l);
-            tcg_temp_free(source2_l);
-            tcg_temp_free(dat_l);
-        }
-        break;
     case OPC_RISC_AMOMAXU_D:
-        {
-            TCGv source1_l, source2_l, dat_l;
-            source1_l = tcg_temp_local_new();
-            source2_l = tcg_temp_local_new();
-            dat_l = tcg_temp_local_new();
-            int j = gen_new_label();
-            int done = gen_new_label();
-            tcg_gen_mov_tl(source1_l, source1);
-            tcg_gen_mov_tl(source2_l, source2);
-            tcg_gen_qemu_ld64(dat_l, source1_l, ctx->mem_idx);
-            tcg_gen_brcond_tl(TCG_COND_GTU, dat_l, source2_l, j);
-            tcg_gen_qemu_st64(source2_l, source1_l, ctx->mem_idx);
-            tcg_gen_br(done);
-            // here we store the thing on the left
-            gen_set_label(j);
-            tcg_gen_qemu_st64(dat_l, source1_l, ctx->mem_idx);
-            //done
-            gen_set_label(done);
-            tcg_gen_mov_tl(source1, dat_l);
-            tcg_temp_free(source1_l);
-            tcg_temp_free(source2_l);
-            tcg_temp_free(dat_l);
-        }
+        gen_helper_amo(dest, cpu_env, op, source1, source2, size);
         break;
     default:
         kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
@@ -1427,22 +1146,20 @@ inline static void gen_atomic(DisasContext *ctx, uint32_t opc,
 
     }
 
-    // set and free
-    gen_set_gpr(rd, source1);
-    tcg_temp_free(source1);
-    tcg_temp_free(source2);
-    tcg_temp_free(dat);
+    tcg_temp_free_i32(op);
+    tcg_temp_free_i32(size);
 }
 
-
 inline static void gen_csr_htif(DisasContext *ctx, uint32_t opc, int addr, int rd, int rs1) {
     TCGv source1, csr_store, htif_addr;
     source1 = tcg_temp_new();
     csr_store = tcg_temp_new();
     htif_addr = tcg_temp_new();
+    // csrrs/csrrc with x0 (or a zero immediate) only read the register
+    bool write = opc == OPC_RISC_CSRRW || opc == OPC_RISC_CSRRWI || rs1 != 0;
     gen_get_gpr(source1, rs1); // load rs1 val
     tcg_gen_movi_tl(htif_addr, addr);
-    tcg_gen_qemu_ld64(csr_store, htif_addr, ctx->mem_idx); // get htif "reg" val
+    gen_helper_htif_read(csr_store, cpu_env, htif_addr); // get htif "reg" val
 
     switch (opc) {
 
@@ -1469,8 +1186,84 @@ inline static void gen_csr_htif(DisasContext *ctx, uint32_t opc, int addr, int r
         break;
 
     }
-    tcg_gen_qemu_st64(source1, htif_addr, ctx->mem_idx);
+    if (write) {
+        gen_helper_htif_write(cpu_env, htif_addr, source1);
+    }
     gen_set_gpr(rd, csr_store);
+    tcg_temp_free(source1);
+    tcg_temp_free(csr_store);
+    tcg_temp_free(htif_addr);
+}
+
+/* CSRs that are plain storage in helper_csr[], with no side effects on
+ * either read or write. These are accessed with direct loads and stores
+ * rather than through csr_read_helper/csr_write_helper. */
+static inline bool csr_is_plain(int csr)
+{
+    switch (csr) {
+    case CSR_SUP0:
+    case CSR_SUP1:
+    case CSR_EPC:
+    case CSR_BADVADDR:
+    case CSR_EVEC:
+    case CSR_CAUSE:
+    case CSR_IMPL:
+    case CSR_FFLAGS:
+    case CSR_FRM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline static void gen_csr_plain(DisasContext *ctx, uint32_t opc,
+                                 int rd, int rs1, int csr)
+{
+    TCGv old = tcg_temp_new();
+    TCGv val = tcg_temp_new();
+    int offset = offsetof(CPURISCVState, helper_csr[csr]);
+    // csrrs/csrrc with x0 (or a zero immediate) only read the CSR
+    bool write = true;
+
+    tcg_gen_ld_tl(old, cpu_env, offset);
+
+    switch (opc) {
+    case OPC_RISC_CSRRW:
+        gen_get_gpr(val, rs1);
+        break;
+    case OPC_RISC_CSRRS:
+        write = rs1 != 0;
+        gen_get_gpr(val, rs1);
+        tcg_gen_or_tl(val, old, val);
+        break;
+    case OPC_RISC_CSRRC:
+        write = rs1 != 0;
+        gen_get_gpr(val, rs1);
+        tcg_gen_andc_tl(val, old, val);
+        break;
+    case OPC_RISC_CSRRWI:
+        tcg_gen_movi_tl(val, rs1);
+        break;
+    case OPC_RISC_CSRRSI:
+        write = rs1 != 0;
+        tcg_gen_ori_tl(val, old, rs1);
+        break;
+    case OPC_RISC_CSRRCI:
+        write = rs1 != 0;
+        tcg_gen_andi_tl(val, old, ~((uint64_t)rs1));
+        break;
+    default:
+        write = false;
+        kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
+        break;
+    }
+
+    if (write) {
+        tcg_gen_st_tl(val, cpu_env, offset);
+    }
+    gen_set_gpr(rd, old);
+    tcg_temp_free(old);
+    tcg_temp_free(val);
 }
 
 inline static void gen_system(DisasContext *ctx, uint32_t opc, 
@@ -1481,7 +1274,7 @@ inline static void gen_system(DisasContext *ctx, uint32_t opc,
 
     csr = csr_regno(csr);
 
-    if (unlikely(backup_csr == 0x50D || backup_csr == 0x505)) {
+    if (unlikely(backup_csr == 0x50D)) {
         gen_helper_tlb_flush(cpu_env);
     } else if (unlikely(csr == CSR_TOHOST)) {
         gen_csr_htif(ctx, opc, 0x400, rd, rs1);
@@ -1490,6 +1283,21 @@ inline static void gen_system(DisasContext *ctx, uint32_t opc,
         gen_csr_htif(ctx, opc, 0x408, rd, rs1);
         return;
     }
+    if (opc != OPC_RISC_SCALL && csr_is_plain(csr)) {
+        gen_csr_plain(ctx, opc, rd, rs1, csr);
+        return;
+    }
+    if (ctx->count_insns && rs1 == 0 && opc != OPC_RISC_SCALL &&
+        opc != OPC_RISC_CSRRW && opc != OPC_RISC_CSRRWI &&
+        (csr == CSR_CYCLE || csr == CSR_TIME || csr == CSR_INSTRET)) {
+        // rdcycle/rdtime/rdinstret: instructions retired before this one
+        if (rd != 0) {
+            tcg_gen_ld_tl(cpu_gpr[rd], cpu_env,
+                          offsetof(CPURISCVState, instret));
+            tcg_gen_addi_tl(cpu_gpr[rd], cpu_gpr[rd], ctx->num_insns - 1);
+        }
+        return;
+    }
 
     TCGv source1, csr_store, dest;
     source1 = tcg_temp_new();
@@ -1510,9 +1318,19 @@ inline static void gen_system(DisasContext *ctx, uint32_t opc,
                 kill_unknown(ctx, RISCV_EXCP_BREAK);
                 ctx->bstate = BS_STOP;
                 break;
+            case 0x102: // WFI
+#ifndef CONFIG_USER_ONLY
+                // the WFI retires before the hart goes to sleep
+                tcg_gen_movi_tl(cpu_PC, ctx->next_pc);
+                gen_instret_add(ctx, ctx->num_insns);
+                gen_helper_wfi(cpu_env);
+                ctx->bstate = BS_BRANCH;
+#endif
+                // in user mode there is nothing to wait for: a nop
+                break;
             case 0x800: // SRET
                 gen_helper_sret(cpu_PC, cpu_env);
-                tcg_gen_exit_tb(0); // no chaining
+                gen_goto_indirect(ctx, false);
                 ctx->bstate = BS_BRANCH;
                 break;
             default:
@@ -1567,54 +1385,55 @@ inline static void gen_system(DisasContext *ctx, uint32_t opc,
     tcg_temp_free(source1);
     tcg_temp_free(dest);
     tcg_temp_free(csr_store);
+
+    // Writes to the remaining CSRs have side effects: they can change the
+    // MMU mode or the translation of the following code, which is baked
+    // into this TB, or raise or enable an interrupt. Look the next TB up
+    // again.
+    if (opc != OPC_RISC_SCALL && (opc == OPC_RISC_CSRRW ||
+        opc == OPC_RISC_CSRRWI || rs1 != 0)) {
+        tcg_gen_movi_tl(cpu_PC, ctx->next_pc);
+        gen_goto_indirect(ctx, false);
+        ctx->bstate = BS_BRANCH;
+    }
 }
 
 
 inline static void gen_fp_load(DisasContext *ctx, uint32_t opc, 
                       int rd, int rs1, int16_t imm)
 {
-    target_ulong uimm = (target_long)imm; /* sign ext 16->64 bits */
+    TCGv tmp;
+    TCGv addr = gen_address(ctx, &tmp, rs1, imm);
 
-    TCGv t0 = tcg_temp_new();
-    gen_get_gpr(t0, rs1);
-    tcg_gen_addi_tl(t0, t0, uimm);
-    
     switch (opc) {
 
     case OPC_RISC_FLW:
-        tcg_gen_qemu_ld32u(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld32u(cpu_fpr[rd], addr, ctx->mem_idx);
         break;
     case OPC_RISC_FLD:
-        tcg_gen_qemu_ld64(t0, t0, ctx->mem_idx);
+        tcg_gen_qemu_ld64(cpu_fpr[rd], addr, ctx->mem_idx);
         break;
     default:
         kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         break;
 
     }
-    tcg_gen_mov_tl(cpu_fpr[rd], t0); // probably can just get rid of this and 
-                                     // store directly to cpu_fpr[rd]
-    tcg_temp_free(t0);
+    gen_free_address(tmp);
 }
 
 inline static void gen_fp_store(DisasContext *ctx, uint32_t opc, 
                       int rs1, int rs2, int16_t imm)
 {
-    target_ulong uimm = (target_long)imm; /* sign ext 16->64 bits */
-
-    TCGv t0 = tcg_temp_new();
-    TCGv dat = tcg_temp_new();
-    gen_get_gpr(t0, rs1);
-    tcg_gen_addi_tl(t0, t0, uimm);
-    tcg_gen_mov_tl(dat, cpu_fpr[rs2]);
+    TCGv tmp;
+    TCGv addr = gen_address(ctx, &tmp, rs1, imm);
 
     switch (opc) {
 
     case OPC_RISC_FSW:
-        tcg_gen_qemu_st32(dat, t0, ctx->mem_idx);
+        tcg_gen_qemu_st32(cpu_fpr[rs2], addr, ctx->mem_idx);
         break;
     case OPC_RISC_FSD:
-        tcg_gen_qemu_st64(dat, t0, ctx->mem_idx);
+        tcg_gen_qemu_st64(cpu_fpr[rs2], addr, ctx->mem_idx);
         break;
 
     default:
@@ -1622,8 +1441,7 @@ inline static void gen_fp_store(DisasContext *ctx, uint32_t opc,
         break;
     }
 
-    tcg_temp_free(t0);
-    tcg_temp_free(dat);
+    gen_free_address(tmp);
 }
 
 inline static void gen_fp_fmadd(DisasContext *ctx, uint32_t opc,
@@ -1711,6 +1529,235 @@ inline static void gen_fp_fnmadd(DisasContext *ctx, uint32_t opc,
     tcg_temp_free(rm_reg);
 }
 
+/* FP sign injection is pure bit manipulation: rd = rs1 with its sign bit
+ * replaced by rs2's sign (fsgnj), its inverse (fsgnjn) or the xor of both
+ * signs (fsgnjx). sign is the sign bit mask of the format. */
+inline static void gen_fsgnj(DisasContext *ctx, int rd, int rs1, int rs2,
+                             int rm, uint64_t sign)
+{
+    TCGv t0;
+
+    if (rs1 == rs2 && rm == 0x0) { // FMV
+        tcg_gen_mov_tl(cpu_fpr[rd], cpu_fpr[rs1]);
+        return;
+    }
+
+    t0 = tcg_temp_new();
+    switch (rm) {
+    case 0x0: // FSGNJ
+        tcg_gen_andi_tl(t0, cpu_fpr[rs2], sign);
+        tcg_gen_andi_tl(cpu_fpr[rd], cpu_fpr[rs1], ~sign);
+        tcg_gen_or_tl(cpu_fpr[rd], cpu_fpr[rd], t0);
+        break;
+    case 0x1: // FSGNJN
+        tcg_gen_not_tl(t0, cpu_fpr[rs2]);
+        tcg_gen_andi_tl(t0, t0, sign);
+        tcg_gen_andi_tl(cpu_fpr[rd], cpu_fpr[rs1], ~sign);
+        tcg_gen_or_tl(cpu_fpr[rd], cpu_fpr[rd], t0);
+        break;
+    case 0x2: // FSGNJX
+        tcg_gen_andi_tl(t0, cpu_fpr[rs2], sign);
+        tcg_gen_xor_tl(cpu_fpr[rd], cpu_fpr[rs1], t0);
+        break;
+    default:
+        kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
+        break;
+    }
+    tcg_temp_free(t0);
+}
+
+/* Load an FP register so that its sign bit ends up in bit 63: singles are
+ * shifted into the top half, which lets one code sequence serve both
+ * formats. */
+inline static void gen_fp_load_top(TCGv dest, int reg, bool dbl)
+{
+    if (dbl) {
+        tcg_gen_mov_tl(dest, cpu_fpr[reg]);
+    } else {
+        tcg_gen_shli_tl(dest, cpu_fpr[reg], 32);
+    }
+}
+
+// exponent all ones, fraction zero, in the layout of gen_fp_load_top
+#define FP_TOP_INF(dbl) ((dbl) ? 0x7FF0000000000000ull : 0x7F80000000000000ull)
+
+/* FCLASS without a helper. For the magnitude m (value without its sign),
+ * the class on the positive side is
+ *   7 inf, 6 normal, 5 subnormal, 4 zero
+ * which is 6 + (m >= inf) - (m < smallest normal) - (m == 0). Negative
+ * numbers mirror it onto 0..3, i.e. class ^ 7. NaNs are 8 (signaling) or
+ * 9 (quiet, top fraction bit set). */
+inline static void gen_fclass(TCGv dest, int rs1, bool dbl)
+{
+    uint64_t inf = FP_TOP_INF(dbl);
+    uint64_t min_normal = dbl ? 1ull << 52 : 1ull << 55; // exponent 1
+    int quiet_bit = dbl ? 51 : 54;
+    TCGv zero = tcg_const_tl(0);
+    TCGv x = tcg_temp_new();
+    TCGv m = tcg_temp_new();
+    TCGv cls = tcg_temp_new();
+    TCGv t0 = tcg_temp_new();
+    TCGv t1 = tcg_temp_new();
+
+    gen_fp_load_top(x, rs1, dbl);
+    tcg_gen_andi_tl(m, x, INT64_MAX);
+
+    tcg_gen_setcondi_tl(TCG_COND_GEU, t0, m, inf);
+    tcg_gen_addi_tl(cls, t0, 6);
+    tcg_gen_setcondi_tl(TCG_COND_LTU, t0, m, min_normal);
+    tcg_gen_sub_tl(cls, cls, t0);
+    tcg_gen_setcondi_tl(TCG_COND_EQ, t0, m, 0);
+    tcg_gen_sub_tl(cls, cls, t0);
+
+    tcg_gen_shri_tl(t0, x, 63);
+    tcg_gen_muli_tl(t0, t0, 7);
+    tcg_gen_xor_tl(cls, cls, t0);
+
+    tcg_gen_shri_tl(t0, x, quiet_bit);
+    tcg_gen_andi_tl(t0, t0, 1);
+    tcg_gen_addi_tl(t0, t0, 8);
+    tcg_gen_setcondi_tl(TCG_COND_GTU, t1, m, inf);
+    tcg_gen_movcond_tl(TCG_COND_NE, cls, t1, zero, t0, cls);
+
+    tcg_gen_movi_tl(t0, 1);
+    tcg_gen_shl_tl(dest, t0, cls);
+
+    tcg_temp_free(zero);
+    tcg_temp_free(x);
+    tcg_temp_free(m);
+    tcg_temp_free(cls);
+    tcg_temp_free(t0);
+    tcg_temp_free(t1);
+}
+
+enum {
+    FP_CMP_LE,
+    FP_CMP_LT,
+    FP_CMP_EQ,
+    FP_CMP_MIN,
+    FP_CMP_MAX,
+};
+
+/* Compares and min/max with an inline fast path. Two numbers that are not
+ * NaN compare like their bit patterns once those are turned into unsigned
+ * keys (flip the sign bit of positive numbers, all bits of negative ones),
+ * except that -0 == +0. None of these raise flags for such inputs. If
+ * either input is a NaN the softfloat helper computes the result and the
+ * exception flags instead. */
+inline static void gen_fp_cmp(DisasContext *ctx, TCGv dest, int op,
+                              int rs1, int rs2, bool dbl)
+{
+    uint64_t inf = FP_TOP_INF(dbl);
+    TCGv a = tcg_temp_new();
+    TCGv b = tcg_temp_new();
+    TCGv ka = tcg_temp_new();
+    TCGv kb = tcg_temp_new();
+    TCGv zero = tcg_temp_new();
+    TCGv nan = tcg_temp_new();
+    TCGv res = tcg_temp_local_new();
+    int done = gen_new_label();
+
+    gen_fp_load_top(a, rs1, dbl);
+    gen_fp_load_top(b, rs2, dbl);
+
+    // nan = a or b is a NaN
+    tcg_gen_andi_tl(ka, a, INT64_MAX);
+    tcg_gen_setcondi_tl(TCG_COND_GTU, nan, ka, inf);
+    tcg_gen_andi_tl(kb, b, INT64_MAX);
+    tcg_gen_setcondi_tl(TCG_COND_GTU, kb, kb, inf);
+    tcg_gen_or_tl(nan, nan, kb);
+
+    // zero = both are +-0
+    tcg_gen_or_tl(zero, a, b);
+    tcg_gen_andi_tl(zero, zero, INT64_MAX);
+    tcg_gen_setcondi_tl(TCG_COND_EQ, zero, zero, 0);
+
+    // ordering keys
+    tcg_gen_sari_tl(ka, a, 63);
+    tcg_gen_ori_tl(ka, ka, INT64_MIN);
+    tcg_gen_xor_tl(ka, ka, a);
+    tcg_gen_sari_tl(kb, b, 63);
+    tcg_gen_ori_tl(kb, kb, INT64_MIN);
+    tcg_gen_xor_tl(kb, kb, b);
+
+    switch (op) {
+    case FP_CMP_LE:
+        tcg_gen_setcond_tl(TCG_COND_LEU, res, ka, kb);
+        tcg_gen_or_tl(res, res, zero);
+        break;
+    case FP_CMP_LT:
+        tcg_gen_setcond_tl(TCG_COND_LTU, res, ka, kb);
+        tcg_gen_andc_tl(res, res, zero);
+        break;
+    case FP_CMP_EQ:
+        tcg_gen_setcond_tl(TCG_COND_EQ, res, a, b);
+        tcg_gen_or_tl(res, res, zero);
+        break;
+    case FP_CMP_MIN:
+    case FP_CMP_MAX:
+        // rs1 if it is strictly less (min) or greater (max), else rs2
+        if (op == FP_CMP_MIN) {
+            tcg_gen_setcond_tl(TCG_COND_LTU, ka, ka, kb);
+        } else {
+            tcg_gen_setcond_tl(TCG_COND_LTU, ka, kb, ka);
+        }
+        tcg_gen_andc_tl(ka, ka, zero);
+        tcg_gen_movi_tl(kb, 0);
+        tcg_gen_movcond_tl(TCG_COND_NE, res, ka, kb,
+                           cpu_fpr[rs1], cpu_fpr[rs2]);
+        break;
+    }
+
+    tcg_gen_brcondi_tl(TCG_COND_EQ, nan, 0, done);
+    switch (op) {
+    case FP_CMP_LE:
+        if (dbl) {
+            gen_helper_fle_d(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        } else {
+            gen_helper_fle_s(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        }
+        break;
+    case FP_CMP_LT:
+        if (dbl) {
+            gen_helper_flt_d(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        } else {
+            gen_helper_flt_s(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        }
+        break;
+    case FP_CMP_EQ:
+        if (dbl) {
+            gen_helper_feq_d(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        } else {
+            gen_helper_feq_s(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        }
+        break;
+    case FP_CMP_MIN:
+        if (dbl) {
+            gen_helper_fmin_d(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        } else {
+            gen_helper_fmin_s(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        }
+        break;
+    case FP_CMP_MAX:
+        if (dbl) {
+            gen_helper_fmax_d(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        } else {
+            gen_helper_fmax_s(res, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+        }
+        break;
+    }
+    gen_set_label(done);
+    tcg_gen_mov_tl(dest, res);
+
+    tcg_temp_free(a);
+    tcg_temp_free(b);
+    tcg_temp_free(ka);
+    tcg_temp_free(kb);
+    tcg_temp_free(zero);
+    tcg_temp_free(nan);
+    tcg_temp_free(res);
+}
+
 inline static void gen_fp_arith(DisasContext *ctx, uint32_t opc, 
                     int rd, int rs1, int rs2, int rm) 
 {
@@ -1733,23 +1780,14 @@ inline static void gen_fp_arith(DisasContext *ctx, uint32_t opc,
         break;
     case OPC_RISC_FSGNJ_S:
         // also handles: OPC_RISC_FSGNJN_S, OPC_RISC_FSGNJX_S  
-        // TODO: probably don't need to use helpers here
-        if (rm == 0x0) {
-            gen_helper_fsgnj_s(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);  
-        } else if (rm == 0x1) {
-            gen_helper_fsgnjn_s(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);  
-        } else if (rm == 0x2) {
-            gen_helper_fsgnjx_s(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);  
-        } else {
-            kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
-        }
+        gen_fsgnj(ctx, rd, rs1, rs2, rm, (uint32_t)INT32_MIN);
         break;
     case OPC_RISC_FMIN_S:
         // also handles: OPC_RISC_FMAX_S
         if (rm == 0x0) {
-            gen_helper_fmin_s(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, cpu_fpr[rd], FP_CMP_MIN, rs1, rs2, false);
         } else if (rm == 0x1) {
-            gen_helper_fmax_s(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, cpu_fpr[rd], FP_CMP_MAX, rs1, rs2, false);
         } else {
             kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         }
@@ -1762,11 +1800,11 @@ inline static void gen_fp_arith(DisasContext *ctx, uint32_t opc,
     case OPC_RISC_FEQ_S:
         // also handles: OPC_RISC_FLT_S, OPC_RISC_FLE_S
         if (rm == 0x0) {
-            gen_helper_fle_s(write_int_rd, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, write_int_rd, FP_CMP_LE, rs1, rs2, false);
         } else if (rm == 0x1) {
-            gen_helper_flt_s(write_int_rd, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, write_int_rd, FP_CMP_LT, rs1, rs2, false);
         } else if (rm == 0x2) {
-            gen_helper_feq_s(write_int_rd, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, write_int_rd, FP_CMP_EQ, rs1, rs2, false);
         } else {
             kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         }
@@ -1810,7 +1848,7 @@ inline static void gen_fp_arith(DisasContext *ctx, uint32_t opc,
         if (rm == 0x0) { // FMV
             tcg_gen_ext32s_tl(write_int_rd, cpu_fpr[rs1]);
         } else if (rm == 0x1) {
-            gen_helper_fclass_s(write_int_rd, cpu_env, cpu_fpr[rs1]);
+            gen_fclass(write_int_rd, rs1, false);
         } else {
             kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         }
@@ -1837,22 +1875,14 @@ inline static void gen_fp_arith(DisasContext *ctx, uint32_t opc,
         break;
     case OPC_RISC_FSGNJ_D:
         // also OPC_RISC_FSGNJN_D, OPC_RISC_FSGNJX_D  
-        if (rm == 0x0) {
-            gen_helper_fsgnj_d(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);  
-        } else if (rm == 0x1) {
-            gen_helper_fsgnjn_d(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);  
-        } else if (rm == 0x2) {
-            gen_helper_fsgnjx_d(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);  
-        } else {
-            kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
-        }
+        gen_fsgnj(ctx, rd, rs1, rs2, rm, INT64_MIN);
         break;
     case OPC_RISC_FMIN_D:
         // also OPC_RISC_FMAX_D    
         if (rm == 0x0) {
-            gen_helper_fmin_d(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, cpu_fpr[rd], FP_CMP_MIN, rs1, rs2, true);
         } else if (rm == 0x1) {
-            gen_helper_fmax_d(cpu_fpr[rd], cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, cpu_fpr[rd], FP_CMP_MAX, rs1, rs2, true);
         } else {
             kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         }
@@ -1877,11 +1907,11 @@ inline static void gen_fp_arith(DisasContext *ctx, uint32_t opc,
     case OPC_RISC_FEQ_D:
         // also OPC_RISC_FLT_D, OPC_RISC_FLE_D     
         if (rm == 0x0) {
-            gen_helper_fle_d(write_int_rd, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, write_int_rd, FP_CMP_LE, rs1, rs2, true);
         } else if (rm == 0x1) {
-            gen_helper_flt_d(write_int_rd, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, write_int_rd, FP_CMP_LT, rs1, rs2, true);
         } else if (rm == 0x2) {
-            gen_helper_feq_d(write_int_rd, cpu_env, cpu_fpr[rs1], cpu_fpr[rs2]);
+            gen_fp_cmp(ctx, write_int_rd, FP_CMP_EQ, rs1, rs2, true);
         } else {
             kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         }
@@ -1922,7 +1952,7 @@ inline static void gen_fp_arith(DisasContext *ctx, uint32_t opc,
         if (rm == 0x0) { // FMV
             tcg_gen_mov_tl(write_int_rd, cpu_fpr[rs1]);
         } else if (rm == 0x1) {
-            gen_helper_fclass_d(write_int_rd, cpu_env, cpu_fpr[rs1]);
+            gen_fclass(write_int_rd, rs1, true);
         } else {
             kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
         }
@@ -1940,134 +1970,459 @@ inline static void gen_fp_arith(DisasContext *ctx, uint32_t opc,
     tcg_temp_free(write_int_rd);
 }
 
-#define GET_B_IMM(inst)              ((int16_t)((((inst >> 25) & 0x3F) << 5) | ((((int32_t)inst) >> 31) << 12) | (((inst >> 8) & 0xF) << 1) | (((inst >> 7) & 0x1) << 11)))  /* THIS BUILDS 13 bit imm (implicit zero is tacked on here), also note that bit #12 is obtained in a special way to get sign extension */
-#define GET_STORE_IMM(inst)           ((int16_t)(((((int32_t)inst) >> 25) << 5) | ((inst >> 7) & 0x1F)))
-#define GET_JAL_IMM(inst)             ((int32_t)((inst & 0xFF000) | (((inst >> 20) & 0x1) << 11) | (((inst >> 21) & 0x3FF) << 1) | ((((int32_t)inst) >> 31) << 20)))
-#define GET_RM(inst)                  ((inst >> 12) & 0x7)
-#define GET_RS3(inst)                 ((inst >> 27) & 0x1F)
-static void decode_opc (CPURISCVState *env, DisasContext *ctx)
-{
+/* Instruction formats. Each major opcode has one, which says how the
+ * operand fields are pulled out of the instruction word. */
+typedef enum {
+    FMT_R,      /* rd, rs1, rs2 */
+    FMT_R4,     /* rd, rs1, rs2, rs3, rm */
+    FMT_I,      /* rd, rs1, imm[11:0] */
+    FMT_S,      /* rs1, rs2, imm[11:5|4:0] */
+    FMT_B,      /* rs1, rs2, branch offset */
+    FMT_U,      /* rd, imm[31:12] */
+    FMT_J,      /* rd, jump offset */
+    FMT_SYS,    /* rd, rs1, csr number in imm */
+} DisasFormat;
+
+typedef struct {
+    int rd;
     int rs1;
     int rs2;
-    int rd;
-    uint32_t op;
-    int16_t imm;
-    target_ulong ubimm;
+    int rs3;
+    int rm;
+    target_long imm;
+} DisasArgs;
+
+/* One entry per major opcode. The generator gets the major opcode
+ * combined with the bits selected by sub_mask (funct3, funct7, ...),
+ * which is what the OPC_RISC_* case labels are built from. */
+typedef struct {
+    void (*gen)(DisasContext *ctx, uint32_t opc, const DisasArgs *a);
+    uint32_t sub_mask;
+    DisasFormat fmt;
+    /* the instruction has no effect other than writing rd, so it is a
+     * nop when rd is x0 */
+    bool nop_if_rd_zero;
+} DisasOp;
+
+#define FUNCT3          (0x7 << 12)
+#define FUNCT7          (0x7F << 25)
+
+static void trans_lui(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    tcg_gen_movi_tl(cpu_gpr[a->rd], a->imm);
+}
 
-    /* make sure instructions are on a word boundary */
-    if (unlikely(ctx->pc & 0x3)) { 
-        // NOT tested for RISCV
-        printf("misaligned instruction, not yet implemented for riscv\n");
-        exit(1);
-        return;
+static void trans_auipc(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    tcg_gen_movi_tl(cpu_gpr[a->rd], ctx->pc + a->imm);
+}
+
+static void trans_jal(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    if (a->rd != 0) {
+        tcg_gen_movi_tl(cpu_gpr[a->rd], ctx->next_pc);
     }
+    if (a->rd == 1) {
+        gen_ras_push(ctx->next_pc);
+    }
+#ifdef DISABLE_CHAINING_JAL
+    gen_instret_add(ctx, ctx->num_insns);
+    tcg_gen_movi_tl(cpu_PC, ctx->pc + a->imm);
+    gen_tb_exit_count(RISCV_TB_EXIT_NOCHAIN);
+    tcg_gen_exit_tb(0);
+#else
+    gen_goto_tb(ctx, 0, ctx->pc + a->imm); // must use this for safety
+#endif
+    ctx->bstate = BS_BRANCH;
+}
 
-    op = MASK_OP_MAJOR(ctx->opcode);
-    rs1 = (ctx->opcode >> 15) & 0x1f;
-    rs2 = (ctx->opcode >> 20) & 0x1f;
-    rd = (ctx->opcode >> 7) & 0x1f;
-    imm = (int16_t)(((int32_t)ctx->opcode) >> 20); /* sign extends */
-    switch (op) {
+static void trans_jalr(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_jalr(ctx, opc, a->rd, a->rs1, a->imm);
+}
 
-    case OPC_RISC_LUI:
-        if (rd == 0) {
-            break; // NOP
-        }
-        tcg_gen_movi_tl(cpu_gpr[rd], (ctx->opcode & 0xFFFFF000));
-        tcg_gen_ext32s_tl(cpu_gpr[rd], cpu_gpr[rd]);
+static void trans_branch(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_branch(ctx, opc, a->rs1, a->rs2, a->imm);
+}
+
+static void trans_load(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_load(ctx, opc, a->rd, a->rs1, a->imm);
+}
+
+static void trans_store(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_store(ctx, opc, a->rs1, a->rs2, a->imm);
+}
+
+static void trans_arith_imm(DisasContext *ctx, uint32_t opc,
+                            const DisasArgs *a)
+{
+    gen_arith_imm(ctx, opc, a->rd, a->rs1, a->imm);
+}
+
+static void trans_arith(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_arith(ctx, opc, a->rd, a->rs1, a->rs2);
+}
+
+static void trans_arith_imm_w(DisasContext *ctx, uint32_t opc,
+                              const DisasArgs *a)
+{
+    gen_arith_imm_w(ctx, opc, a->rd, a->rs1, a->imm);
+}
+
+static void trans_arith_w(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_arith_w(ctx, opc, a->rd, a->rs1, a->rs2);
+}
+
+static void trans_fence(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    /* fences are nops for us */
+}
+
+static void trans_system(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_system(ctx, opc, a->rd, a->rs1, a->imm);
+}
+
+static void trans_atomic(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_atomic(ctx, opc, a->rd, a->rs1, a->rs2);
+}
+
+static void trans_fp_load(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_fp_load(ctx, opc, a->rd, a->rs1, a->imm);
+}
+
+static void trans_fp_store(DisasContext *ctx, uint32_t opc,
+                           const DisasArgs *a)
+{
+    gen_fp_store(ctx, opc, a->rs1, a->rs2, a->imm);
+}
+
+static void trans_fmadd(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_fp_fmadd(ctx, opc, a->rd, a->rs1, a->rs2, a->rs3, a->rm);
+}
+
+static void trans_fmsub(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_fp_fmsub(ctx, opc, a->rd, a->rs1, a->rs2, a->rs3, a->rm);
+}
+
+static void trans_fnmsub(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_fp_fnmsub(ctx, opc, a->rd, a->rs1, a->rs2, a->rs3, a->rm);
+}
+
+static void trans_fnmadd(DisasContext *ctx, uint32_t opc, const DisasArgs *a)
+{
+    gen_fp_fnmadd(ctx, opc, a->rd, a->rs1, a->rs2, a->rs3, a->rm);
+}
+
+static void trans_fp_arith(DisasContext *ctx, uint32_t opc,
+                           const DisasArgs *a)
+{
+    gen_fp_arith(ctx, opc, a->rd, a->rs1, a->rs2, a->rm);
+}
+
+/* Indexed by bits 6:2 of the instruction; bits 1:0 are 11 for every
+ * 32-bit instruction. Empty slots are illegal instructions. */
+static const DisasOp riscv_major_ops[32] = {
+    [OPC_RISC_LUI >> 2]         = { trans_lui, 0, FMT_U, true },
+    [OPC_RISC_AUIPC >> 2]       = { trans_auipc, 0, FMT_U, true },
+    [OPC_RISC_JAL >> 2]         = { trans_jal, 0, FMT_J, false },
+    [OPC_RISC_JALR >> 2]        = { trans_jalr, FUNCT3, FMT_I, false },
+    [OPC_RISC_BRANCH >> 2]      = { trans_branch, FUNCT3, FMT_B, false },
+    [OPC_RISC_LOAD >> 2]        = { trans_load, FUNCT3, FMT_I, false },
+    [OPC_RISC_STORE >> 2]       = { trans_store, FUNCT3, FMT_S, false },
+    [OPC_RISC_ARITH_IMM >> 2]   = { trans_arith_imm, FUNCT3, FMT_I, true },
+    [OPC_RISC_ARITH >> 2]       = { trans_arith, FUNCT3 | FUNCT7, FMT_R,
+                                    true },
+    [OPC_RISC_ARITH_IMM_W >> 2] = { trans_arith_imm_w, FUNCT3, FMT_I, true },
+    [OPC_RISC_ARITH_W >> 2]     = { trans_arith_w, FUNCT3 | FUNCT7, FMT_R,
+                                    true },
+    [OPC_RISC_FENCE >> 2]       = { trans_fence, 0, FMT_I, false },
+    [OPC_RISC_SYSTEM >> 2]      = { trans_system, FUNCT3, FMT_SYS, false },
+    [OPC_RISC_ATOMIC >> 2]      = { trans_atomic, FUNCT3 | FUNCT7, FMT_R,
+                                    false },
+    [OPC_RISC_FP_LOAD >> 2]     = { trans_fp_load, FUNCT3, FMT_I, false },
+    [OPC_RISC_FP_STORE >> 2]    = { trans_fp_store, FUNCT3, FMT_S, false },
+    [OPC_RISC_FMADD >> 2]       = { trans_fmadd, 0x3 << 25, FMT_R4, false },
+    [OPC_RISC_FMSUB >> 2]       = { trans_fmsub, 0x3 << 25, FMT_R4, false },
+    [OPC_RISC_FNMSUB >> 2]      = { trans_fnmsub, 0x3 << 25, FMT_R4, false },
+    [OPC_RISC_FNMADD >> 2]      = { trans_fnmadd, 0x3 << 25, FMT_R4, false },
+    [OPC_RISC_FP_ARITH >> 2]    = { trans_fp_arith, FUNCT7, FMT_R4, false },
+};
+
+static inline void decode_format(DisasFormat fmt, uint32_t insn,
+                                 DisasArgs *a)
+{
+    a->rd = (insn >> 7) & 0x1f;
+    a->rs1 = (insn >> 15) & 0x1f;
+    a->rs2 = (insn >> 20) & 0x1f;
+
+    switch (fmt) {
+    case FMT_R:
         break;
-    case OPC_RISC_AUIPC:
-        if (rd == 0) {
-            break; // NOP
-        }
-        tcg_gen_movi_tl(cpu_gpr[rd], (ctx->opcode & 0xFFFFF000));
-        tcg_gen_ext32s_tl(cpu_gpr[rd], cpu_gpr[rd]);
-        tcg_gen_add_tl(cpu_gpr[rd], cpu_gpr[rd], tcg_const_tl(ctx->pc));
+    case FMT_R4:
+        a->rs3 = (insn >> 27) & 0x1f;
+        a->rm = (insn >> 12) & 0x7;
         break;
-    case OPC_RISC_JAL:
-        ubimm = (target_long) (GET_JAL_IMM(ctx->opcode));
-        if (rd != 0) {
-            tcg_gen_movi_tl(cpu_gpr[rd], 4);
-            tcg_gen_addi_tl(cpu_gpr[rd], cpu_gpr[rd], ctx->pc);
-        }
-#ifdef DISABLE_CHAINING_JAL
-        tcg_gen_movi_tl(cpu_PC, ctx->pc + ubimm);
-        tcg_gen_exit_tb(0);
-#else
-        gen_goto_tb(ctx, 0, ctx->pc + ubimm); // must use this for safety
-#endif
-        ctx->bstate = BS_BRANCH;
+    case FMT_I:
+        a->imm = (int32_t)insn >> 20;
         break;
-    case OPC_RISC_JALR:
-        gen_jalr(ctx, MASK_OP_JALR(ctx->opcode), rd, rs1, imm);
+    case FMT_S:
+        a->imm = (((int32_t)insn >> 25) << 5) | ((insn >> 7) & 0x1f);
         break;
-    case OPC_RISC_BRANCH:
-        gen_branch(ctx, MASK_OP_BRANCH(ctx->opcode), rs1, rs2, GET_B_IMM(ctx->opcode));
+    case FMT_B:
+        a->imm = (((int32_t)insn >> 31) << 12) | (((insn >> 7) & 0x1) << 11) |
+                 (((insn >> 25) & 0x3f) << 5) | (((insn >> 8) & 0xf) << 1);
         break;
-    case OPC_RISC_LOAD:
-        gen_load(ctx, MASK_OP_LOAD(ctx->opcode), rd, rs1, imm);
+    case FMT_U:
+        a->imm = (int32_t)(insn & 0xfffff000);
         break;
-    case OPC_RISC_STORE:
-        gen_store(ctx, MASK_OP_STORE(ctx->opcode), rs1, rs2, GET_STORE_IMM(ctx->opcode));
+    case FMT_J:
+        a->imm = (((int32_t)insn >> 31) << 20) | (insn & 0xff000) |
+                 (((insn >> 20) & 0x1) << 11) | (((insn >> 21) & 0x3ff) << 1);
         break;
-    case OPC_RISC_ARITH_IMM:
-        if (rd == 0) {
-            break; // NOP
-        }
-        gen_arith_imm(ctx, MASK_OP_ARITH_IMM(ctx->opcode), rd, rs1, imm);
+    case FMT_SYS:
+        a->imm = insn >> 20;
         break;
-    case OPC_RISC_ARITH:
+    }
+}
+
+/* Compressed (RVC) instructions
+ *
+ * A 16-bit instruction is expanded to the 32-bit instruction it stands for
+ * and then goes through the normal decoder, so it shares all of the gen_*
+ * code; only ctx->next_pc tells the two apart. The encoding is that of the
+ * C extension, including x2 as the implicit stack pointer of c.addi4spn,
+ * c.addi16sp and the c.*sp loads and stores, whatever register the ABI of
+ * the rest of the code uses as sp (RISCV_REG_SP). Reserved encodings
+ * expand to 0, which decode_opc rejects as illegal.
+ */
+#define RVC_REG(x)  (8 + ((x) & 0x7))
+#define RVC_REG_SP  2
+
+static inline uint32_t rvc_i(uint32_t opc, int rd, int rs1, int32_t imm)
+{
+    return opc | (rd << 7) | (rs1 << 15) | ((uint32_t)imm << 20);
+}
+
+static inline uint32_t rvc_s(uint32_t opc, int rs1, int rs2, int32_t imm)
+{
+    return opc | ((imm & 0x1f) << 7) | (rs1 << 15) | (rs2 << 20) |
+           ((uint32_t)(imm >> 5) << 25);
+}
+
+static inline uint32_t rvc_r(uint32_t opc, int rd, int rs1, int rs2)
+{
+    return opc | (rd << 7) | (rs1 << 15) | (rs2 << 20);
+}
+
+static inline uint32_t rvc_b(uint32_t opc, int rs1, int32_t imm)
+{
+    return opc | (((imm >> 11) & 0x1) << 7) | (((imm >> 1) & 0xf) << 8) |
+           (rs1 << 15) | (((imm >> 5) & 0x3f) << 25) |
+           ((uint32_t)((imm >> 12) & 0x1) << 31);
+}
+
+static inline uint32_t rvc_j(int rd, int32_t imm)
+{
+    return OPC_RISC_JAL | (rd << 7) | (imm & 0xff000) |
+           (((imm >> 11) & 0x1) << 20) | (((imm >> 1) & 0x3ff) << 21) |
+           ((uint32_t)((imm >> 20) & 0x1) << 31);
+}
+
+static uint32_t expand_rvc(uint32_t c)
+{
+    int rd = extract32(c, 7, 5);       /* also rs1 of the two-operand forms */
+    int rs2 = extract32(c, 2, 5);
+    int rd_c = RVC_REG(extract32(c, 2, 3));  /* rd' / rs2' */
+    int rs1_c = RVC_REG(extract32(c, 7, 3)); /* rs1' / rd' */
+    int32_t imm6 = (sextract32(c, 12, 1) << 5) | extract32(c, 2, 5);
+    int shamt = (extract32(c, 12, 1) << 5) | extract32(c, 2, 5);
+    int32_t imm;
+
+    switch (((c & 0x3) << 3) | extract32(c, 13, 3)) {
+    /* quadrant 0 */
+    case 0x00: /* C.ADDI4SPN */
+        imm = (extract32(c, 6, 1) << 2) | (extract32(c, 5, 1) << 3) |
+              (extract32(c, 11, 2) << 4) | (extract32(c, 7, 4) << 6);
+        if (imm == 0) {
+            return 0;
+        }
+        return rvc_i(OPC_RISC_ADDI, rd_c, RVC_REG_SP, imm);
+    case 0x01: /* C.FLD */
+        imm = (extract32(c, 10, 3) << 3) | (extract32(c, 5, 2) << 6);
+        return rvc_i(OPC_RISC_FLD, rd_c, rs1_c, imm);
+    case 0x02: /* C.LW */
+        imm = (extract32(c, 6, 1) << 2) | (extract32(c, 10, 3) << 3) |
+              (extract32(c, 5, 1) << 6);
+        return rvc_i(OPC_RISC_LW, rd_c, rs1_c, imm);
+    case 0x03: /* C.LD */
+        imm = (extract32(c, 10, 3) << 3) | (extract32(c, 5, 2) << 6);
+        return rvc_i(OPC_RISC_LD, rd_c, rs1_c, imm);
+    case 0x05: /* C.FSD */
+        imm = (extract32(c, 10, 3) << 3) | (extract32(c, 5, 2) << 6);
+        return rvc_s(OPC_RISC_FSD, rs1_c, rd_c, imm);
+    case 0x06: /* C.SW */
+        imm = (extract32(c, 6, 1) << 2) | (extract32(c, 10, 3) << 3) |
+              (extract32(c, 5, 1) << 6);
+        return rvc_s(OPC_RISC_SW, rs1_c, rd_c, imm);
+    case 0x07: /* C.SD */
+        imm = (extract32(c, 10, 3) << 3) | (extract32(c, 5, 2) << 6);
+        return rvc_s(OPC_RISC_SD, rs1_c, rd_c, imm);
+
+    /* quadrant 1 */
+    case 0x08: /* C.ADDI, C.NOP */
+        return rvc_i(OPC_RISC_ADDI, rd, rd, imm6);
+    case 0x09: /* C.ADDIW */
         if (rd == 0) {
-            break; // NOP
+            return 0;
         }
-        gen_arith(ctx, MASK_OP_ARITH(ctx->opcode), rd, rs1, rs2);
-        break;
-    case OPC_RISC_ARITH_IMM_W:
+        return rvc_i(OPC_RISC_ADDIW, rd, rd, imm6);
+    case 0x0a: /* C.LI */
+        return rvc_i(OPC_RISC_ADDI, rd, 0, imm6);
+    case 0x0b:
+        if (rd == 2) { /* C.ADDI16SP */
+            imm = (extract32(c, 6, 1) << 4) | (extract32(c, 2, 1) << 5) |
+                  (extract32(c, 5, 1) << 6) | (extract32(c, 3, 2) << 7) |
+                  (sextract32(c, 12, 1) << 9);
+            if (imm == 0) {
+                return 0;
+            }
+            return rvc_i(OPC_RISC_ADDI, RVC_REG_SP, RVC_REG_SP, imm);
+        }
+        /* C.LUI */
+        if (rd == 0 || imm6 == 0) {
+            return 0;
+        }
+        return OPC_RISC_LUI | (rd << 7) | ((uint32_t)imm6 << 12);
+    case 0x0c:
+        switch (extract32(c, 10, 2)) {
+        case 0: /* C.SRLI */
+            return rvc_i(OPC_RISC_SHIFT_RIGHT_I, rs1_c, rs1_c, shamt);
+        case 1: /* C.SRAI */
+            return rvc_i(OPC_RISC_SHIFT_RIGHT_I, rs1_c, rs1_c, shamt | 0x400);
+        case 2: /* C.ANDI */
+            return rvc_i(OPC_RISC_ANDI, rs1_c, rs1_c, imm6);
+        }
+        switch ((extract32(c, 12, 1) << 2) | extract32(c, 5, 2)) {
+        case 0: /* C.SUB */
+            return rvc_r(OPC_RISC_SUB, rs1_c, rs1_c, rd_c);
+        case 1: /* C.XOR */
+            return rvc_r(OPC_RISC_XOR, rs1_c, rs1_c, rd_c);
+        case 2: /* C.OR */
+            return rvc_r(OPC_RISC_OR, rs1_c, rs1_c, rd_c);
+        case 3: /* C.AND */
+            return rvc_r(OPC_RISC_AND, rs1_c, rs1_c, rd_c);
+        case 4: /* C.SUBW */
+            return rvc_r(OPC_RISC_SUBW, rs1_c, rs1_c, rd_c);
+        case 5: /* C.ADDW */
+            return rvc_r(OPC_RISC_ADDW, rs1_c, rs1_c, rd_c);
+        }
+        return 0;
+    case 0x0d: /* C.J */
+        imm = (extract32(c, 3, 3) << 1) | (extract32(c, 11, 1) << 4) |
+              (extract32(c, 2, 1) << 5) | (extract32(c, 7, 1) << 6) |
+              (extract32(c, 6, 1) << 7) | (extract32(c, 9, 2) << 8) |
+              (extract32(c, 8, 1) << 10) | (sextract32(c, 12, 1) << 11);
+        return rvc_j(0, imm);
+    case 0x0e: /* C.BEQZ */
+    case 0x0f: /* C.BNEZ */
+        imm = (extract32(c, 3, 2) << 1) | (extract32(c, 10, 2) << 3) |
+              (extract32(c, 2, 1) << 5) | (extract32(c, 5, 2) << 6) |
+              (sextract32(c, 12, 1) << 8);
+        return rvc_b(c & (1 << 13) ? OPC_RISC_BNE : OPC_RISC_BEQ, rs1_c, imm);
+
+    /* quadrant 2 */
+    case 0x10: /* C.SLLI */
+        return rvc_i(OPC_RISC_SLLI, rd, rd, shamt);
+    case 0x11: /* C.FLDSP */
+        imm = (extract32(c, 5, 2) << 3) | (extract32(c, 12, 1) << 5) |
+              (extract32(c, 2, 3) << 6);
+        return rvc_i(OPC_RISC_FLD, rd, RVC_REG_SP, imm);
+    case 0x12: /* C.LWSP */
         if (rd == 0) {
-            break; // NOP
+            return 0;
         }
-        gen_arith_imm_w(ctx, MASK_OP_ARITH_IMM_W(ctx->opcode), rd, rs1, imm);
-        break;
-    case OPC_RISC_ARITH_W:
+        imm = (extract32(c, 4, 3) << 2) | (extract32(c, 12, 1) << 5) |
+              (extract32(c, 2, 2) << 6);
+        return rvc_i(OPC_RISC_LW, rd, RVC_REG_SP, imm);
+    case 0x13: /* C.LDSP */
         if (rd == 0) {
-            break; // NOP
+            return 0;
         }
-        gen_arith_w(ctx, MASK_OP_ARITH_W(ctx->opcode), rd, rs1, rs2);
-        break;
-    case OPC_RISC_FENCE:
-        /* fences are nops for us */
-        break;
-    case OPC_RISC_SYSTEM:
-        gen_system(ctx, MASK_OP_SYSTEM(ctx->opcode), rd, rs1, (ctx->opcode & 0xFFF00000) >> 20);
-        break;
-    case OPC_RISC_ATOMIC:
-        gen_atomic(ctx, MASK_OP_ATOMIC(ctx->opcode), rd, rs1, rs2);
-        break;        
-    case OPC_RISC_FP_LOAD:
-        gen_fp_load(ctx, MASK_OP_FP_LOAD(ctx->opcode), rd, rs1, imm);
-        break;
-    case OPC_RISC_FP_STORE:
-        gen_fp_store(ctx, MASK_OP_FP_STORE(ctx->opcode), rs1, rs2, GET_STORE_IMM(ctx->opcode));
-        break;
-    case OPC_RISC_FMADD:
-        gen_fp_fmadd(ctx, MASK_OP_FP_FMADD(ctx->opcode), rd, rs1, rs2, GET_RS3(ctx->opcode), GET_RM(ctx->opcode));
-        break;
-    case OPC_RISC_FMSUB:
-        gen_fp_fmsub(ctx, MASK_OP_FP_FMSUB(ctx->opcode), rd, rs1, rs2, GET_RS3(ctx->opcode), GET_RM(ctx->opcode));
-        break;
-    case OPC_RISC_FNMSUB:
-        gen_fp_fnmsub(ctx, MASK_OP_FP_FNMSUB(ctx->opcode), rd, rs1, rs2, GET_RS3(ctx->opcode), GET_RM(ctx->opcode));
-        break;
-    case OPC_RISC_FNMADD:
-        gen_fp_fnmadd(ctx, MASK_OP_FP_FNMADD(ctx->opcode), rd, rs1, rs2, GET_RS3(ctx->opcode), GET_RM(ctx->opcode));
-        break;
-    case OPC_RISC_FP_ARITH:
-        gen_fp_arith(ctx, MASK_OP_FP_ARITH(ctx->opcode), rd, rs1, rs2, GET_RM(ctx->opcode));
-        break;
-    default:
+        imm = (extract32(c, 5, 2) << 3) | (extract32(c, 12, 1) << 5) |
+              (extract32(c, 2, 3) << 6);
+        return rvc_i(OPC_RISC_LD, rd, RVC_REG_SP, imm);
+    case 0x14:
+        if (!(c & (1 << 12))) {
+            if (rs2 != 0) { /* C.MV */
+                return rvc_r(OPC_RISC_ADD, rd, 0, rs2);
+            }
+            if (rd == 0) {
+                return 0;
+            }
+            /* C.JR */
+            return rvc_i(OPC_RISC_JALR, 0, rd, 0);
+        }
+        if (rs2 != 0) { /* C.ADD */
+            return rvc_r(OPC_RISC_ADD, rd, rd, rs2);
+        }
+        if (rd == 0) { /* C.EBREAK */
+            return rvc_i(OPC_RISC_SBREAK, 0, 0, 1);
+        }
+        /* C.JALR */
+        return rvc_i(OPC_RISC_JALR, RISCV_REG_RA, rd, 0);
+    case 0x15: /* C.FSDSP */
+        imm = (extract32(c, 10, 3) << 3) | (extract32(c, 7, 3) << 6);
+        return rvc_s(OPC_RISC_FSD, RVC_REG_SP, rs2, imm);
+    case 0x16: /* C.SWSP */
+        imm = (extract32(c, 9, 4) << 2) | (extract32(c, 7, 2) << 6);
+        return rvc_s(OPC_RISC_SW, RVC_REG_SP, rs2, imm);
+    case 0x17: /* C.SDSP */
+        imm = (extract32(c, 10, 3) << 3) | (extract32(c, 7, 3) << 6);
+        return rvc_s(OPC_RISC_SD, RVC_REG_SP, rs2, imm);
+    }
+    return 0;
+}
+
+static void decode_opc (CPURISCVState *env, DisasContext *ctx)
+{
+    uint32_t insn = ctx->opcode;
+    const DisasOp *op;
+    DisasArgs a;
+
+    /* make sure instructions are on a halfword boundary */
+    if (unlikely(ctx->pc & 0x1)) { 
+        // NOT tested for RISCV
+        printf("misaligned instruction, not yet implemented for riscv\n");
+        exit(1);
+        return;
+    }
+
+    if ((insn & 0x3) != 0x3) {
+        insn = expand_rvc(insn);
+    }
+    op = &riscv_major_ops[(insn >> 2) & 0x1f];
+    if (unlikely((insn & 0x3) != 0x3 || op->gen == NULL)) {
         kill_unknown(ctx, RISCV_EXCP_ILLEGAL_INST);
-        break;
+        return;
+    }
+
+    decode_format(op->fmt, insn, &a);
+    if (op->nop_if_rd_zero && a.rd == 0) {
+        return;
     }
+    op->gen(ctx, MASK_OP_MAJOR(insn) | (insn & op->sub_mask), &a);
+    gen_free_operands(ctx);
 }
 
 static inline void
@@ -2083,8 +2438,11 @@ gen_intermediate_code_internal(RISCVCPU *cpu, TranslationBlock *tb,
     int j, lj = -1;
     int num_insns;
     int max_insns;
+    int64_t start_ns = 0;
     if (search_pc) {
         qemu_log("search pc %d\n", search_pc);
+    } else {
+        start_ns = get_clock();
     }
     pc_start = tb->pc;
     gen_opc_end = tcg_ctx.gen_opc_buf + OPC_MAX_SIZE;
@@ -2092,10 +2450,12 @@ gen_intermediate_code_internal(RISCVCPU *cpu, TranslationBlock *tb,
     ctx.singlestep_enabled = cs->singlestep_enabled;
     ctx.tb = tb;
     ctx.bstate = BS_NONE;
+    ctx.count_insns = cpu->icount_counters;
+    ctx.num_insns = 0;
 #ifdef CONFIG_USER_ONLY
         ctx.mem_idx = 0;
 #else
-        ctx.mem_idx = env->helper_csr[CSR_STATUS] & SR_S;
+        ctx.mem_idx = tb->flags; // cpu_mmu_index, see cpu_get_tb_cpu_state
 #endif
     num_insns = 0;
     max_insns = tb->cflags & CF_COUNT_MASK;
@@ -2104,15 +2464,27 @@ gen_intermediate_code_internal(RISCVCPU *cpu, TranslationBlock *tb,
     }
     gen_tb_start();
     while (ctx.bstate == BS_NONE) {
+        // A 32-bit instruction in the last halfword of a page continues on
+        // the next one, and fetching that half may fault. Give it a TB of
+        // its own, so that the fault is taken with PC at the instruction
+        // and not at the start of a TB that has already run part-way.
+        if (num_insns > 0 &&
+            (ctx.pc & (TARGET_PAGE_SIZE - 1)) == TARGET_PAGE_SIZE - 2 &&
+            (cpu_lduw_code(env, ctx.pc) & 0x3) == 0x3) {
+            break;
+        }
         if (unlikely(!QTAILQ_EMPTY(&cs->breakpoints))) {
             QTAILQ_FOREACH(bp, &cs->breakpoints, entry) {
                 if (bp->pc == ctx.pc) {
+                    gen_instret_add(&ctx, num_insns);
                     tcg_gen_movi_tl(cpu_PC, ctx.pc);
                     ctx.bstate = BS_BRANCH;
                     TCGv_i32 helper_tmp = tcg_const_i32(EXCP_DEBUG);
                     gen_helper_raise_exception(cpu_env, helper_tmp);
                     tcg_temp_free_i32(helper_tmp);
-                    ctx.pc += 4;
+                    // cover the breakpoint, but do not reach into the
+                    // next page, which may not be mapped
+                    ctx.pc += 2;
                     goto done_generating;
                 }
             }
@@ -2133,13 +2505,23 @@ gen_intermediate_code_internal(RISCVCPU *cpu, TranslationBlock *tb,
             gen_io_start();
         }
 
-        ctx.opcode = cpu_ldl_code(env, ctx.pc);
+        // fetch by halfwords: with RVC a 32-bit instruction need only be
+        // 2-byte aligned
+        ctx.opcode = cpu_lduw_code(env, ctx.pc);
+        if ((ctx.opcode & 0x3) == 0x3) {
+            ctx.opcode |= (uint32_t)cpu_lduw_code(env, ctx.pc + 2) << 16;
+            ctx.next_pc = ctx.pc + 4;
+        } else {
+            ctx.next_pc = ctx.pc + 2;
+        }
+        ctx.num_insns = num_insns + 1;
         decode_opc(env, &ctx);
-        ctx.pc += 4;
+        ctx.pc = ctx.next_pc;
         num_insns++;
 
-        if (unlikely((ctx.pc & (TARGET_PAGE_SIZE - 1)) == 0)) { 
-            // handle tb at the end of a page
+        if (unlikely((ctx.pc ^ pc_start) & TARGET_PAGE_MASK)) {
+            // handle tb at the end of a page, or after an instruction
+            // that straddles two
             break;
         }
         if (unlikely(tcg_ctx.gen_opc_ptr >= gen_opc_end)) {
@@ -2162,9 +2544,10 @@ gen_intermediate_code_internal(RISCVCPU *cpu, TranslationBlock *tb,
         gen_goto_tb(&ctx, 0, ctx.pc);
         break;
     case BS_NONE:
-        // DO NOT CHAIN. This is for END-OF-PAGE. See gen_goto_tb.
-        tcg_gen_movi_tl(cpu_PC, ctx.pc); // NOT PC+4, that was already done
-        tcg_gen_exit_tb(0);
+        // end of page, or the TB is full: fall through to ctx.pc (NOT
+        // next_pc, that was already done). gen_goto_tb looks the next page
+        // up.
+        gen_goto_tb(&ctx, 0, ctx.pc);
         break;
     case BS_BRANCH:
     default:
@@ -2181,6 +2564,13 @@ done_generating:
     } else {
         tb->size = ctx.pc - pc_start;
         tb->icount = num_insns;
+        env->tr_tb++;
+        env->tr_insns += num_insns;
+        env->tr_ops += tcg_ctx.gen_opc_ptr - tcg_ctx.gen_opc_buf;
+        env->tr_ns += get_clock() - start_ns;
+        if (!env->first_tb_ns) {
+            env->first_tb_ns = start_ns;
+        }
     }
 #ifdef DEBUG_DISAS // TODO: riscv disassembly
     LOG_DISAS("\n");
@@ -2226,7 +2616,7 @@ void riscv_cpu_dump_state(CPUState *cs, FILE *f, fprintf_function cpu_fprintf,
         if (i == CSR_COUNT) {
             cpu_fprintf(f, " %s " TARGET_FMT_lx, cs_regnames[i], (target_ulong)cpu_riscv_get_count(env));
 
-        } else if (i == CSR_CYCLE) {
+        } else if (i == CSR_CYCLE || i == CSR_TIME || i == CSR_INSTRET) {
             cpu_fprintf(f, " %s " TARGET_FMT_lx, cs_regnames[i], cpu_riscv_get_cycle(env));
         } else if (i == CSR_FCSR) {
              cpu_fprintf(f, " %s " TARGET_FMT_lx, cs_regnames[i], env->helper_csr[CSR_FFLAGS] | (env->helper_csr[CSR_FRM] << 5));
@@ -2249,6 +2639,70 @@ void riscv_cpu_dump_state(CPUState *cs, FILE *f, fprintf_function cpu_fprintf,
     }
 }
 
+void riscv_cpu_dump_statistics(CPUState *cs, FILE *f,
+                               fprintf_function cpu_fprintf, int flags)
+{
+    RISCVCPU *cpu = RISCV_CPU(cs);
+    CPURISCVState *env = &cpu->env;
+    int i;
+
+    cpu_fprintf(f, "indirect branch TB lookup hit %" PRIu64 " miss %" PRIu64
+                "\n", env->tb_lookup_hit, env->tb_lookup_miss);
+#ifdef RISCV_RAS_STATS
+    cpu_fprintf(f, "return address stack hit %" PRIu64 " miss %" PRIu64 "\n",
+                env->ras_hit, env->ras_miss);
+#endif
+    cpu_fprintf(f, "cross-page jump TB lookup hit %" PRIu64 " miss %" PRIu64
+                "\n", env->xpage_hit, env->xpage_miss);
+    cpu_fprintf(f, "TB lookups resolved by physical address %" PRIu64 "\n",
+                env->tb_lookup_phys);
+    cpu_fprintf(f, "TB exits to main loop: unchained %" PRIu64 " no chaining %"
+                PRIu64 " lookup miss %" PRIu64 " interrupt %" PRIu64 "\n",
+                env->tb_exit[RISCV_TB_EXIT_UNCHAINED],
+                env->tb_exit[RISCV_TB_EXIT_NOCHAIN],
+                env->tb_exit[RISCV_TB_EXIT_LOOKUP_MISS],
+                env->tb_exit[RISCV_TB_EXIT_IRQ]);
+    cpu_fprintf(f, "tlb fill %" PRIu64 " (faults %" PRIu64 ") pte loads %"
+                PRIu64 " walk cache hits %" PRIu64 "\n", env->tlb_fill,
+                env->tlb_fill_fault, env->ptw_load, env->pwc_hit);
+    cpu_fprintf(f, "asid switch %" PRIu64 " (slot recycled %" PRIu64 ")\n",
+                env->asid_switch, env->asid_recycle);
+#ifndef CONFIG_USER_ONLY
+    cpu_fprintf(f, "tlb entries per mmu mode");
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        cpu_fprintf(f, " %zu (%zu used)", tlb_n_entries(env, i),
+                    env->tlb_d[i].n_used_entries);
+    }
+    cpu_fprintf(f, "\n");
+#endif
+    cpu_fprintf(f, "wfi halts %" PRIu64 "\n", env->wfi_halt);
+    cpu_fprintf(f, "translated TBs %" PRIu64 " insns %" PRIu64
+                " (%.1f TCG ops/insn)\n", env->tr_tb, env->tr_insns,
+                env->tr_insns ? (double)env->tr_ops / env->tr_insns : 0.0);
+    if (env->tr_ns) {
+        cpu_fprintf(f, "translation %.0f insns/s (%.1f ns/insn)\n",
+                    env->tr_insns * 1e9 / env->tr_ns,
+                    (double)env->tr_ns / (env->tr_insns ? env->tr_insns : 1));
+    }
+    if (env->boot_start_ns && env->first_tb_ns) {
+        cpu_fprintf(f, "first instruction %.3f ms after board init\n",
+                    (env->first_tb_ns - env->boot_start_ns) / 1e6);
+    }
+    for (i = 0; i < RISCV_EXCP_COUNT; i++) {
+        if (env->excp_count[i]) {
+            cpu_fprintf(f, "exception %-32s %" PRIu64 "\n",
+                        i < ARRAY_SIZE(riscv_excp_names) ?
+                        riscv_excp_names[i] : "unknown", env->excp_count[i]);
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(env->irq_count); i++) {
+        if (env->irq_count[i]) {
+            cpu_fprintf(f, "interrupt %-32d %" PRIu64 "\n", i,
+                        env->irq_count[i]);
+        }
+    }
+}
+
 void riscv_tcg_init(void)
 {
     int i;
@@ -2311,10 +2765,19 @@ void cpu_state_reset(CPURISCVState *env)
     CPUState *cs = CPU(cpu);
 
     env->active_tc.PC = RISCV_START_PC; // STARTING PC VALUE def'd in cpu.h
+    env->load_res = -1;
+    riscv_pwc_flush(env);
+    riscv_asid_slots_reset(env);
+    env->instret = 0;
+    env->helper_csr[CSR_HARTID] = cs->cpu_index;
     cs->exception_index = EXCP_NONE;
 }
 
 void restore_state_to_opc(CPURISCVState *env, TranslationBlock *tb, int pc_pos)
 {
     env->active_tc.PC = tcg_ctx.gen_opc_pc[pc_pos];
+    // a fault inside the TB skipped its exit; count what ran before it
+    if (riscv_env_get_cpu(env)->icount_counters) {
+        env->instret += tcg_ctx.gen_opc_icount[pc_pos];
+    }
 }
@@ -0,0 +1,605 @@
+/*
+ *  Persistent translation block cache
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The host code of the TBs translated by one run is saved to a file when
+ * QEMU exits, and reused instead of retranslating when a later run of the
+ * same binary meets the same guest code again.  A TB is found by its pc,
+ * cs_base and flags, by the hash of the guest page that holds it and by
+ * cpu_tb_cache_config(); its guest bytes are compared as well, so a hash
+ * collision cannot run the wrong code.
+ *
+ * Host addresses in the code are recorded by the backend (TCGHostReloc),
+ * and saved relative to something that is at the same offset in the next
+ * run: the TB, its own code, the prologue or the QEMU executable.  A TB
+ * with any other address in it is not saved.  Loading patches them all,
+ * and falls back to translating when the backend would not have produced
+ * the same instructions at the new place.
+ *
+ * Only the TBs that a run found in the cache or translated are written
+ * back, so the file follows the guest code that is still in use.  Both
+ * the file and the memory that holds it are limited to tb_cache.max_size
+ * bytes of TBs; past that, new translations are not kept.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "qemu-common.h"
+#define NO_CPU_IO_DEFS
+#include "cpu.h"
+#include "tcg.h"
+#include "qemu/bitops.h"
+#include "qemu/error-report.h"
+#include "tb-cache.h"
+
+#ifdef TB_CACHE_SUPPORTED
+#include "exec/ram_addr.h"
+
+#define TB_CACHE_MAGIC   "QEMUTBC"
+#define TB_CACHE_VERSION 2
+
+/* Bounds of the QEMU executable, from the linker */
+extern const char __executable_start[], _end[];
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    char qemu_version[32];
+    /* the same binary, loaded with the same host code features */
+    uint64_t image_size;
+    uint64_t image_check[2];
+    uint32_t features;
+    uint32_t env_size;
+    uint64_t nb_entries;
+} TBCacheHeader;
+
+typedef struct TBCacheKey {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t page_hash;     /* of the page that holds pc */
+    uint32_t flags;
+    uint32_t config;        /* cpu_tb_cache_config() */
+} TBCacheKey;
+
+/* What a saved host address is relative to */
+enum {
+    TB_CACHE_BASE_TB,
+    TB_CACHE_BASE_CODE,
+    TB_CACHE_BASE_PROLOGUE,
+    TB_CACHE_BASE_IMAGE,
+};
+
+typedef struct TBCacheReloc {
+    int64_t addend;
+    uint16_t offset;
+    uint8_t type;
+    uint8_t base;           /* TB_CACHE_BASE_* */
+    uint32_t unused;
+} TBCacheReloc;
+
+typedef struct TBCacheEntry {
+    TBCacheKey key;
+    uint64_t page2_hash;    /* of the next page, if the TB continues there */
+    uint16_t size;
+    uint16_t icount;
+    uint16_t code_size;
+    uint16_t nb_relocs;
+    uint16_t tb_next_offset[2];
+    uint16_t tb_jmp_offset[2];
+    uint32_t used;          /* hit or stored by this run, not from the file */
+    uint32_t unused;
+    /* followed by the host code, then by the guest code */
+    TBCacheReloc relocs[];
+} TBCacheEntry;
+
+static struct {
+    char *path;
+    GHashTable *index;
+    uint64_t size;          /* of the entries in index */
+    uint64_t max_size;
+    bool dirty;
+    /* whether index may hold entries that this run did not use */
+    bool stale;
+    /* key of the TB being translated, computed by tb_cache_lookup() */
+    bool pending;
+    TBCacheKey pending_key;
+    /* statistics */
+    uint64_t loaded;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t rejected;
+    uint64_t stored;
+    uint64_t unsaved;
+    uint64_t full;
+    uint64_t dropped;
+} tb_cache;
+
+static inline uint8_t *tb_cache_code(TBCacheEntry *e)
+{
+    return (uint8_t *)&e->relocs[e->nb_relocs];
+}
+
+static inline uint8_t *tb_cache_guest_code(TBCacheEntry *e)
+{
+    return tb_cache_code(e) + e->code_size;
+}
+
+static inline size_t tb_cache_entry_size(TBCacheEntry *e)
+{
+    return sizeof(*e) + e->nb_relocs * sizeof(TBCacheReloc) +
+           e->code_size + e->size;
+}
+
+static gboolean tb_cache_entry_stale(gpointer key, gpointer value,
+                                     gpointer opaque)
+{
+    TBCacheEntry *e = value;
+
+    if (e->used) {
+        return FALSE;
+    }
+    tb_cache.size -= tb_cache_entry_size(e);
+    tb_cache.dropped++;
+    return TRUE;
+}
+
+/* Make room for size more bytes, if need be by dropping the entries that
+   this run did not use.  They would not be saved anyway. */
+static bool tb_cache_reserve(size_t size)
+{
+    if (tb_cache.size + size > tb_cache.max_size && tb_cache.stale) {
+        g_hash_table_foreach_remove(tb_cache.index, tb_cache_entry_stale,
+                                    NULL);
+        tb_cache.stale = false;
+    }
+    return tb_cache.size + size <= tb_cache.max_size;
+}
+
+/* Add e to the index, in place of an entry with the same key */
+static void tb_cache_add(TBCacheEntry *e)
+{
+    TBCacheEntry *old = g_hash_table_lookup(tb_cache.index, &e->key);
+
+    if (old) {
+        tb_cache.size -= tb_cache_entry_size(old);
+    }
+    tb_cache.size += tb_cache_entry_size(e);
+    g_hash_table_replace(tb_cache.index, &e->key, e);
+}
+
+static guint tb_cache_key_hash(gconstpointer p)
+{
+    const TBCacheKey *k = p;
+
+    return k->page_hash ^ (k->pc * 0x9e3779b97f4a7c15ull) ^ k->flags;
+}
+
+static gboolean tb_cache_key_equal(gconstpointer a, gconstpointer b)
+{
+    return memcmp(a, b, sizeof(TBCacheKey)) == 0;
+}
+
+static uint64_t tb_cache_page_hash(tb_page_addr_t addr)
+{
+    const uint64_t *p = qemu_get_ram_ptr(addr & TARGET_PAGE_MASK);
+    uint64_t h = TARGET_PAGE_SIZE;
+    int i;
+
+    for (i = 0; i < TARGET_PAGE_SIZE / 8; i++) {
+        h ^= p[i] * 0x87c37b91114253d5ull;
+        h = rol64(h, 31) * 0x4cf5ad432745937full;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Bytes of the TB that are on the page of its pc */
+static inline int tb_cache_first_page_size(target_ulong pc, int size)
+{
+    return MIN(size, TARGET_PAGE_SIZE - (pc & ~TARGET_PAGE_MASK));
+}
+
+static uintptr_t tb_cache_base(TranslationBlock *tb, int base)
+{
+    switch (base) {
+    case TB_CACHE_BASE_TB:
+        return (uintptr_t)tb;
+    case TB_CACHE_BASE_CODE:
+        return (uintptr_t)tb->tc_ptr;
+    case TB_CACHE_BASE_PROLOGUE:
+        return (uintptr_t)tcg_ctx.code_gen_prologue;
+    default:
+        return (uintptr_t)__executable_start;
+    }
+}
+
+/* What value can be saved relative to, or -1 */
+static int tb_cache_classify(TranslationBlock *tb, int code_size,
+                             uintptr_t value)
+{
+    if (value - (uintptr_t)tb < sizeof(*tb)) {
+        return TB_CACHE_BASE_TB;
+    }
+    if (value - (uintptr_t)tb->tc_ptr <= code_size) {
+        return TB_CACHE_BASE_CODE;
+    }
+    /* the prologue has the last 1KB of the buffer, see code_gen_alloc() */
+    if (value - (uintptr_t)tcg_ctx.code_gen_prologue < 1024) {
+        return TB_CACHE_BASE_PROLOGUE;
+    }
+    if (value >= (uintptr_t)__executable_start && value < (uintptr_t)_end) {
+        return TB_CACHE_BASE_IMAGE;
+    }
+    return -1;
+}
+
+/* Whether the translation of tb may come from, or go to, the cache */
+static bool tb_cacheable(CPUState *cpu, TranslationBlock *tb)
+{
+    return tb->cflags == 0 && !use_icount && !singlestep &&
+           !cpu->singlestep_enabled && QTAILQ_EMPTY(&cpu->breakpoints);
+}
+
+static void tb_cache_set_key(TBCacheKey *key, CPUState *cpu,
+                             TranslationBlock *tb, tb_page_addr_t phys_pc)
+{
+    memset(key, 0, sizeof(*key));
+    key->pc = tb->pc;
+    key->cs_base = tb->cs_base;
+    key->page_hash = tb_cache_page_hash(phys_pc);
+    key->flags = tb->flags;
+    key->config = cpu_tb_cache_config(cpu->env_ptr);
+}
+
+/* Copy e to tb->tc_ptr, or return false if it cannot be used there */
+static bool tb_cache_install(CPUState *cpu, TranslationBlock *tb,
+                             TBCacheEntry *e, tb_page_addr_t phys_pc)
+{
+    uint8_t *guest = tb_cache_guest_code(e);
+    int n1 = tb_cache_first_page_size(tb->pc, e->size);
+    TCGHostReloc r;
+    int i;
+
+    if (memcmp(qemu_get_ram_ptr(phys_pc), guest, n1) != 0) {
+        return false;
+    }
+    if (n1 < e->size) {
+        /* the translator would have fetched from there as well */
+        tb_page_addr_t phys_page2 =
+            get_page_addr_code(cpu->env_ptr, tb->pc + n1);
+
+        if (tb_cache_page_hash(phys_page2) != e->page2_hash ||
+            memcmp(qemu_get_ram_ptr(phys_page2), guest + n1,
+                   e->size - n1) != 0) {
+            return false;
+        }
+    }
+
+    memcpy(tb->tc_ptr, tb_cache_code(e), e->code_size);
+    for (i = 0; i < e->nb_relocs; i++) {
+        r.offset = e->relocs[i].offset;
+        r.type = e->relocs[i].type;
+        r.value = tb_cache_base(tb, e->relocs[i].base) + e->relocs[i].addend;
+        if (!tcg_patch_host_reloc(tb->tc_ptr, &r)) {
+            return false;
+        }
+    }
+    flush_icache_range((uintptr_t)tb->tc_ptr,
+                       (uintptr_t)tb->tc_ptr + e->code_size);
+
+    tb->size = e->size;
+    tb->icount = e->icount;
+    for (i = 0; i < 2; i++) {
+        tb->tb_next_offset[i] = e->tb_next_offset[i];
+        tb->tb_jmp_offset[i] = e->tb_jmp_offset[i];
+    }
+    return true;
+}
+
+/* Fill in the code of tb from the cache, if it has it.  Otherwise the TB
+   is translated and then passed to tb_cache_insert(). */
+bool tb_cache_lookup(CPUState *cpu, TranslationBlock *tb,
+                     tb_page_addr_t phys_pc, int *code_size)
+{
+    TBCacheEntry *e;
+
+    tb_cache.pending = false;
+    if (!tb_cache.index || !tb_cacheable(cpu, tb)) {
+        return false;
+    }
+    tb_cache_set_key(&tb_cache.pending_key, cpu, tb, phys_pc);
+    tb_cache.pending = true;
+
+    e = g_hash_table_lookup(tb_cache.index, &tb_cache.pending_key);
+    if (!e) {
+        tb_cache.misses++;
+        return false;
+    }
+    if (!tb_cache_install(cpu, tb, e, phys_pc)) {
+        /* tb_cache_insert() will replace it */
+        tb_cache.rejected++;
+        return false;
+    }
+    tb_cache.pending = false;
+    tb_cache.hits++;
+    e->used = 1;
+    *code_size = e->code_size;
+    return true;
+}
+
+/* Add tb, just translated by tcg_gen_code(), to the cache */
+void tb_cache_insert(CPUState *cpu, TranslationBlock *tb,
+                     tb_page_addr_t phys_pc, int code_size)
+{
+    int n = tcg_ctx.nb_host_relocs;
+    int n1 = tb_cache_first_page_size(tb->pc, tb->size);
+    size_t size;
+    TBCacheEntry *e;
+    uint8_t *guest;
+    int i, base;
+
+    if (!tb_cache.pending) {
+        return;
+    }
+    tb_cache.pending = false;
+    if (n < 0 || code_size > UINT16_MAX) {
+        tb_cache.unsaved++;
+        return;
+    }
+    size = sizeof(*e) + n * sizeof(TBCacheReloc) + code_size + tb->size;
+    if (!tb_cache_reserve(size)) {
+        tb_cache.full++;
+        return;
+    }
+
+    e = g_malloc0(size);
+    e->key = tb_cache.pending_key;
+    e->size = tb->size;
+    e->icount = tb->icount;
+    e->code_size = code_size;
+    e->nb_relocs = n;
+    e->used = 1;
+    for (i = 0; i < 2; i++) {
+        e->tb_next_offset[i] = tb->tb_next_offset[i];
+        e->tb_jmp_offset[i] = tb->tb_jmp_offset[i];
+    }
+    for (i = 0; i < n; i++) {
+        uintptr_t value = tcg_ctx.host_relocs[i].value;
+
+        base = tb_cache_classify(tb, code_size, value);
+        if (base < 0) {
+            g_free(e);
+            tb_cache.unsaved++;
+            return;
+        }
+        e->relocs[i].addend = value - tb_cache_base(tb, base);
+        e->relocs[i].offset = tcg_ctx.host_relocs[i].offset;
+        e->relocs[i].type = tcg_ctx.host_relocs[i].type;
+        e->relocs[i].base = base;
+    }
+    memcpy(tb_cache_code(e), tb->tc_ptr, code_size);
+
+    guest = tb_cache_guest_code(e);
+    memcpy(guest, qemu_get_ram_ptr(phys_pc), n1);
+    if (n1 < tb->size) {
+        tb_page_addr_t phys_page2 =
+            get_page_addr_code(cpu->env_ptr, tb->pc + n1);
+
+        e->page2_hash = tb_cache_page_hash(phys_page2);
+        memcpy(guest + n1, qemu_get_ram_ptr(phys_page2), tb->size - n1);
+    }
+
+    tb_cache_add(e);
+    tb_cache.dirty = true;
+    tb_cache.stored++;
+}
+
+/* Whether e, read from the file, can be used at all */
+static bool tb_cache_entry_valid(TBCacheEntry *e)
+{
+    int i;
+
+    for (i = 0; i < e->nb_relocs; i++) {
+        if (e->relocs[i].offset >= e->code_size ||
+            e->relocs[i].base > TB_CACHE_BASE_IMAGE) {
+            return false;
+        }
+    }
+    return e->size != 0 && e->code_size != 0;
+}
+
+static void tb_cache_set_header(TBCacheHeader *h)
+{
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, TB_CACHE_MAGIC, sizeof(TB_CACHE_MAGIC));
+    h->version = TB_CACHE_VERSION;
+    h->page_size = TARGET_PAGE_SIZE;
+    pstrcpy(h->qemu_version, sizeof(h->qemu_version), QEMU_VERSION);
+    h->image_size = _end - __executable_start;
+    h->image_check[0] = (uintptr_t)tb_cache_lookup -
+                        (uintptr_t)__executable_start;
+    h->image_check[1] = (uintptr_t)&tcg_ctx - (uintptr_t)__executable_start;
+    h->features = tcg_host_code_features();
+    h->env_size = sizeof(CPUArchState);
+}
+
+static void tb_cache_load(void)
+{
+    TBCacheHeader h, expected;
+    TBCacheEntry *e, head;
+    uint64_t i, nb_entries;
+    struct stat st;
+    FILE *f;
+
+    f = fopen(tb_cache.path, "rb");
+    if (!f) {
+        if (errno != ENOENT) {
+            error_report("-tb-cache: cannot open %s: %s", tb_cache.path,
+                         strerror(errno));
+        }
+        return;
+    }
+    /* the file is host code that is run as is, so it must not be
+       something that another user could have written */
+    if (fstat(fileno(f), &st) < 0 || !S_ISREG(st.st_mode) ||
+        st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+        error_report("-tb-cache: ignoring %s, it is not a regular file owned "
+                     "by this user and writable by no one else",
+                     tb_cache.path);
+        goto out;
+    }
+    if (fread(&h, sizeof(h), 1, f) != 1) {
+        goto out;
+    }
+    tb_cache_set_header(&expected);
+    expected.nb_entries = nb_entries = h.nb_entries;
+    if (memcmp(&h, &expected, sizeof(h)) != 0) {
+        /* another QEMU binary or host CPU, it will be overwritten */
+        error_report("-tb-cache: ignoring %s, it was made by another build "
+                     "of QEMU or on another host", tb_cache.path);
+        goto out;
+    }
+
+    /* a truncated file still gives the entries before the cut, and a file
+       written with a larger size only those that fit */
+    for (i = 0; i < nb_entries; i++) {
+        if (fread(&head, sizeof(head), 1, f) != 1 ||
+            head.nb_relocs > TCG_MAX_HOST_RELOCS ||
+            !tb_cache_reserve(tb_cache_entry_size(&head))) {
+            break;
+        }
+        e = g_malloc(tb_cache_entry_size(&head));
+        *e = head;
+        if (fread(e->relocs, tb_cache_entry_size(e) - sizeof(*e), 1, f) != 1 ||
+            !tb_cache_entry_valid(e)) {
+            g_free(e);
+            break;
+        }
+        e->used = 0;
+        tb_cache_add(e);
+        tb_cache.loaded++;
+    }
+    tb_cache.stale = tb_cache.loaded != 0;
+
+out:
+    fclose(f);
+}
+
+/* Write the entries that this run used to a temporary file and rename it,
+   so that QEMUs exiting at the same time leave the file of one of them. */
+static void tb_cache_save(void)
+{
+    GHashTableIter iter;
+    TBCacheHeader h;
+    TBCacheEntry *e;
+    char *tmp;
+    FILE *f;
+    bool ok;
+    int fd;
+
+    if (tb_cache.stale) {
+        g_hash_table_foreach_remove(tb_cache.index, tb_cache_entry_stale,
+                                    NULL);
+        tb_cache.stale = false;
+    }
+    if (!tb_cache.dirty && !tb_cache.dropped) {
+        return;
+    }
+    /* private to this user, as tb_cache_load() wants it */
+    tmp = g_strdup_printf("%s.%d", tb_cache.path, (int)getpid());
+    unlink(tmp);
+    fd = qemu_open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    f = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (!f) {
+        error_report("-tb-cache: cannot create %s: %s", tmp, strerror(errno));
+        if (fd >= 0) {
+            qemu_close(fd);
+            unlink(tmp);
+        }
+        g_free(tmp);
+        return;
+    }
+
+    tb_cache_set_header(&h);
+    h.nb_entries = g_hash_table_size(tb_cache.index);
+    ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    g_hash_table_iter_init(&iter, tb_cache.index);
+    while (ok && g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+        ok = fwrite(e, tb_cache_entry_size(e), 1, f) == 1;
+    }
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok || rename(tmp, tb_cache.path) < 0) {
+        error_report("-tb-cache: cannot write %s: %s", tb_cache.path,
+                     strerror(errno));
+        unlink(tmp);
+    }
+    g_free(tmp);
+}
+
+void tb_cache_init(const char *path, uint64_t max_size)
+{
+    tb_cache.path = g_strdup(path);
+    tb_cache.max_size = max_size;
+    tb_cache.index = g_hash_table_new_full(tb_cache_key_hash,
+                                           tb_cache_key_equal, NULL, g_free);
+    tb_cache_load();
+    atexit(tb_cache_save);
+}
+
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf)
+{
+    if (!tb_cache.index) {
+        return;
+    }
+    cpu_fprintf(f, "TB cache            %s, %u TBs (%" PRIu64 " loaded)\n",
+                tb_cache.path, g_hash_table_size(tb_cache.index),
+                tb_cache.loaded);
+    cpu_fprintf(f, "TB cache size       %" PRIu64 " KB of %" PRIu64
+                " KB (%" PRIu64 " unused TBs dropped)\n",
+                tb_cache.size >> 10, tb_cache.max_size >> 10,
+                tb_cache.dropped);
+    cpu_fprintf(f, "TB cache hits       %" PRIu64 " (%" PRIu64 " misses, %"
+                PRIu64 " rejected)\n",
+                tb_cache.hits, tb_cache.misses, tb_cache.rejected);
+    cpu_fprintf(f, "TB cache stores     %" PRIu64 " (%" PRIu64
+                " not movable, %" PRIu64 " over size)\n",
+                tb_cache.stored, tb_cache.unsaved, tb_cache.full);
+}
+
+#else
+
+void tb_cache_init(const char *path, uint64_t max_size)
+{
+    error_report("-tb-cache: not supported for this host and target, "
+                 "ignored");
+}
+
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf)
+{
+}
+
+#endif /* TB_CACHE_SUPPORTED */
@@ -0,0 +1,38 @@
+/*
+ *  Persistent translation block cache
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TB_CACHE_H
+#define TB_CACHE_H
+
+/* Default limit on the TBs kept in memory and in the file */
+#define TB_CACHE_DEFAULT_SIZE (64 * 1024 * 1024)
+
+void tb_cache_init(const char *path, uint64_t max_size);
+void tb_cache_dump_info(FILE *f, fprintf_function cpu_fprintf);
+
+/* The host backend must be able to move generated code, and the target
+   must say what its translator depends on besides pc, cs_base and flags */
+#if !defined(CONFIG_USER_ONLY) && defined(TCG_TARGET_HAS_HOST_RELOCS) && \
+    defined(TARGET_TB_CACHE)
+#define TB_CACHE_SUPPORTED 1
+
+bool tb_cache_lookup(CPUState *cpu, TranslationBlock *tb,
+                     tb_page_addr_t phys_pc, int *code_size);
+void tb_cache_insert(CPUState *cpu, TranslationBlock *tb,
+                     tb_page_addr_t phys_pc, int code_size);
+#endif
+
+#endif /* TB_CACHE_H */
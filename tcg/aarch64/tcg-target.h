@@ -97,6 +97,7 @@ enum {
 };
 
 #define TCG_TARGET_HAS_new_ldst         0
+#define TCG_TARGET_HAS_goto_ptr         0
 
 static inline void flush_icache_range(uintptr_t start, uintptr_t stop)
 {
@@ -306,6 +306,7 @@ static inline int tcg_target_const_match(tcg_target_long val,
 #define OPC_ARITH_GvEv	(0x03)		/* ... plus (ARITH_FOO << 3) */
 #define OPC_ANDN        (0xf2 | P_EXT38)
 #define OPC_ADD_GvEv	(OPC_ARITH_GvEv | (ARITH_ADD << 3))
+#define OPC_AND_GvEv	(OPC_ARITH_GvEv | (ARITH_AND << 3))
 #define OPC_BSWAP	(0xc8 | P_EXT)
 #define OPC_CALL_Jz	(0xe8)
 #define OPC_CMOVCC      (0x40 | P_EXT)  /* ... plus condition code */
@@ -673,6 +674,55 @@ static void tcg_out_movi(TCGContext *s, TCGType type,
     tcg_out64(s, arg);
 }
 
+/* How tcg_out_branch() and tcg_out_movi() put a host address into the
+   code, see tcg_out_host_reloc().  When the code is moved, each address
+   must still be reached the same way, or cpu_restore_state() would not
+   find the same instructions when it retranslates the TB.  */
+enum {
+    R_HOST_UNKNOWN,         /* an address in a register, cannot be moved */
+    R_HOST_BRANCH_REL32,    /* call or jmp rel32 */
+    R_HOST_BRANCH_FAR,      /* call or jmp *%r10, out of rel32 range */
+    R_HOST_MOVI_U32,        /* movl $imm32 */
+    R_HOST_MOVI_S32,        /* movq $simm32 */
+    R_HOST_MOVI_PCREL,      /* leaq disp32(%rip) */
+    R_HOST_MOVI_64,         /* movabsq $imm64 */
+};
+
+#if TCG_TARGET_REG_BITS == 64
+/* The form tcg_out_movi() uses for arg at code_ptr */
+static int movi_host_form(uintptr_t arg, uintptr_t code_ptr)
+{
+    intptr_t diff = arg - (code_ptr + 7);
+
+    if (arg == 0) {
+        return R_HOST_UNKNOWN;
+    } else if (arg == (uint32_t)arg) {
+        return R_HOST_MOVI_U32;
+    } else if (arg == (int32_t)arg) {
+        return R_HOST_MOVI_S32;
+    } else if (diff == (int32_t)diff) {
+        return R_HOST_MOVI_PCREL;
+    }
+    return R_HOST_MOVI_64;
+}
+#endif
+
+/* tcg_out_movi() of a host address */
+static void tcg_out_movi_ptr(TCGContext *s, TCGReg ret, uintptr_t arg)
+{
+#if TCG_TARGET_REG_BITS == 64
+    int type = movi_host_form(arg, (uintptr_t)s->code_ptr);
+
+    tcg_out_movi(s, TCG_TYPE_PTR, ret, arg);
+    if (type != R_HOST_UNKNOWN) {
+        tcg_out_host_reloc(s, s->code_ptr - (type == R_HOST_MOVI_64 ? 8 : 4),
+                           type, arg);
+    }
+#else
+    tcg_out_movi(s, TCG_TYPE_PTR, ret, arg);
+#endif
+}
+
 static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
 {
     if (val == (int8_t)val) {
@@ -1105,9 +1155,11 @@ static void tcg_out_branch(TCGContext *s, int call, uintptr_t dest)
 
     if (disp == (int32_t)disp) {
         tcg_out_opc(s, call ? OPC_CALL_Jz : OPC_JMP_long, 0, 0, 0);
+        tcg_out_host_reloc(s, s->code_ptr, R_HOST_BRANCH_REL32, dest);
         tcg_out32(s, disp);
     } else {
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_R10, dest);
+        tcg_out_host_reloc(s, s->code_ptr, R_HOST_BRANCH_FAR, dest);
+        tcg_out_movi_ptr(s, TCG_REG_R10, dest);
         tcg_out_modrm(s, OPC_GRP5,
                       call ? EXT5_CALLN_Ev : EXT5_JMPN_Ev, TCG_REG_R10);
     }
@@ -1123,6 +1175,52 @@ static void tcg_out_jmp(TCGContext *s, uintptr_t dest)
     tcg_out_branch(s, 0, dest);
 }
 
+#ifdef TCG_TARGET_HAS_HOST_RELOCS
+static bool patch_host_reloc(uint8_t *code_ptr, int type, uintptr_t value)
+{
+    uintptr_t next = (uintptr_t)code_ptr + 4;
+    intptr_t disp;
+
+    switch (type) {
+    case R_HOST_BRANCH_REL32:
+        disp = value - next;
+        if (disp != (int32_t)disp) {
+            return false;
+        }
+        *(int32_t *)code_ptr = disp;
+        return true;
+    case R_HOST_BRANCH_FAR:
+        /* code_ptr is where tcg_out_branch() started */
+        disp = value - ((uintptr_t)code_ptr + 5);
+        return disp != (int32_t)disp;
+    case R_HOST_MOVI_U32:
+    case R_HOST_MOVI_S32:
+        /* these do not depend on where the movi is */
+        if (movi_host_form(value, next) != type) {
+            return false;
+        }
+        *(uint32_t *)code_ptr = value;
+        return true;
+    case R_HOST_MOVI_PCREL:
+        /* rex, opcode and modrm precede the displacement */
+        if (movi_host_form(value, (uintptr_t)code_ptr - 3) != type) {
+            return false;
+        }
+        *(int32_t *)code_ptr = value - next;
+        return true;
+    case R_HOST_MOVI_64:
+        /* rex and opcode precede the immediate */
+        if (movi_host_form(value, (uintptr_t)code_ptr - 2) != type) {
+            return false;
+        }
+        *(uint64_t *)code_ptr = value;
+        return true;
+    default:
+        return false;
+    }
+}
+#endif
+
 #if defined(CONFIG_SOFTMMU)
 /* helper signature: helper_ret_ld_mmu(CPUState *env, target_ulong addr,
  *                                     int mmu_idx, uintptr_t ra)
@@ -1180,6 +1278,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     TCGType ttype = TCG_TYPE_I32;
     TCGType htype = TCG_TYPE_I32;
     int trexw = 0, hrexw = 0;
+    int ofs;
 
     if (TCG_TARGET_REG_BITS == 64) {
         if (TARGET_LONG_BITS == 64) {
@@ -1200,15 +1299,27 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     tgen_arithi(s, ARITH_AND + trexw, r1,
                 TARGET_PAGE_MASK | ((1 << s_bits) - 1), 0);
+
+    /* r0 = &tlb_table[mem_index][index] + ofs */
+#if CPU_TLB_DYN
+    /* and tlb_mask(env), r0; add tlb_table(env), r0 */
+    tcg_out_modrm_offset(s, OPC_AND_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_mask[mem_index]));
+    tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r0, TCG_AREG0,
+                         offsetof(CPUArchState, tlb_table[mem_index]));
+    ofs = 0;
+#else
     tgen_arithi(s, ARITH_AND + hrexw, r0,
                 (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
 
     tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
                              offsetof(CPUArchState, tlb_table[mem_index][0])
                              + which);
+    ofs = which;
+#endif
 
-    /* cmp 0(r0), r1 */
-    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, 0);
+    /* cmp which(r0), r1 */
+    tcg_out_modrm_offset(s, OPC_CMP_GvEv + trexw, r1, r0, which - ofs);
 
     /* Prepare for both the fast path add of the tlb addend, and the slow
        path function argument setup.  There are two cases worth note:
@@ -1224,8 +1335,8 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
     s->code_ptr += 4;
 
     if (TARGET_LONG_BITS > TCG_TARGET_REG_BITS) {
-        /* cmp 4(r0), addrhi */
-        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, 4);
+        /* cmp which+4(r0), addrhi */
+        tcg_out_modrm_offset(s, OPC_CMP_GvEv, addrhi, r0, which + 4 - ofs);
 
         /* jne slow_path */
         tcg_out_opc(s, OPC_JCC_long + JCC_JNE, 0, 0, 0);
@@ -1237,7 +1348,7 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     /* add addend(r0), r1 */
     tcg_out_modrm_offset(s, OPC_ADD_GvEv + hrexw, r1, r0,
-                         offsetof(CPUTLBEntry, addend) - which);
+                         offsetof(CPUTLBEntry, addend) - ofs);
 }
 
 /*
@@ -1304,8 +1415,8 @@ static void tcg_out_qemu_ld_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
         /* The second argument is already loaded with addrlo.  */
         tcg_out_movi(s, TCG_TYPE_I32, tcg_target_call_iarg_regs[2],
                      l->mem_index);
-        tcg_out_movi(s, TCG_TYPE_PTR, tcg_target_call_iarg_regs[3],
-                     (uintptr_t)l->raddr);
+        tcg_out_movi_ptr(s, tcg_target_call_iarg_regs[3],
+                         (uintptr_t)l->raddr);
     }
 
     tcg_out_calli(s, (uintptr_t)qemu_ld_helpers[opc & ~MO_SIGN]);
@@ -1403,10 +1514,10 @@ static void tcg_out_qemu_st_slow_path(TCGContext *s, TCGLabelQemuLdst *l)
 
         if (ARRAY_SIZE(tcg_target_call_iarg_regs) > 4) {
             retaddr = tcg_target_call_iarg_regs[4];
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_ptr(s, retaddr, (uintptr_t)l->raddr);
         } else {
             retaddr = TCG_REG_RAX;
-            tcg_out_movi(s, TCG_TYPE_PTR, retaddr, (uintptr_t)l->raddr);
+            tcg_out_movi_ptr(s, retaddr, (uintptr_t)l->raddr);
             tcg_out_st(s, TCG_TYPE_PTR, retaddr, TCG_REG_ESP, 0);
         }
     }
@@ -1730,7 +1841,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 
     switch(opc) {
     case INDEX_op_exit_tb:
-        tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
+        tcg_out_movi_ptr(s, TCG_REG_EAX, args[0]);
         tcg_out_jmp(s, (uintptr_t)tb_ret_addr);
         break;
     case INDEX_op_goto_tb:
@@ -1746,11 +1857,16 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         s->tb_next_offset[args[0]] = s->code_ptr - s->code_buf;
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp *reg; the target is a TB or code_gen_epilogue */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_call:
         if (const_args[0]) {
             tcg_out_calli(s, args[0]);
         } else {
-            /* call *reg */
+            /* call *reg, the address is not known here */
+            tcg_out_host_reloc(s, s->code_ptr, R_HOST_UNKNOWN, 0);
             tcg_out_modrm(s, OPC_GRP5, EXT5_CALLN_Ev, args[0]);
         }
         break;
@@ -2078,6 +2194,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_call, { "ri" } },
     { INDEX_op_br, { } },
     { INDEX_op_mov_i32, { "r", "r" } },
@@ -2275,6 +2392,11 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /* Return path for goto_ptr.  Set the return value to 0, as
+       exit_tb(0) would, and fall through to the TB epilogue.  */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2293,6 +2415,13 @@ static void tcg_target_qemu_prologue(TCGContext *s)
 #endif
 }
 
+#ifdef TCG_TARGET_HAS_HOST_RELOCS
+static uint32_t tcg_target_code_features(void)
+{
+    return have_cmov | have_movbe << 1 | have_bmi1 << 2 | have_bmi2 << 3;
+}
+#endif
+
 static void tcg_target_init(TCGContext *s)
 {
 #ifdef CONFIG_CPUID_H
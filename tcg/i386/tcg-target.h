@@ -130,6 +130,16 @@ extern bool have_bmi1;
 #endif
 
 #define TCG_TARGET_HAS_new_ldst         1
+#define TCG_TARGET_HAS_goto_ptr         1
+
+/* tcg_out_tlb_load() takes the TLB size from the env, see cpu-defs.h */
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB   1
+
+/* The code of a TB notes where it embeds host addresses, so that it can
+   be moved, see tcg_out_host_reloc() */
+#if TCG_TARGET_REG_BITS == 64
+#define TCG_TARGET_HAS_HOST_RELOCS      1
+#endif
 
 #define TCG_TARGET_deposit_i32_valid(ofs, len) \
     (((ofs) == 0 && (len) == 8) || ((ofs) == 8 && (len) == 8) || \
@@ -100,6 +100,7 @@ typedef enum {
 #define TCG_TARGET_HAS_mulsh_i32        0
 
 #define TCG_TARGET_HAS_new_ldst         1
+#define TCG_TARGET_HAS_goto_ptr         0
 
 #define TCG_AREG0 TCG_REG_R27
 
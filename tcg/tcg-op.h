@@ -2647,6 +2647,16 @@ static inline void tcg_gen_goto_tb(unsigned idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+/* Jump to the host code at PTR, which is either the start of a TB or
+   tcg_ctx.code_gen_epilogue (which returns 0 to cpu_exec).  Only
+   available if TCG_TARGET_HAS_goto_ptr; callers must fall back to
+   tcg_gen_exit_tb(0) otherwise.  */
+static inline void tcg_gen_goto_ptr(TCGv_ptr ptr)
+{
+    *tcg_ctx.gen_opc_ptr++ = INDEX_op_goto_ptr;
+    *tcg_ctx.gen_opparam_ptr++ = GET_TCGV_PTR(ptr);
+}
+
 
 void tcg_gen_qemu_ld_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_st_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
@@ -105,6 +105,10 @@ static int tcg_target_const_match(tcg_target_long val,
                                   const TCGArgConstraint *arg_ct);
 static void tcg_out_tb_init(TCGContext *s);
 static void tcg_out_tb_finalize(TCGContext *s);
+#ifdef TCG_TARGET_HAS_HOST_RELOCS
+static bool patch_host_reloc(uint8_t *code_ptr, int type, uintptr_t value);
+static uint32_t tcg_target_code_features(void);
+#endif
 
 
 TCGOpDef tcg_op_defs[] = {
@@ -187,6 +191,46 @@ static void tcg_out_label(TCGContext *s, int label_index, void *ptr)
     l->u.value = value;
 }
 
+/* host address relocation, for copying the code of a TB elsewhere */
+
+#ifdef TCG_TARGET_HAS_HOST_RELOCS
+static void tcg_out_host_reloc(TCGContext *s, uint8_t *code_ptr, int type,
+                               uintptr_t value)
+{
+    TCGHostReloc *r;
+
+    if (s->nb_host_relocs < 0) {
+        return;
+    }
+    if (s->nb_host_relocs == TCG_MAX_HOST_RELOCS) {
+        s->nb_host_relocs = -1;
+        return;
+    }
+    r = &s->host_relocs[s->nb_host_relocs++];
+    r->offset = code_ptr - s->code_buf;
+    r->type = type;
+    r->value = value;
+}
+
+/* Point the address recorded by r at r->value. Fails when the backend
+   would not have generated the same instruction for it at that place. */
+bool tcg_patch_host_reloc(uint8_t *code_buf, const TCGHostReloc *r)
+{
+    return patch_host_reloc(code_buf + r->offset, r->type, r->value);
+}
+
+/* Host CPU features that generated code depends on */
+uint32_t tcg_host_code_features(void)
+{
+    return tcg_target_code_features();
+}
+#else
+static inline void tcg_out_host_reloc(TCGContext *s, uint8_t *code_ptr,
+                                      int type, uintptr_t value)
+{
+}
+#endif
+
 int gen_new_label(void)
 {
     TCGContext *s = &tcg_ctx;
@@ -375,6 +419,9 @@ void tcg_func_start(TCGContext *s)
     s->gen_opparam_ptr = s->gen_opparam_buf;
 
     s->be = tcg_malloc(sizeof(TCGBackendData));
+#ifdef TCG_TARGET_HAS_HOST_RELOCS
+    s->nb_host_relocs = 0;
+#endif
 }
 
 static inline void tcg_temp_alloc(TCGContext *s, int n)
@@ -448,6 +448,18 @@ typedef struct TCGTempSet {
     unsigned long l[BITS_TO_LONGS(TCG_MAX_TEMPS)];
 } TCGTempSet;
 
+#ifdef TCG_TARGET_HAS_HOST_RELOCS
+/* A host address (helper, prologue, the TB itself...) in the code of a
+   TB, recorded so that the code can be copied elsewhere, see tb-cache.c */
+typedef struct TCGHostReloc {
+    uint16_t offset;    /* from the start of the TB's code */
+    uint8_t type;       /* backend specific */
+    uintptr_t value;
+} TCGHostReloc;
+
+#define TCG_MAX_HOST_RELOCS 1024
+#endif
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -462,6 +474,13 @@ struct TCGContext {
     uint16_t *tb_next_offset;
     uint16_t *tb_jmp_offset; /* != NULL if USE_DIRECT_JUMP */
 
+#ifdef TCG_TARGET_HAS_HOST_RELOCS
+    /* host addresses in the code of the current TB, -1 if there were
+       too many of them or some could not be recorded */
+    int nb_host_relocs;
+    TCGHostReloc host_relocs[TCG_MAX_HOST_RELOCS];
+#endif
+
     /* liveness analysis */
     uint16_t *op_dead_args; /* for each operation, each bit tells if the
                                corresponding argument is dead */
@@ -520,6 +539,8 @@ struct TCGContext {
     /* Code generation */
     int code_gen_max_blocks;
     uint8_t *code_gen_prologue;
+    /* return path for goto_ptr, exits to cpu_exec with a 0 result */
+    uint8_t *code_gen_epilogue;
     uint8_t *code_gen_buffer;
     size_t code_gen_buffer_size;
     /* threshold to flush the translated code buffer */
@@ -562,6 +583,11 @@ void tcg_func_start(TCGContext *s);
 int tcg_gen_code(TCGContext *s, uint8_t *gen_code_buf);
 int tcg_gen_code_search_pc(TCGContext *s, uint8_t *gen_code_buf, long offset);
 
+#ifdef TCG_TARGET_HAS_HOST_RELOCS
+bool tcg_patch_host_reloc(uint8_t *code_buf, const TCGHostReloc *r);
+uint32_t tcg_host_code_features(void);
+#endif
+
 void tcg_set_frame(TCGContext *s, int reg, intptr_t start, intptr_t size);
 
 TCGv_i32 tcg_global_reg_new_i32(int reg, const char *name);
@@ -0,0 +1,104 @@
+/*
+ * QTest testcase for the RISC-V HTIF block device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "libqtest.h"
+#include "qemu-common.h"
+
+#define TEST_IMAGE_SIZE (4 * 512)
+
+#define HTIF_TOHOST     0x400
+#define HTIF_FROMHOST   0x408
+#define HTIF_DEV_BLOCK  0x1ULL
+
+/* the request descriptor and the buffer it points to */
+#define REQ_ADDR        0x10000
+#define BUF_ADDR        0x11000
+
+static char tmp_path[] = "/tmp/qtest.XXXXXX";
+
+/* Send a disk read and wait for the response, which is taken from
+ * fromhost. Returns the response payload. */
+static uint64_t htif_disk_read(uint64_t offset, uint64_t size, uint64_t tag)
+{
+    uint64_t req[4] = {
+        cpu_to_le64(BUF_ADDR), cpu_to_le64(offset),
+        cpu_to_le64(size), cpu_to_le64(tag),
+    };
+    uint64_t tohost = HTIF_DEV_BLOCK << 56 | 0x0ULL << 48 | REQ_ADDR;
+    uint64_t fromhost;
+
+    memwrite(REQ_ADDR, req, sizeof(req));
+    writel(HTIF_TOHOST, (uint32_t)tohost);
+    writel(HTIF_TOHOST + 4, tohost >> 32);
+
+    /* every qtest command runs the main loop once, so polling lets the
+     * block layer complete the request */
+    do {
+        fromhost = readl(HTIF_FROMHOST) |
+                   (uint64_t)readl(HTIF_FROMHOST + 4) << 32;
+    } while (fromhost == 0);
+    writel(HTIF_FROMHOST, 0);
+    writel(HTIF_FROMHOST + 4, 0);
+
+    g_assert_cmphex(fromhost >> 48, ==, HTIF_DEV_BLOCK << 8 | 0x0);
+    return fromhost & 0xFFFFFFFFFFFFULL;
+}
+
+static void test_read(void)
+{
+    g_assert_cmphex(htif_disk_read(512, 512, 1), ==, 1);
+}
+
+static void test_unaligned(void)
+{
+    g_assert_cmphex(htif_disk_read(512, 100, 2), ==, ~2ULL & 0xFFFFFFFFFFFFULL);
+    g_assert_cmphex(htif_disk_read(100, 512, 3), ==, ~3ULL & 0xFFFFFFFFFFFFULL);
+}
+
+static void test_past_end(void)
+{
+    /* the block layer fails the request with -EIO */
+    g_assert_cmphex(htif_disk_read(TEST_IMAGE_SIZE, 512, 4),
+                    ==, ~4ULL & 0xFFFFFFFFFFFFULL);
+
+    /* and the device still serves the next one */
+    g_assert_cmphex(htif_disk_read(0, 512, 5), ==, 5);
+}
+
+int main(int argc, char **argv)
+{
+    char *cmdline;
+    int fd;
+    int ret;
+
+    fd = mkstemp(tmp_path);
+    g_assert(fd >= 0);
+    ret = ftruncate(fd, TEST_IMAGE_SIZE);
+    g_assert(ret == 0);
+    close(fd);
+
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/riscv-htif/read", test_read);
+    qtest_add_func("/riscv-htif/unaligned", test_unaligned);
+    qtest_add_func("/riscv-htif/past_end", test_past_end);
+
+    cmdline = g_strdup_printf("-drive file=%s,if=ide,format=raw", tmp_path);
+    qtest_start(cmdline);
+    g_free(cmdline);
+    ret = g_test_run();
+    qtest_end();
+
+    unlink(tmp_path);
+
+    return ret;
+}
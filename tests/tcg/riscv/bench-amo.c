@@ -0,0 +1,133 @@
+/*
+ * Atomic memory operation microbenchmark
+ *
+ * Measures the cost of AMOs and LR/SC compared to a plain load/add/store,
+ * and checks that a spinlock and a shared atomic counter stay consistent
+ * when several threads hammer on them.
+ *
+ * usage: bench-amo [iterations] [threads]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+static long iterations = 1000000;
+static int nthreads = 2;
+
+static volatile uint64_t plain_counter;
+static uint64_t amo_counter;
+static uint64_t lrsc_counter;
+
+static int lock;
+static uint64_t locked_counter;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double t, long ops)
+{
+    printf("%-12s %10ld ops %8.3f s %8.1f ns/op\n", name, ops, t,
+           t * 1e9 / ops);
+}
+
+/* amoadd.d */
+static void *amo_thread(void *arg)
+{
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        __sync_fetch_and_add(&amo_counter, 1);
+    }
+    return NULL;
+}
+
+/* lr.d/sc.d loop */
+static void *lrsc_thread(void *arg)
+{
+    long i;
+    uint64_t old;
+
+    for (i = 0; i < iterations; i++) {
+        do {
+            old = lrsc_counter;
+        } while (!__sync_bool_compare_and_swap(&lrsc_counter, old, old + 1));
+    }
+    return NULL;
+}
+
+/* amoswap.w based test-and-set spinlock */
+static void *lock_thread(void *arg)
+{
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        while (__sync_lock_test_and_set(&lock, 1)) {
+            while (lock) {
+                /* spin */
+            }
+        }
+        locked_counter++;
+        __sync_lock_release(&lock);
+    }
+    return NULL;
+}
+
+static void run(const char *name, void *(*fn)(void *), uint64_t *counter)
+{
+    pthread_t threads[nthreads];
+    double t;
+    int i;
+
+    t = now();
+    for (i = 0; i < nthreads; i++) {
+        pthread_create(&threads[i], NULL, fn, NULL);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    t = now() - t;
+
+    report(name, t, iterations * nthreads);
+    if (*counter != (uint64_t)iterations * nthreads) {
+        printf("%s: FAILED, counter %" PRIu64 " expected %" PRIu64 "\n",
+               name, *counter, (uint64_t)iterations * nthreads);
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double t;
+    long i;
+
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+    }
+    if (argc > 2) {
+        nthreads = atoi(argv[2]);
+    }
+    assert(iterations > 0 && nthreads > 0);
+
+    /* baseline: non-atomic read-modify-write, single thread */
+    t = now();
+    for (i = 0; i < iterations; i++) {
+        plain_counter++;
+    }
+    report("plain", now() - t, iterations);
+
+    run("amoadd", amo_thread, &amo_counter);
+    run("lr/sc", lrsc_thread, &lrsc_counter);
+    run("spinlock", lock_thread, &locked_counter);
+
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# Measure how soon a riscv-softmmu guest starts executing.
+#
+# usage: bench-boot.sh [runs] -- qemu command line
+#
+# Start QEMU with the given command line a number of times and print the
+# time from board init to the first translated instruction, as reported by
+# "info cpustats", for each run. Compare a -kernel boot with one from a
+# memory image:
+#
+#   bench-boot.sh 10 -- qemu-system-riscv -kernel vmlinux -m 1024
+#   bench-boot.sh 10 -- qemu-system-riscv -machine mem-image=vmlinux.ram -m 1024
+#
+# A memory image with the same layout as a -kernel boot can be written by
+# QEMU itself: start it stopped with -S -kernel vmlinux, and save the RAM
+# with "pmemsave 0 <RAM size> vmlinux.ram" in the monitor.
+#
+# With UNTIL set, print instead the time from starting QEMU until that
+# pattern shows up on the serial console, then quit QEMU from the monitor.
+# The output is polled every 10 ms. The time is followed by the
+# translation throughput from "info cpustats" (guest instructions
+# translated per second, first translations only), and with -tb-cache by
+# the TB cache hits, misses and rejections of the run. For the time to log
+# in with and without a persistent TB cache (the first run fills it):
+#
+#   rm -f /tmp/tb.cache
+#   UNTIL=login: bench-boot.sh 5 -- qemu-system-riscv -kernel vmlinux \
+#       -tb-cache /tmp/tb.cache
+#   UNTIL=login: bench-boot.sh 5 -- qemu-system-riscv -kernel vmlinux
+
+runs=${1:-5}
+shift 1 2>/dev/null
+[ "$1" = "--" ] && shift
+if [ $# -eq 0 ]; then
+    echo "usage: $0 [runs] -- qemu-system-riscv ..." >&2
+    exit 1
+fi
+
+if [ -n "$UNTIL" ]; then
+    dir=$(mktemp -d) || exit 1
+    trap 'rm -rf "$dir"' EXIT
+    mkfifo "$dir/in" || exit 1
+fi
+
+i=0
+while [ $i -lt "$runs" ]; do
+    if [ -n "$UNTIL" ]; then
+        start=$(date +%s%N)
+        "$@" -monitor none -display none -serial mon:stdio \
+            <"$dir/in" >"$dir/out" 2>&1 &
+        pid=$!
+        exec 3>"$dir/in"
+        # a prompt does not end in a newline, so look at the whole output
+        while ! grep -q -- "$UNTIL" "$dir/out"; do
+            if ! kill -0 $pid 2>/dev/null; then
+                echo "QEMU exited before \"$UNTIL\" was seen" >&2
+                exit 1
+            fi
+            sleep 0.01
+        done
+        end=$(date +%s%N)
+        # the monitor shares the console: switch to it with C-a c, get
+        # the counters and quit, which saves the TB cache
+        printf '\001c\ninfo cpustats\ninfo jit\nquit\n' >&3
+        exec 3>&-
+        wait $pid
+        echo "$(((end - start) / 1000000)) ms" \
+            $(sed -n -e 's/^\(translation [0-9]* insns\/s\).*/\1/p' \
+                     -e 's/^TB cache hits */TB cache hits /p' "$dir/out")
+    else
+        (sleep 2; echo "info cpustats"; echo quit) |
+            "$@" -monitor stdio -display none -serial null 2>&1 |
+            sed -n 's/^first instruction \([0-9.]*\) ms.*/\1 ms/p'
+    fi
+    i=$((i + 1))
+done
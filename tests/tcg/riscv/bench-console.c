@@ -0,0 +1,67 @@
+/*
+ * Console throughput benchmark
+ *
+ * Writes a block of text to stdout, which should be the guest console
+ * (run it from the console shell, not over the network), and reports the
+ * throughput on stderr. With the HTIF console each write system call
+ * reaches the chardev backend in a few large transfers; the 16550 moves
+ * it a byte and an MMIO exit at a time. The HTIF console is on the second
+ * serial port, so start QEMU with "-serial null -serial stdio" to compare.
+ *
+ * usage: bench-console [megabytes] [bytes per write]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    double megabytes = 1;
+    long chunk = 4096;
+    long total, done, i;
+    char *buf;
+    double t;
+
+    if (argc > 1) {
+        megabytes = atof(argv[1]);
+    }
+    if (argc > 2) {
+        chunk = atol(argv[2]);
+    }
+    assert(megabytes > 0 && chunk > 0);
+
+    /* printable lines, so that a terminal backend does not choke */
+    buf = malloc(chunk);
+    assert(buf);
+    for (i = 0; i < chunk; i++) {
+        buf[i] = (i % 64 == 63) ? '\n' : 'a' + i % 26;
+    }
+
+    total = megabytes * 1024 * 1024;
+    t = now();
+    for (done = 0; done < total; ) {
+        ssize_t n = write(STDOUT_FILENO, buf,
+                          total - done < chunk ? total - done : chunk);
+        if (n <= 0) {
+            perror("write");
+            return 1;
+        }
+        done += n;
+    }
+    t = now() - t;
+
+    fprintf(stderr, "\n%ld bytes in %ld byte writes %8.3f s %8.3f MB/s\n",
+            total, chunk, t, total / t / (1024 * 1024));
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * Counter CSR microbenchmark
+ *
+ * Reads cycle and instret in a tight loop, the way sampling profilers and
+ * self-timing benchmarks do, and reports the cost of a read along with the
+ * instret delta across a known instruction sequence. Without
+ * "-global riscv-cpu.icount-counters=on" every read goes to the virtual
+ * clock and instret does not count instructions.
+ *
+ * usage: bench-counters [iterations]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static long iterations = 10000000;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline unsigned long rdcycle(void)
+{
+    unsigned long val;
+
+    asm volatile ("rdcycle %0" : "=r" (val));
+    return val;
+}
+
+static inline unsigned long rdinstret(void)
+{
+    unsigned long val;
+
+    asm volatile ("rdinstret %0" : "=r" (val));
+    return val;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long sum = 0, start, delta;
+    double t;
+    long i;
+
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+    }
+    assert(iterations > 0);
+
+    t = now();
+    for (i = 0; i < iterations; i++) {
+        sum += rdcycle();
+    }
+    t = now() - t;
+    printf("rdcycle:   %ld reads %8.3f s %8.1f ns/read\n",
+           iterations, t, t * 1e9 / iterations);
+
+    t = now();
+    for (i = 0; i < iterations; i++) {
+        sum += rdinstret();
+    }
+    t = now() - t;
+    printf("rdinstret: %ld reads %8.3f s %8.1f ns/read\n",
+           iterations, t, t * 1e9 / iterations);
+
+    /* three instructions separate the two reads */
+    asm volatile ("rdinstret %0\n\t"
+                  "nop\n\t"
+                  "nop\n\t"
+                  "rdinstret %1\n\t"
+                  "sub %1, %1, %0"
+                  : "=&r" (start), "=&r" (delta));
+    printf("instret delta over 3 insns: %lu\n", delta);
+
+    return sum == 42;
+}
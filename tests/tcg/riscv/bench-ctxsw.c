@@ -0,0 +1,120 @@
+/*
+ * Context switch microbenchmark
+ *
+ * A token is passed around a ring of processes through pipes, so every
+ * hop is a switch to another address space. After receiving the token
+ * each process touches its own working set, which is what an ASID-tagged
+ * TLB keeps warm across switches. Run it with fewer processes than the
+ * emulated TLB has ASID slots and with more, and compare the two with
+ * "info cpustats" in the monitor.
+ *
+ * usage: bench-ctxsw [round trips] [processes] [working set pages]
+ */
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static long iterations = 10000;
+static int nprocs = 2;
+static int npages = 16;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void touch(volatile char *buf, long pagesize)
+{
+    int i;
+
+    for (i = 0; i < npages; i++) {
+        buf[i * pagesize]++;
+    }
+}
+
+/* Pass the token from in to out iterations times. The first process
+ * starts the ring, so it reads one token fewer than it writes. */
+static void ring(int in, int out, int first, char *buf, long pagesize)
+{
+    char token = 0;
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        if (!first || i > 0) {
+            if (read(in, &token, 1) != 1) {
+                perror("read");
+                exit(1);
+            }
+        }
+        touch(buf, pagesize);
+        if (write(out, &token, 1) != 1) {
+            perror("write");
+            exit(1);
+        }
+    }
+    if (first && read(in, &token, 1) != 1) {
+        perror("read");
+        exit(1);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    int (*fds)[2];
+    char *buf;
+    double t;
+    int i;
+
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+    }
+    if (argc > 2) {
+        nprocs = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        npages = atoi(argv[3]);
+    }
+    assert(iterations > 0 && nprocs > 1 && npages >= 0);
+
+    fds = calloc(nprocs, sizeof(*fds));
+    buf = malloc(pagesize * (npages + 1));
+    assert(fds && buf);
+    memset(buf, 0, pagesize * (npages + 1));
+    for (i = 0; i < nprocs; i++) {
+        if (pipe(fds[i]) < 0) {
+            perror("pipe");
+            return 1;
+        }
+    }
+
+    /* process i reads from pipe i and writes to pipe i + 1 */
+    t = now();
+    for (i = 1; i < nprocs; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (pid == 0) {
+            ring(fds[i][0], fds[(i + 1) % nprocs][1], 0, buf, pagesize);
+            _exit(0);
+        }
+    }
+    ring(fds[0][0], fds[1][1], 1, buf, pagesize);
+    for (i = 1; i < nprocs; i++) {
+        wait(NULL);
+    }
+    t = now() - t;
+
+    printf("%d processes, %d pages: %ld round trips %8.3f s %8.1f us/switch\n",
+           nprocs, npages, iterations, t, t * 1e6 / (iterations * nprocs));
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * FP sign injection / compare / classify microbenchmark
+ *
+ * Times loops of fsgnj, flt/fle/feq, fmin/fmax and fclass on ordinary
+ * (non-NaN) operands and prints ns per instruction. A checksum of the
+ * results is printed so runs can be compared for correctness.
+ *
+ * usage: bench-fp [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+static long iterations = 10000000;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double t, uint64_t sum)
+{
+    printf("%-8s %8.3f s %8.1f ns/insn  sum %016" PRIx64 "\n", name, t,
+           t * 1e9 / iterations, sum);
+}
+
+#define BENCH_FP_OP(name, insn)                                         \
+static void bench_##name(double a, double b)                            \
+{                                                                       \
+    uint64_t sum = 0;                                                   \
+    double t = now();                                                   \
+    long i;                                                             \
+                                                                        \
+    for (i = 0; i < iterations; i++) {                                  \
+        double r;                                                       \
+        asm volatile(insn " %0, %1, %2" : "=f"(r) : "f"(a), "f"(b));    \
+        a = r;                                                          \
+        sum += (uint64_t)(int64_t)r;                                    \
+    }                                                                   \
+    report(#name, now() - t, sum);                                      \
+}
+
+#define BENCH_FP_CMP(name, insn)                                        \
+static void bench_##name(double a, double b)                            \
+{                                                                       \
+    uint64_t sum = 0;                                                   \
+    double t = now();                                                   \
+    long i;                                                             \
+                                                                        \
+    for (i = 0; i < iterations; i++) {                                  \
+        long r;                                                         \
+        asm volatile(insn " %0, %1, %2" : "=r"(r) : "f"(a), "f"(b));    \
+        sum += r;                                                       \
+        b = -b;                                                         \
+    }                                                                   \
+    report(#name, now() - t, sum);                                      \
+}
+
+BENCH_FP_OP(fsgnj, "fsgnj.d")
+BENCH_FP_OP(fsgnjn, "fsgnjn.d")
+BENCH_FP_OP(fsgnjx, "fsgnjx.d")
+BENCH_FP_OP(fmin, "fmin.d")
+BENCH_FP_OP(fmax, "fmax.d")
+BENCH_FP_CMP(flt, "flt.d")
+BENCH_FP_CMP(fle, "fle.d")
+BENCH_FP_CMP(feq, "feq.d")
+
+static void bench_fclass(double a)
+{
+    uint64_t sum = 0;
+    double t = now();
+    long i;
+
+    for (i = 0; i < iterations; i++) {
+        long r;
+        asm volatile("fclass.d %0, %1" : "=r"(r) : "f"(a));
+        sum += r;
+        a = -a;
+    }
+    report("fclass", now() - t, sum);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        iterations = atol(argv[1]);
+    }
+
+    bench_fsgnj(1.5, -2.0);
+    bench_fsgnjn(1.5, -2.0);
+    bench_fsgnjx(1.5, -2.0);
+    bench_fmin(1.5, -2.0);
+    bench_fmax(1.5, -2.0);
+    bench_flt(1.5, -2.0);
+    bench_fle(1.5, 1.5);
+    bench_feq(0.0, -0.0);
+    bench_fclass(3.0);
+    return 0;
+}
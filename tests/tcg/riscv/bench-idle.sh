@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+# Measure the host CPU time an idle riscv-softmmu guest burns.
+#
+# usage: bench-idle.sh [settle seconds] [sample seconds] -- qemu command line
+#
+# Boot a guest that sits at a shell prompt (or in its idle loop) with the
+# given command line, wait for it to settle, then report the share of one
+# host core the QEMU process used over the sample period. A guest whose
+# idle loop executes WFI should come out at a few percent at most; one
+# that spins shows close to 100% per hart.
+
+settle=${1:-30}
+sample=${2:-10}
+shift 2 2>/dev/null
+[ "$1" = "--" ] && shift
+if [ $# -eq 0 ]; then
+    echo "usage: $0 [settle] [sample] -- qemu-system-riscv ..." >&2
+    exit 1
+fi
+
+"$@" > /dev/null 2>&1 < /dev/null &
+pid=$!
+trap 'kill $pid 2>/dev/null' EXIT
+
+# utime + stime of the process, in clock ticks
+cputicks() {
+    awk '{ print $14 + $15 }' /proc/$pid/stat
+}
+
+sleep "$settle"
+kill -0 $pid 2>/dev/null || { echo "qemu exited during boot" >&2; exit 1; }
+t0=$(cputicks)
+sleep "$sample"
+t1=$(cputicks)
+
+hz=$(getconf CLK_TCK)
+echo "idle guest: $(echo "($t1 - $t0) * 100 / ($hz * $sample)" | bc -l | cut -c1-5)% of a host core"
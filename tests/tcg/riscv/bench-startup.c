@@ -0,0 +1,16 @@
+/*
+ * Startup microbenchmark
+ *
+ * Does nothing but write one line and exit, so timing it measures the
+ * cost of getting a process to its first instruction and back out. Run
+ * it with bench-startup.sh to compare qemu-riscv against starting it
+ * inside a booted riscv-softmmu guest.
+ */
+#include <unistd.h>
+
+int main(void)
+{
+    static const char msg[] = "hello\n";
+
+    return write(1, msg, sizeof(msg) - 1) != sizeof(msg) - 1;
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# Time N runs of bench-startup under user mode emulation.
+#
+# usage: bench-startup.sh [runs] [qemu-riscv] [sysroot]
+#
+# For comparison, run the same loop inside a riscv-softmmu guest that has
+# bench-startup in its root filesystem; the system mode figure excludes
+# the kernel boot, which user mode never pays.
+
+runs=${1:-100}
+qemu=${2:-qemu-riscv}
+sysroot=${3:+-L $3}
+prog=$(dirname "$0")/bench-startup
+
+start=$(date +%s.%N)
+i=0
+while [ $i -lt $runs ]; do
+    $qemu $sysroot "$prog" > /dev/null || exit 1
+    i=$((i + 1))
+done
+end=$(date +%s.%N)
+
+echo "$runs runs: $(echo "($end - $start) * 1000 / $runs" | bc -l | cut -c1-6) ms/run"
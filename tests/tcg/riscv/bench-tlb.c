@@ -0,0 +1,100 @@
+/*
+ * Software TLB microbenchmark
+ *
+ * Touches pages of a working set in a pseudo-random order, for working
+ * sets from a few pages to several thousand, so that the emulated TLB is
+ * first mostly idle and then far too small. Every so often a page is
+ * re-protected, which makes the kernel flush the TLB; that is when the
+ * emulator gets to resize it. Compare runs with different -tlb settings,
+ * and look at the TLB sizes with "info cpustats" in the monitor.
+ *
+ * usage: bench-tlb [accesses per working set] [accesses between flushes]
+ *                  [largest working set in pages]
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static long accesses = 4000000;
+static long flush_interval = 100000;
+static long max_pages = 8192;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* xorshift, so that consecutive touches land on unrelated TLB entries */
+static inline uint32_t next_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static double run(volatile char *buf, long npages, long pagesize)
+{
+    uint32_t state = 2463534242u;
+    char *flush_page = (char *)buf + npages * pagesize;
+    double t;
+    long i;
+
+    /* fault everything in first, this is not what we measure */
+    for (i = 0; i < npages; i++) {
+        buf[i * pagesize] = 0;
+    }
+
+    t = now();
+    for (i = 0; i < accesses; i++) {
+        buf[(next_rand(&state) % npages) * pagesize]++;
+        if (flush_interval && i % flush_interval == flush_interval - 1) {
+            mprotect(flush_page, pagesize, PROT_READ);
+            mprotect(flush_page, pagesize, PROT_READ | PROT_WRITE);
+        }
+    }
+    return now() - t;
+}
+
+int main(int argc, char **argv)
+{
+    long pagesize = sysconf(_SC_PAGESIZE);
+    char *buf;
+    long npages;
+
+    if (argc > 1) {
+        accesses = atol(argv[1]);
+    }
+    if (argc > 2) {
+        flush_interval = atol(argv[2]);
+    }
+    if (argc > 3) {
+        max_pages = atol(argv[3]);
+    }
+    assert(accesses > 0 && flush_interval >= 0 && max_pages > 0);
+
+    /* one extra page to re-protect */
+    buf = mmap(NULL, (max_pages + 1) * pagesize, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buf == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    for (npages = 16; npages <= max_pages; npages *= 4) {
+        double t = run(buf, npages, pagesize);
+
+        printf("%6ld pages: %ld accesses %8.3f s %8.1f ns/access\n",
+               npages, accesses, t, t * 1e9 / accesses);
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Compressed instruction test
+ *
+ * Runs the RVC forms with an implicit stack pointer (c.addi16sp,
+ * c.addi4spn, c.sdsp/ldsp, c.swsp/lwsp, c.fsdsp/fldsp) as a compiler for
+ * the C extension emits them, with x2 as the stack pointer, and checks
+ * what they loaded and stored. The instructions are given as halfwords so
+ * that the test does not depend on the assembler supporting RVC; x2 is
+ * pointed at a buffer of its own and restored afterwards, so it does not
+ * matter which ABI the rest of the program was built for.
+ *
+ * usage: test-rvc
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+static uint64_t stack[2048];
+
+int main(void)
+{
+    uint64_t *base = &stack[1024];
+    uint8_t *sp = (uint8_t *)base - 64;
+    int64_t want_lw = (int32_t)(uintptr_t)(sp + 16);
+    int failed = 0;
+
+    asm volatile(
+        "sd     x2, 0(%0)\n\t"
+        "addi   x2, %0, 0\n\t"
+        ".2byte 0x4415\n\t"     /* c.li       x8, 5         */
+        ".2byte 0x7139\n\t"     /* c.addi16sp x2, -64       */
+        ".2byte 0xe422\n\t"     /* c.sdsp     x8, 8(x2)     */
+        ".2byte 0x0804\n\t"     /* c.addi4spn x9, x2, 16    */
+        ".2byte 0x441d\n\t"     /* c.li       x8, 7         */
+        ".2byte 0x6422\n\t"     /* c.ldsp     x8, 8(x2)     */
+        ".2byte 0xf022\n\t"     /* c.sdsp     x8, 32(x2)    */
+        ".2byte 0xc826\n\t"     /* c.swsp     x9, 16(x2)    */
+        ".2byte 0x2422\n\t"     /* c.fldsp    f8, 8(x2)     */
+        ".2byte 0xac22\n\t"     /* c.fsdsp    f8, 24(x2)    */
+        ".2byte 0x4442\n\t"     /* c.lwsp     x8, 16(x2)    */
+        ".2byte 0x6121\n\t"     /* c.addi16sp x2, 64        */
+        "sd     x8, 8(x2)\n\t"
+        "ld     x2, 0(x2)\n\t"
+        : : "r" (base) : "x8", "x9", "f8", "memory");
+
+    if (*(uint64_t *)(sp + 8) != 5) {
+        printf("c.sdsp stored %" PRIx64 "\n", *(uint64_t *)(sp + 8));
+        failed = 1;
+    }
+    if (*(uint64_t *)(sp + 32) != 5) {
+        printf("c.ldsp loaded %" PRIx64 "\n", *(uint64_t *)(sp + 32));
+        failed = 1;
+    }
+    if (*(int32_t *)(sp + 16) != (int32_t)want_lw) {
+        printf("c.addi4spn/c.swsp stored %x, want %x\n",
+               *(int32_t *)(sp + 16), (int32_t)want_lw);
+        failed = 1;
+    }
+    if (*(uint64_t *)(sp + 24) != 5) {
+        printf("c.fldsp/c.fsdsp stored %" PRIx64 "\n", *(uint64_t *)(sp + 24));
+        failed = 1;
+    }
+    if ((int64_t)base[1] != want_lw) {
+        printf("c.lwsp loaded %" PRIx64 ", want %" PRIx64 "\n",
+               base[1], (uint64_t)want_lw);
+        failed = 1;
+    }
+    printf("%s\n", failed ? "FAIL" : "ok");
+    return failed;
+}
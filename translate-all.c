@@ -58,6 +58,7 @@
 
 #include "exec/cputlb.h"
 #include "translate-all.h"
+#include "tb-cache.h"
 #include "qemu/timer.h"
 
 //#define DEBUG_TB_INVALIDATE
@@ -562,6 +563,34 @@ static inline void *alloc_code_gen_buffer(void)
 }
 #endif /* USE_STATIC_CODE_GEN_BUFFER, USE_MMAP */
 
+/* Split the buffer into regions, each with its share of the TB array */
+static void tb_region_init(void)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    size_t size;
+    int n, i;
+
+    n = tcg_ctx.code_gen_buffer_size / CODE_GEN_MIN_REGION_SIZE;
+    n = MIN(MAX(n, 1), CODE_GEN_REGIONS);
+    size = (tcg_ctx.code_gen_buffer_size / n) & ~(CODE_GEN_ALIGN - 1);
+
+    tb_ctx->nb_regions = n;
+    tb_ctx->cur_region = 0;
+    tb_ctx->region_max_blocks = tcg_ctx.code_gen_max_blocks / n;
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &tb_ctx->regions[i];
+
+        r->start = tcg_ctx.code_gen_buffer + i * size;
+        r->limit = r->start + size - TCG_MAX_OP_SIZE * OPC_BUF_SIZE;
+        r->ptr = r->start;
+        r->tbs = tb_ctx->tbs + i * tb_ctx->region_max_blocks;
+        r->nb_tbs = 0;
+        r->last_used = 0;
+    }
+    tcg_ctx.code_gen_buffer_max_size = n * (size - TCG_MAX_OP_SIZE *
+                                            OPC_BUF_SIZE);
+}
+
 static inline void code_gen_alloc(size_t tb_size)
 {
     tcg_ctx.code_gen_buffer_size = size_code_gen_buffer(tb_size);
@@ -583,12 +612,11 @@ static inline void code_gen_alloc(size_t tb_size)
             tcg_ctx.code_gen_buffer_size - 1024;
     tcg_ctx.code_gen_buffer_size -= 1024;
 
-    tcg_ctx.code_gen_buffer_max_size = tcg_ctx.code_gen_buffer_size -
-        (TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
     tcg_ctx.code_gen_max_blocks = tcg_ctx.code_gen_buffer_size /
             CODE_GEN_AVG_BLOCK_SIZE;
     tcg_ctx.tb_ctx.tbs =
             g_malloc(tcg_ctx.code_gen_max_blocks * sizeof(TranslationBlock));
+    tb_region_init();
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -613,32 +641,39 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* Allocate a new translation block in the current region. Return NULL
+   if the region has too many translation blocks or too much generated
+   code. */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &tb_ctx->regions[tb_ctx->cur_region];
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks ||
-        (tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer) >=
-         tcg_ctx.code_gen_buffer_max_size) {
+    if (r->nb_tbs >= tb_ctx->region_max_blocks ||
+        tcg_ctx.code_gen_ptr >= r->limit) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &r->tbs[r->nb_tbs++];
+    tb_ctx->nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->region = tb_ctx->cur_region;
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &tb_ctx->regions[tb_ctx->cur_region];
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
-        tcg_ctx.tb_ctx.nb_tbs--;
+        r->nb_tbs--;
+        tb_ctx->nb_tbs--;
     }
 }
 
@@ -689,6 +724,7 @@ static void page_flush_tb(void)
 void tb_flush(CPUArchState *env1)
 {
     CPUState *cpu = ENV_GET_CPU(env1);
+    int i;
 
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
@@ -702,6 +738,14 @@ void tb_flush(CPUArchState *env1)
         cpu_abort(cpu, "Internal error: code buffer overflow\n");
     }
     tcg_ctx.tb_ctx.nb_tbs = 0;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+        r->nb_tbs = 0;
+        r->ptr = r->start;
+        r->last_used = 0;
+    }
+    tcg_ctx.tb_ctx.cur_region = 0;
 
     CPU_FOREACH(cpu) {
         memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
@@ -882,6 +926,106 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
 }
 
+static inline tb_page_addr_t tb_phys_pc(TranslationBlock *tb)
+{
+    return tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+}
+
+/* Whether tb is still in the physical hash table, i.e. not invalidated */
+static bool tb_is_linked(TranslationBlock *tb)
+{
+    TranslationBlock *tb1;
+
+    for (tb1 = tcg_ctx.tb_ctx.tb_phys_hash[tb_phys_hash_func(tb_phys_pc(tb))];
+         tb1; tb1 = tb1->phys_hash_next) {
+        if (tb1 == tb) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Invalidate the TBs of a region that are still live and empty it */
+static void tb_region_evict(int i)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &tb_ctx->regions[i];
+    int j;
+
+    if (r->nb_tbs == 0) {
+        return;
+    }
+    for (j = 0; j < r->nb_tbs; j++) {
+        TranslationBlock *tb = &r->tbs[j];
+
+        if (tb_is_linked(tb)) {
+            set_bit(tb_phys_hash_func(tb_phys_pc(tb)), tb_ctx->evicted_pc);
+            tb_phys_invalidate(tb, -1);
+            tb_ctx->tb_evict_count++;
+        }
+    }
+    tb_ctx->nb_tbs -= r->nb_tbs;
+    r->nb_tbs = 0;
+    r->ptr = r->start;
+    r->last_used = 0;
+    tb_ctx->region_evict_count++;
+}
+
+/* Whether some CPU is executing code of region i. In user mode a thread
+   can stay in a chained loop for as long as it likes. */
+static bool tb_region_running(int i)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        TranslationBlock *tb = cpu->current_tb;
+
+        if (tb && tb->region == i) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* The current region is full: go on in the least recently used one that
+   no CPU is running, evicting its TBs. TBs that stay in use are in
+   recently used regions, or get translated again into the new one. With
+   a single region this is a plain flush. */
+static void tb_region_next(CPUArchState *env)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    int i, victim = -1;
+    bool victim_running = true;
+
+    if (tb_ctx->nb_regions == 1) {
+        tb_flush(env);
+        return;
+    }
+    for (i = 0; i < tb_ctx->nb_regions; i++) {
+        bool running;
+
+        if (i == tb_ctx->cur_region) {
+            continue;
+        }
+        running = tb_region_running(i);
+        if (victim < 0 || victim_running > running ||
+            (victim_running == running &&
+             tb_ctx->regions[i].last_used <
+             tb_ctx->regions[victim].last_used)) {
+            victim = i;
+            victim_running = running;
+        }
+    }
+#if defined(DEBUG_FLUSH)
+    printf("qemu: evict region %d (%d TBs)\n", victim,
+           tb_ctx->regions[victim].nb_tbs);
+#endif
+    tb_ctx->regions[tb_ctx->cur_region].ptr = tcg_ctx.code_gen_ptr;
+    tb_region_evict(victim);
+    tb_ctx->cur_region = victim;
+    tcg_ctx.code_gen_ptr = tb_ctx->regions[victim].start;
+}
+
 static inline void set_bits(uint8_t *tab, int start, int len)
 {
     int end, mask, end1;
@@ -952,19 +1096,32 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     phys_pc = get_page_addr_code(env, pc);
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+        /* make room */
+        tb_region_next(env);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         /* Don't forget to invalidate previous TB info.  */
         tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
     }
+    tb_mark_used(&tcg_ctx.tb_ctx, tb);
+    tcg_ctx.tb_ctx.tb_gen_count++;
+    if (test_and_clear_bit(tb_phys_hash_func(phys_pc),
+                           tcg_ctx.tb_ctx.evicted_pc)) {
+        tcg_ctx.tb_ctx.tb_retranslate_count++;
+    }
     tc_ptr = tcg_ctx.code_gen_ptr;
     tb->tc_ptr = tc_ptr;
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+#ifdef TB_CACHE_SUPPORTED
+    if (!tb_cache_lookup(cpu, tb, phys_pc, &code_gen_size)) {
+        cpu_gen_code(env, tb, &code_gen_size);
+        tb_cache_insert(cpu, tb, phys_pc, code_gen_size);
+    }
+#else
     cpu_gen_code(env, tb, &code_gen_size);
+#endif
     tcg_ctx.code_gen_ptr = (void *)(((uintptr_t)tcg_ctx.code_gen_ptr +
             code_gen_size + CODE_GEN_ALIGN - 1) & ~(CODE_GEN_ALIGN - 1));
 
@@ -1325,23 +1482,31 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = NULL;
+    int m_min, m_max, m, i;
     uintptr_t v;
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
-        return NULL;
+    for (i = 0; i < tb_ctx->nb_regions; i++) {
+        uint8_t *end = i == tb_ctx->cur_region ? tcg_ctx.code_gen_ptr
+                                               : tb_ctx->regions[i].ptr;
+
+        if (tc_ptr >= (uintptr_t)tb_ctx->regions[i].start &&
+            tc_ptr < (uintptr_t)end) {
+            r = &tb_ctx->regions[i];
+            break;
+        }
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    if (r == NULL || r->nb_tbs <= 0) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1351,7 +1516,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 #if defined(TARGET_HAS_ICE) && !defined(CONFIG_USER_ONLY)
@@ -1496,8 +1661,10 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
 
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    ptrdiff_t code_size;
     TranslationBlock *tb;
 
     target_code_size = 0;
@@ -1505,55 +1672,67 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    code_size = 0;
+    for (i = 0; i < tb_ctx->nb_regions; i++) {
+        TBRegion *r = &tb_ctx->regions[i];
+
+        code_size += (i == tb_ctx->cur_region ? tcg_ctx.code_gen_ptr : r->ptr)
+                     - r->start;
+        for (j = 0; j < r->nb_tbs; j++) {
+            tb = &r->tbs[j];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_buffer_max_size);
+                code_size, tcg_ctx.code_gen_buffer_max_size);
+    cpu_fprintf(f, "code regions        %d (current %d)\n",
+                tb_ctx->nb_regions, tb_ctx->cur_region);
     cpu_fprintf(f, "TB count            %d/%d\n",
-            tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
+            tb_ctx->nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
-            tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
-                    tcg_ctx.tb_ctx.nb_tbs : 0,
+            tb_ctx->nb_tbs ? target_code_size / tb_ctx->nb_tbs : 0,
             max_target_code_size);
     cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+            tb_ctx->nb_tbs ? code_size / tb_ctx->nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
-            tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
-                                    tcg_ctx.tb_ctx.nb_tbs : 0);
+            tb_ctx->nb_tbs ? (cross_page * 100) / tb_ctx->nb_tbs : 0);
     cpu_fprintf(f, "direct jump count   %d (%d%%) (2 jumps=%d %d%%)\n",
                 direct_jmp_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0,
+                tb_ctx->nb_tbs ? (direct_jmp_count * 100) /
+                        tb_ctx->nb_tbs : 0,
                 direct_jmp2_count,
-                tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
-                        tcg_ctx.tb_ctx.nb_tbs : 0);
+                tb_ctx->nb_tbs ? (direct_jmp2_count * 100) /
+                        tb_ctx->nb_tbs : 0);
     cpu_fprintf(f, "\nStatistics:\n");
-    cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB flush count      %d\n", tb_ctx->tb_flush_count);
     cpu_fprintf(f, "TB invalidate count %d\n",
-            tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+            tb_ctx->tb_phys_invalidate_count);
+    cpu_fprintf(f, "region evictions    %d (%" PRId64 " TBs)\n",
+                tb_ctx->region_evict_count, tb_ctx->tb_evict_count);
+    cpu_fprintf(f, "TB retranslations   %" PRId64 "/%" PRId64 " (%d%%)\n",
+                tb_ctx->tb_retranslate_count, tb_ctx->tb_gen_count,
+                tb_ctx->tb_gen_count ? (int)(tb_ctx->tb_retranslate_count *
+                                             100 / tb_ctx->tb_gen_count) : 0);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    cpu_fprintf(f, "TLB victim hits     %" PRIu64 "\n", tlb_victim_hit_count);
+    cpu_fprintf(f, "TLB resize count    %d\n", tlb_resize_count);
+    cpu_fprintf(f, "TLB large page flushes %d\n", tlb_large_page_flush_count);
+    tb_cache_dump_info(f, cpu_fprintf);
     tcg_dump_info(f, cpu_fprintf);
 }
 
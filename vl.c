@@ -112,6 +112,7 @@ int main(int argc, char **argv)
 #include "qemu/queue.h"
 #include "sysemu/cpus.h"
 #include "sysemu/arch_init.h"
+#include "tb-cache.h"
 #include "qemu/osdep.h"
 
 #include "ui/qemu-spice.h"
@@ -154,6 +155,9 @@ int win2k_install_hack = 0;
 int singlestep = 0;
 int smp_cpus = 1;
 int max_cpus = 0;
+unsigned int tlb_entries;
+unsigned int tlb_entries_min;
+unsigned int tlb_entries_max;
 int smp_cores = 1;
 int smp_threads = 1;
 #ifdef CONFIG_VNC
@@ -382,6 +386,10 @@ static QemuOptsList qemu_machine_opts = {
             .name = "kvm-type",
             .type = QEMU_OPT_STRING,
             .help = "Specifies the KVM virtualization mode (HV, PR)",
+        },{
+            .name = "mem-image",
+            .type = QEMU_OPT_STRING,
+            .help = "RAM image to map copy-on-write at address 0",
         },
         { /* End of list */ }
     },
@@ -1431,6 +1439,79 @@ static void smp_parse(QemuOpts *opts)
 
 }
 
+static QemuOptsList qemu_tlb_opts = {
+    .name = "tlb-opts",
+    .implied_opt_name = "size",
+    .merge_lists = true,
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_tlb_opts.head),
+    .desc = {
+        {
+            .name = "size",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "min",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "max",
+            .type = QEMU_OPT_NUMBER,
+        },
+        { /*End of list */ }
+    },
+};
+
+/* Zero leaves the choice to cputlb.c, see tlb_init() */
+static void tlb_parse(QemuOpts *opts)
+{
+    if (!opts) {
+        return;
+    }
+    tlb_entries = qemu_opt_get_number(opts, "size", 0);
+    tlb_entries_min = qemu_opt_get_number(opts, "min", 0);
+    tlb_entries_max = qemu_opt_get_number(opts, "max", 0);
+    if (tlb_entries_max && tlb_entries_min > tlb_entries_max) {
+        fprintf(stderr, "-tlb: min must not be greater than max\n");
+        exit(1);
+    }
+}
+
+static QemuOptsList qemu_tb_cache_opts = {
+    .name = "tb-cache",
+    .implied_opt_name = "file",
+    .merge_lists = true,
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_tb_cache_opts.head),
+    .desc = {
+        {
+            .name = "file",
+            .type = QEMU_OPT_STRING,
+        }, {
+            .name = "size",
+            .type = QEMU_OPT_SIZE,
+        },
+        { /*End of list */ }
+    },
+};
+
+static void tb_cache_parse(QemuOpts *opts)
+{
+    const char *path;
+    uint64_t size;
+
+    if (!opts || !tcg_enabled()) {
+        return;
+    }
+    path = qemu_opt_get(opts, "file");
+    if (!path || !*path) {
+        fprintf(stderr, "-tb-cache: a file name is required\n");
+        exit(1);
+    }
+    size = qemu_opt_get_size(opts, "size", TB_CACHE_DEFAULT_SIZE);
+    if (size == 0) {
+        fprintf(stderr, "-tb-cache: size must not be 0\n");
+        exit(1);
+    }
+    tb_cache_init(path, size);
+}
+
 static void configure_realtime(QemuOpts *opts)
 {
     bool enable_mlock;
@@ -2988,6 +3069,8 @@ int main(int argc, char **argv, char **envp)
     qemu_add_opts(&qemu_option_rom_opts);
     qemu_add_opts(&qemu_machine_opts);
     qemu_add_opts(&qemu_smp_opts);
+    qemu_add_opts(&qemu_tlb_opts);
+    qemu_add_opts(&qemu_tb_cache_opts);
     qemu_add_opts(&qemu_boot_opts);
     qemu_add_opts(&qemu_sandbox_opts);
     qemu_add_opts(&qemu_add_fd_opts);
@@ -3779,6 +3862,16 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_tlb:
+                if (!qemu_opts_parse(qemu_find_opts("tlb-opts"), optarg, 1)) {
+                    exit(1);
+                }
+                break;
+            case QEMU_OPTION_tb_cache:
+                if (!qemu_opts_parse(qemu_find_opts("tb-cache"), optarg, 1)) {
+                    exit(1);
+                }
+                break;
             case QEMU_OPTION_icount:
                 icount_option = optarg;
                 break;
@@ -4000,6 +4093,7 @@ int main(int argc, char **argv, char **envp)
     }
 
     smp_parse(qemu_opts_find(qemu_find_opts("smp-opts"), NULL));
+    tlb_parse(qemu_opts_find(qemu_find_opts("tlb-opts"), NULL));
 
     machine->max_cpus = machine->max_cpus ?: 1; /* Default to UP */
     if (smp_cpus > machine->max_cpus) {
@@ -4165,6 +4259,7 @@ int main(int argc, char **argv, char **envp)
     }
 
     configure_accelerator(machine);
+    tb_cache_parse(qemu_opts_find(qemu_find_opts("tb-cache"), NULL));
 
     if (qtest_chrdev) {
         Error *local_err = NULL;